@@ -0,0 +1,47 @@
+#include "ofApp.h"
+
+// Headless usage on a GPU-less Linux box (Mesa software rasterizer):
+//   xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 ./bin/example_benchmark --out bench.json
+// Options:
+//   --cpu          use the CPU simulation backend
+//   --compute      use the compute shader backend (opens a GL 4.3 context)
+//   --packed       use the packed particle state layout
+//   --fixed16      store positions as 16-bit fixed-point (--fixed32 for 32-bit)
+//   --capacity     allocate state once for 2^18 particles; resizes only change the active count
+//   --prepare      combine the two fields into one prepared texture instead of sampling both per particle
+//   --quick        fewer particle counts and iterations, for smoke runs
+//   --out <path>   where to write the JSON report (default bin/data/benchmark.json)
+int main(int argc, char* argv[]) {
+  auto app = std::make_shared<ofApp>();
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--cpu") {
+      app->settings.backend = ofxParticleField::ParticleField::Backend::CPU;
+    } else if (arg == "--compute") {
+      app->settings.backend = ofxParticleField::ParticleField::Backend::COMPUTE;
+    } else if (arg == "--packed") {
+      app->settings.stateLayout = ofxParticleField::StateLayoutType::PACKED;
+    } else if (arg == "--fixed16") {
+      app->settings.positionEncoding = ofxParticleField::PositionEncoding::FIXED16;
+    } else if (arg == "--fixed32") {
+      app->settings.positionEncoding = ofxParticleField::PositionEncoding::FIXED32;
+    } else if (arg == "--capacity") {
+      app->settings.particleCapacity = 1 << 18;
+    } else if (arg == "--prepare") {
+      app->settings.prepareFields = true;
+    } else if (arg == "--quick") {
+      app->quick = true;
+    } else if (arg == "--out" && i + 1 < argc) {
+      app->outputPath = argv[++i];
+    }
+  }
+
+  ofGLWindowSettings settings;
+  bool compute = (app->settings.backend == ofxParticleField::ParticleField::Backend::COMPUTE);
+  settings.setGLVersion(4, compute ? 3 : 1);
+  settings.setSize(256, 256);
+  auto window = ofCreateWindow(settings);
+
+  ofRunApp(window, app);
+  ofRunMainLoop();
+}
@@ -0,0 +1,336 @@
+#include <chrono>
+#include <numeric>
+
+#include "ofApp.h"
+#include "Simd.h"
+
+using ofxParticleField::ParticleField;
+
+namespace {
+
+// Sweep axes. Everything is fixed or seeded so consecutive runs on the same machine can be diffed.
+const std::vector<int> FIELD_RESOLUTIONS { 64, 256, 1024 };
+const std::vector<float> POINT_SIZES { 1.0f, 4.0f, 16.0f };
+const std::vector<int> FBO_SIZES { 1024, 4096 };
+
+const size_t FBO_BYTES_PER_PIXEL = 4; // GL_RGBA8
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setup(){
+  ofSetVerticalSync(false);
+  ofSetFrameRate(0);
+  ofDisableArbTex();
+  ofSeedRandom(0);
+  if (quick) {
+    warmupIterations = 2;
+    iterations = 5;
+  }
+}
+
+//--------------------------------------------------------------
+void ofApp::update(){
+  if (finished) return;
+  runBenchmark();
+  finished = true;
+  ofExit();
+}
+
+//--------------------------------------------------------------
+void ofApp::draw(){
+}
+
+//--------------------------------------------------------------
+// Fixed noise slice so every run samples the same field values
+const ofFloatPixels& ofApp::getFieldPixels(int resolution, float scale) {
+  auto key = std::make_pair(resolution, scale);
+  auto it = fieldPixelsCache.find(key);
+  if (it != fieldPixelsCache.end()) return it->second;
+
+  ofFloatPixels& pixels = fieldPixelsCache[key];
+  pixels.allocate(resolution, resolution, OF_PIXELS_RGB);
+  float normalizedScale = scale * 200.0f / resolution; // same features regardless of resolution
+  for (int y = 0; y < resolution; ++y) {
+    for (int x = 0; x < resolution; ++x) {
+      float n1 = ofNoise(x * normalizedScale, y * normalizedScale, 0.5f);
+      float n2 = ofNoise((x + 5000) * normalizedScale, (y + 5000) * normalizedScale, 0.5f);
+      pixels.setColor(x, y, ofFloatColor(n1, n2, 0.0, 0.0));
+    }
+  }
+  return pixels;
+}
+
+//--------------------------------------------------------------
+// Wall-clock around glFinish() so queued GPU work is attributed to the stage that issued it
+ofApp::Timing ofApp::timeStage(const std::function<void()>& stage) {
+  for (int i = 0; i < warmupIterations; ++i) {
+    stage();
+  }
+  glFinish();
+
+  std::vector<double> samples;
+  samples.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    stage();
+    glFinish();
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+
+  std::sort(samples.begin(), samples.end());
+  double sum = std::accumulate(samples.begin(), samples.end(), 0.0);
+  return { samples[samples.size() / 2], samples.front(), sum / samples.size() };
+}
+
+ofJson ofApp::makeResult(const std::string& stage, int ln2ParticleCount, size_t particleCount, const Timing& timing, size_t bytesPerFrame) {
+  ofJson result;
+  result["stage"] = stage;
+  result["ln2ParticleCount"] = ln2ParticleCount;
+  result["particleCount"] = particleCount;
+  result["msMedian"] = timing.msMedian;
+  result["msMin"] = timing.msMin;
+  result["msMean"] = timing.msMean;
+  result["particlesPerSecond"] = (timing.msMedian > 0.0) ? particleCount / (timing.msMedian / 1000.0) : 0.0;
+  result["bytesPerFrame"] = bytesPerFrame;
+  return result;
+}
+
+//--------------------------------------------------------------
+void ofApp::runBenchmark() {
+  ofJson report;
+  report["schemaVersion"] = 1;
+  const char* backends[] = { "gpu", "cpu", "compute" };
+  report["backend"] = backends[(int)settings.backend];
+  report["stateLayout"] = (settings.stateLayout == ofxParticleField::StateLayoutType::PACKED) ? "packed" : "separate";
+  const char* positionEncodings[] = { "float", "fixed16", "fixed32" };
+  report["positionEncoding"] = positionEncodings[(int)settings.positionEncoding];
+  report["particleCapacity"] = settings.particleCapacity;
+  report["prepareFields"] = settings.prepareFields;
+  report["simd"] = ofxParticleField::simd::name;
+  report["workerThreads"] = ofxParticleField::WorkerPool::shared().getThreadCount();
+  report["glRenderer"] = (const char*)glGetString(GL_RENDERER);
+  report["glVersion"] = (const char*)glGetString(GL_VERSION);
+  report["warmupIterations"] = warmupIterations;
+  report["iterations"] = iterations;
+  ofJson results = ofJson::array();
+
+  std::vector<int> ln2Counts;
+  for (int ln2 = 8; ln2 <= 18; ln2 += (quick ? 5 : 1)) ln2Counts.push_back(ln2);
+
+  for (int ln2 : ln2Counts) {
+    ofLogNotice("benchmark") << "ln2ParticleCount " << ln2;
+    int particleCount = 1 << ln2;
+
+    ofSeedRandom(ln2);
+    ParticleField particleField;
+    particleField.ln2ParticleCountParameter = ln2;
+    particleField.setup(ofFloatColor(0.5, 0.3, 1.0, 0.7), -0.5, -0.5, settings);
+    size_t actualCount = particleField.getParticleCount();
+
+    // update() against each field resolution
+    for (int resolution : FIELD_RESOLUTIONS) {
+      const ofFloatPixels& field1 = getFieldPixels(resolution, 0.001f);
+      const ofFloatPixels& field2 = getFieldPixels(resolution, 0.01f);
+      particleField.setField1(field1);
+      particleField.setField2(field2);
+      size_t fieldBytes = 2 * 4 * field1.getNumChannels() * sizeof(float); // two bilinear samples of four texels
+      Timing timing = timeStage([&] { particleField.update(); });
+      ofJson result = makeResult("update", ln2, actualCount, timing, actualCount * (particleField.getUpdateBytesPerParticle() + fieldBytes));
+      result["fieldResolution"] = resolution;
+      results.push_back(result);
+    }
+
+    // update() with a full-state readback queued after it; captures are dropped rather than waited for
+    {
+      particleField.enableReadback({ true, 1 });
+      ofxParticleField::ParticleReadback& readback = particleField.getReadback();
+      Timing timing = timeStage([&] {
+        particleField.update();
+        readback.getView();
+      });
+      ofJson result = makeResult("readback", ln2, actualCount, timing, readback.getLastCaptureBytes());
+      result["droppedCaptures"] = readback.getDroppedCaptureCount();
+      results.push_back(result);
+      particleField.disableReadback();
+    }
+
+    // update() with the population statistics reduced after it; the reduction alone is in its GPU stage timing
+    {
+      particleField.enablePopulationStats();
+      Timing timing = timeStage([&] {
+        particleField.update();
+        particleField.getPopulationStats();
+      });
+      ofJson result = makeResult("populationStats", ln2, actualCount, timing, actualCount * particleField.getUpdateBytesPerParticle());
+      auto reductionStats = particleField.getStats(ofxParticleField::Stage::POPULATION_STATS);
+      auto updateStats = particleField.getStats(ofxParticleField::Stage::UPDATE);
+      result["reductionGpuMeanMs"] = reductionStats.gpu.meanMs;
+      result["updateGpuMeanMs"] = updateStats.gpu.meanMs;
+      result["meanSpeed"] = particleField.getPopulationStats().meanSpeed;
+      results.push_back(result);
+      particleField.disablePopulationStats();
+    }
+
+    // draw() for each output size and point size
+    for (int fboSize : FBO_SIZES) {
+      ofFbo fbo;
+      fbo.allocate(fboSize, fboSize, GL_RGBA);
+      for (float pointSize : POINT_SIZES) {
+        ParticleField::ParameterOverrides overrides;
+        overrides.particleSize = pointSize;
+        particleField.setParameterOverrides(overrides);
+        fbo.begin();
+        ofClear(0, 0);
+        fbo.end();
+        ofEnableBlendMode(OF_BLENDMODE_SCREEN);
+        Timing timing = timeStage([&] { particleField.draw(fbo); });
+        ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+        // Upper bound on fragments: full circular sprites blending into the FBO; faint particles are culled and slow ones shrink
+        size_t fragmentBytes = (size_t)(pointSize * pointSize * PI / 4.0f * (2 * FBO_BYTES_PER_PIXEL));
+        ofJson result = makeResult("draw", ln2, actualCount, timing, actualCount * (particleField.getDrawBytesPerParticle() + fragmentBytes));
+        result["fboSize"] = fboSize;
+        result["pointSize"] = pointSize;
+        results.push_back(result);
+      }
+      particleField.clearParameterOverrides();
+    }
+
+    // Full-size and small particles into two FBOs: two draw() calls, then one draw() of both targets
+    for (int fboSize : FBO_SIZES) {
+      ofFbo foregroundFbo, smallFbo;
+      foregroundFbo.allocate(fboSize, fboSize, GL_RGBA);
+      smallFbo.allocate(fboSize, fboSize, GL_RGBA);
+      ofEnableBlendMode(OF_BLENDMODE_SCREEN);
+      Timing separate = timeStage([&] {
+        particleField.draw(foregroundFbo);
+        particleField.draw(smallFbo, true);
+      });
+      Timing combined = timeStage([&] {
+        particleField.draw({ particleField.makeDrawTarget(foregroundFbo), particleField.makeDrawTarget(smallFbo, true) });
+      });
+      ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+      ofJson result = makeResult("drawTargets", ln2, actualCount, combined, actualCount * particleField.getDrawBytesPerParticle());
+      result["fboSize"] = fboSize;
+      result["targets"] = 2;
+      result["separateMsMedian"] = separate.msMedian;
+      result["gain"] = (combined.msMedian > 0.0) ? separate.msMedian / combined.msMedian : 1.0;
+      results.push_back(result);
+    }
+
+    // update() plus draw() into the largest FBO, before and after one spatial sort of the particles
+    {
+      ofFbo fbo;
+      fbo.allocate(FBO_SIZES.back(), FBO_SIZES.back(), GL_RGBA);
+      auto updateAndDraw = [&] {
+        particleField.update();
+        particleField.draw(fbo);
+      };
+      Timing unsorted = timeStage(updateAndDraw);
+      ofxParticleField::SpatialSorter::Settings sortSettings;
+      sortSettings.intervalUpdates = 1 << 30; // only the sort captured on enabling
+      particleField.enableSpatialSort(sortSettings);
+      for (int i = 0; i < 1000 && particleField.getSpatialSortStatistics().sortCount == 0; ++i) {
+        particleField.update();
+        glFinish();
+      }
+      Timing sorted = timeStage(updateAndDraw);
+      ofJson result = makeResult("spatialSort", ln2, actualCount, sorted, actualCount * (particleField.getUpdateBytesPerParticle() + particleField.getDrawBytesPerParticle()));
+      result["unsortedMsMedian"] = unsorted.msMedian;
+      result["gain"] = (sorted.msMedian > 0.0) ? unsorted.msMedian / sorted.msMedian : 1.0;
+      result["sortWorkMs"] = particleField.getSpatialSortStatistics().lastSortWorkMs;
+      results.push_back(result);
+      particleField.disableSpatialSort();
+    }
+
+    // update() with separation, alignment and pressure between neighbours; not available on the GPU backend
+    if (settings.backend != ParticleField::Backend::GPU) {
+      ofxParticleField::InteractionParameters interaction;
+      interaction.separation = 0.001f;
+      interaction.alignment = 0.01f;
+      interaction.pressure = 0.0005f;
+      particleField.setInteractionParameters(interaction);
+      Timing timing = timeStage([&] { particleField.update(); });
+      ofJson result = makeResult("interaction", ln2, actualCount, timing, actualCount * particleField.getUpdateBytesPerParticle());
+      result["radius"] = interaction.radius;
+      result["maxNeighbours"] = interaction.maxNeighbours;
+      results.push_back(result);
+      particleField.setInteractionParameters({});
+    }
+
+    // update() plus draw() of eight fields with an eighth of the particles each, separately and as one group
+    if (settings.backend == ParticleField::Backend::GPU) {
+      const size_t groupMembers = 8;
+      ofTexture fieldTexture;
+      fieldTexture.loadData(getFieldPixels(FIELD_RESOLUTIONS.front(), 0.001f));
+      ofFbo fbo;
+      fbo.allocate(FBO_SIZES.front(), FBO_SIZES.front(), GL_RGBA);
+      ParticleField::Settings memberSettings = settings;
+      memberSettings.particleCapacity = 0;
+      std::vector<std::unique_ptr<ParticleField>> separateFields;
+      ofxParticleField::ParticleFieldGroup group;
+      for (size_t i = 0; i < groupMembers; ++i) {
+        separateFields.push_back(std::make_unique<ParticleField>());
+        separateFields.back()->ln2ParticleCountParameter = ln2 - 3;
+        separateFields.back()->setup(ofFloatColor(0.5, 0.3, 1.0, 0.7), -0.5, -0.5, memberSettings);
+        separateFields.back()->setField1(fieldTexture);
+        ParticleField* member = group.addMember(ofFloatColor(0.5, 0.3, 1.0, 0.7), -0.5, -0.5);
+        member->ln2ParticleCountParameter = ln2 - 3;
+        member->setField1(fieldTexture);
+      }
+      ofxParticleField::ParticleFieldGroup::Settings groupSettings;
+      groupSettings.stateLayout = settings.stateLayout;
+      groupSettings.positionEncoding = settings.positionEncoding;
+      group.setup(groupSettings);
+
+      Timing separate = timeStage([&] {
+        for (auto& field : separateFields) {
+          field->update();
+          field->draw(fbo);
+        }
+      });
+      Timing grouped = timeStage([&] {
+        group.update();
+        group.draw(fbo);
+      });
+      size_t groupCount = group.getParticleCount();
+      ofJson result = makeResult("group", ln2, groupCount, grouped, groupCount * (particleField.getUpdateBytesPerParticle() + particleField.getDrawBytesPerParticle()));
+      result["members"] = groupMembers;
+      result["separateMsMedian"] = separate.msMedian;
+      result["gain"] = (grouped.msMedian > 0.0) ? separate.msMedian / grouped.msMedian : 1.0;
+      results.push_back(result);
+    }
+
+    // Reseeding every particle (initializeParticleRegion over the whole state)
+    {
+      Timing timing = timeStage([&] { particleField.reinitializeParticles(); });
+      results.push_back(makeResult("init", ln2, actualCount, timing, actualCount * particleField.getUpdateBytesPerParticle() / 2));
+    }
+
+    // Growing from half the particles: copy, reallocate and initialize the new region
+    if (ln2 > 8) {
+      std::vector<double> samples;
+      timeStage([&] {
+        particleField.resizeParticles(particleCount / 2);
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        particleField.resizeParticles(particleCount);
+        glFinish();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      });
+      // Only the grow half of each iteration is reported
+      samples.erase(samples.begin(), samples.begin() + warmupIterations);
+      std::sort(samples.begin(), samples.end());
+      Timing timing = { samples[samples.size() / 2], samples.front(), std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size() };
+      results.push_back(makeResult("resize", ln2, actualCount, timing, actualCount * particleField.getUpdateBytesPerParticle()));
+    }
+  }
+
+  report["results"] = results;
+  // Every case after the first shares most of its programs through the cache
+  report["cachedProgramLoads"] = ofxParticleField::ProgramCache::shared().getCachedLoadCount();
+  report["compiledProgramLoads"] = ofxParticleField::ProgramCache::shared().getCompiledLoadCount();
+  ofSavePrettyJson(outputPath, report);
+  ofLogNotice("benchmark") << "wrote " << results.size() << " results to " << ofToDataPath(outputPath, true);
+}
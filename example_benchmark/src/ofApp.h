@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxParticleField.h"
+
+// Runs the whole sweep on the first update, writes a JSON report and exits.
+class ofApp: public ofBaseApp {
+public:
+  void setup();
+  void update();
+  void draw();
+
+  ofxParticleField::ParticleField::Settings settings;
+  bool quick = false;
+  std::string outputPath = "benchmark.json";
+
+private:
+  struct Timing {
+    double msMedian;
+    double msMin;
+    double msMean;
+  };
+  Timing timeStage(const std::function<void()>& stage);
+  ofJson makeResult(const std::string& stage, int ln2ParticleCount, size_t particleCount, const Timing& timing, size_t bytesPerFrame);
+  void runBenchmark();
+
+  const ofFloatPixels& getFieldPixels(int resolution, float scale);
+  std::map<std::pair<int, float>, ofFloatPixels> fieldPixelsCache;
+
+  int warmupIterations = 5;
+  int iterations = 30;
+  bool finished = false;
+};
@@ -1,20 +1,6 @@
 #include "ofApp.h"
 
 
-static ofFloatPixels makePerlin2DNoise(int w, int h, float scale, float z) {
-  ofFloatPixels pixels;
-  pixels.allocate(w, h, OF_PIXELS_RGB);
-  for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      float n1 = ofNoise(x * scale, y * scale, z);
-      float n2 = ofNoise((x+5000) * scale, (y+5000) * scale, z);
-      pixels.setColor(x, y, ofFloatColor(n1, n2, 0.0, 0.0));
-    }
-  }
-  return pixels;
-}
-
-
 //--------------------------------------------------------------
 void ofApp::setup(){
   ofEnableAlphaBlending();
@@ -31,21 +17,22 @@ void ofApp::setup(){
   ofClear(0, 0, 0, 255);
   foregroundFbo.end();
 
-  field1Texture.allocate(fieldWidth, fieldHeight, GL_RG16F);
-  field2Texture.allocate(fieldWidth, fieldHeight, GL_RG16F);
+  ofxParticleField::FieldGenerator::Settings fieldSettings;
+  fieldSettings.width = fieldWidth;
+  fieldSettings.height = fieldHeight;
+  fieldSettings.scale = 0.001;
+  field1Generator.setup(fieldSettings);
+  fieldSettings.scale = 0.01;
+  field2Generator.setup(fieldSettings);
 
   gui.setup(particleField.getParameterGroup());
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
-  ofFloatPixels pixels1 = makePerlin2DNoise(fieldWidth, fieldHeight, 0.001, ofGetElapsedTimef()*0.1);
-  field1Texture.loadData(pixels1);
-  ofFloatPixels pixels2 = makePerlin2DNoise(fieldWidth, fieldHeight, 0.01, -1000.0 + ofGetElapsedTimef()*0.2);
-  field2Texture.loadData(pixels2);
-
-  particleField.setField1(field1Texture);
-  particleField.setField2(field2Texture);
+  // Fields are generated on the worker pool and streamed to the GPU; neither blocks this thread
+  if (field1Generator.update(ofGetElapsedTimef()*0.1)) particleField.setField1(field1Generator.getPixels());
+  if (field2Generator.update(-1000.0 + ofGetElapsedTimef()*0.2)) particleField.setField2(field2Generator.getPixels());
   particleField.update();
   
   if (ofGetFrameNum() % 30 == 0) {
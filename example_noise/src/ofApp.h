@@ -26,7 +26,7 @@ private:
   
   int fieldWidth = 200;
   int fieldHeight = 200;
-  ofTexture field1Texture, field2Texture;
+  ofxParticleField::FieldGenerator field1Generator, field2Generator;
   
   ofxParticleField::ParticleField particleField;
   
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Shader.h"
+#include "ProgramCache.h"
+
+namespace ofxParticleField {
+
+
+
+// The ofxRenderer Shader base with load() going through the shared ProgramCache,
+// so identical sources are compiled and linked once per process.
+class CachedShader : public Shader {
+
+public:
+  void load() {
+    ProgramCache::shared().load(shader, { { GL_VERTEX_SHADER, getVertexShader() }, { GL_FRAGMENT_SHADER, getFragmentShader() } });
+  }
+
+};
+
+
+
+} // namespace ofxParticleField
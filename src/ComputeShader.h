@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ProgramCache.h"
+#include "Shader.h"
+#include "ShaderDefines.h"
+
+namespace ofxParticleField {
+
+
+
+// Counterpart of the ofxRenderer Shader base for compute programs, loaded through the ProgramCache like CachedShader.
+// Sources are written with GLSL() and raised to #version 430 here.
+class ComputeShader {
+
+public:
+  virtual ~ComputeShader() = default;
+
+  void load() {
+    ProgramCache::shared().load(shader, { { GL_COMPUTE_SHADER, replaceVersion(getComputeShader(), 430) } });
+  }
+
+protected:
+  virtual std::string getComputeShader() = 0;
+
+  // One invocation per item along x
+  void dispatch(size_t count, size_t workgroupSize) {
+    if (count == 0) return;
+    shader.dispatchCompute((GLuint)((count + workgroupSize - 1) / workgroupSize), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); // later passes read what this one wrote
+  }
+
+  ofShader shader;
+
+};
+
+
+
+} // namespace ofxParticleField
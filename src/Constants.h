@@ -10,9 +10,34 @@
 
 namespace ofxParticleField {
 
+// StateLayoutType::SEPARATE attachments
 static const size_t POSITION_DATA_INDEX = 0;
 static const size_t VELOCITY_DATA_INDEX = 1;
 static const size_t JITTER_DATA_INDEX = 2;
 static const size_t WEIGHT_DATA_INDEX = 3;
 
+// StateLayoutType::PACKED attachments
+static const size_t PACKED_POSITION_VELOCITY_DATA_INDEX = 0; // xy position, zw velocity
+static const size_t PACKED_JITTER_DATA_INDEX = 1;
+static const size_t PACKED_WEIGHT_DATA_INDEX = 2; // written at init only
+
+// Parameters are tuned per 60Hz frame; other timesteps are scaled from this one
+static const float REFERENCE_TIMESTEP = 1.0f / 60.0f;
+// Added to jitterSeed for each substep so substeps don't repeat the same jitter
+static const float SUBSTEP_JITTER_SEED_OFFSET = 1.618034f;
+
+// Texture units shared by the shaders; state attachments take the units below these
+static const int FIRST_FIELD_TEXTURE_UNIT = 4;
+static const int FIRST_COLOR_TEXTURE_UNIT = 4;
+static const int PERMUTATION_TEXTURE_UNIT = 4;
+
+// Uniform buffer binding of the ParameterBlock
+static const unsigned int PARAMETER_BLOCK_BINDING = 0;
+
+// Storage buffer bindings of the compute backend's NeighbourGridCompute; the state buffer is 0
+static const unsigned int CELL_COUNT_BINDING = 2;
+static const unsigned int CELL_START_BINDING = 3;
+static const unsigned int SORTED_INDEX_BINDING = 4;
+static const unsigned int INTERACTION_FORCE_BINDING = 5;
+
 }
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "CpuSimulation.h"
+#include "Simd.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+// Particles per inner block: field samples for a block are gathered into stack arrays, then integrated in SIMD
+constexpr size_t BLOCK_SIZE = 256;
+// Particles per parallelFor chunk
+constexpr size_t GRAIN_SIZE = 16 * BLOCK_SIZE;
+// State arrays are padded so SIMD loads and stores never run off the end
+constexpr size_t PADDING = 8;
+
+size_t paddedSize(size_t count) {
+  return (count + PADDING - 1) / PADDING * PADDING;
+}
+
+// Same hash and float construction as InitShader
+uint32_t hash(uint32_t x) {
+  x += (x << 10u);
+  x ^= (x >> 6u);
+  x += (x << 3u);
+  x ^= (x >> 11u);
+  x += (x << 15u);
+  return x;
+}
+
+float random(uint32_t x, uint32_t y, float seed) {
+  uint32_t m = hash(x ^ hash(y) ^ (uint32_t)(seed * 1000.0f));
+  m &= 0x007FFFFFu;
+  m |= 0x3F800000u;
+  float f;
+  std::memcpy(&f, &m, sizeof(f));
+  return f - 1.0f;
+}
+
+// Interleaved Gradient Noise, as in UpdateShader
+simd::Float ign(simd::Float x, simd::Float y) {
+  using namespace simd;
+  return fract(broadcast(52.9829189f) * fract(broadcast(0.06711056f) * x + broadcast(0.00583715f) * y));
+}
+
+} // namespace
+
+void CpuField::sample(float u, float v, float& outX, float& outY) const {
+  if (!(u == u) || !(v == v)) u = v = 0.0f;
+  float tx = u * width - 0.5f;
+  float ty = v * height - 0.5f;
+  float x0f = std::floor(tx);
+  float y0f = std::floor(ty);
+  float fx = tx - x0f;
+  float fy = ty - y0f;
+  long maxX = (long)width - 1;
+  long maxY = (long)height - 1;
+  long x0 = std::clamp((long)x0f, 0L, maxX);
+  long x1 = std::clamp((long)x0f + 1, 0L, maxX);
+  long y0 = std::clamp((long)y0f, 0L, maxY);
+  long y1 = std::clamp((long)y0f + 1, 0L, maxY);
+  const float* p00 = data + (y0 * width + x0) * numChannels;
+  const float* p10 = data + (y0 * width + x1) * numChannels;
+  const float* p01 = data + (y1 * width + x0) * numChannels;
+  const float* p11 = data + (y1 * width + x1) * numChannels;
+  auto bilinear = [&](size_t c) {
+    float top = p00[c] + (p10[c] - p00[c]) * fx;
+    float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+    return top + (bottom - top) * fy;
+  };
+  outX = bilinear(0);
+  outY = bilinear(1);
+}
+
+void CpuSimulation::resize(size_t newWidth, size_t newHeight) {
+  if (newWidth == width && newHeight == height) return;
+
+  auto resizeArray = [&](std::vector<float>& array) {
+    std::vector<float> resized(paddedSize(newWidth * newHeight), 0.0f);
+    size_t minWidth = std::min(width, newWidth);
+    size_t minHeight = std::min(height, newHeight);
+    for (size_t y = 0; y < minHeight; ++y) {
+      std::copy_n(array.begin() + y * width, minWidth, resized.begin() + y * newWidth);
+    }
+    array.swap(resized);
+  };
+  resizeArray(positionX);
+  resizeArray(positionY);
+  resizeArray(velocityX);
+  resizeArray(velocityY);
+  resizeArray(jitterX);
+  resizeArray(jitterY);
+  resizeArray(weight);
+
+  // Keep padding lanes finite and the divide by weight safe
+  std::fill(weight.begin() + newWidth * newHeight, weight.end(), 1.0f);
+
+  width = newWidth;
+  height = newHeight;
+  activeCount = newWidth * newHeight;
+}
+
+void CpuSimulation::permute(const std::vector<uint32_t>& sourceIndices) {
+  size_t count = std::min(sourceIndices.size(), getParticleCount());
+  auto permuteArray = [&](std::vector<float>& array) {
+    permuteBuffer.assign(array.begin(), array.end());
+    for (size_t i = 0; i < count; ++i) {
+      array[i] = permuteBuffer[sourceIndices[i]];
+    }
+  };
+  permuteArray(positionX);
+  permuteArray(positionY);
+  permuteArray(velocityX);
+  permuteArray(velocityY);
+  permuteArray(jitterX);
+  permuteArray(jitterY);
+  permuteArray(weight);
+}
+
+void CpuSimulation::seedRegion(size_t x, size_t y, size_t regionWidth, size_t regionHeight, float seed, float minWeight, float maxWeight) {
+  size_t endX = std::min(x + regionWidth, width);
+  size_t endY = std::min(y + regionHeight, height);
+  for (size_t ty = y; ty < endY; ++ty) {
+    for (size_t tx = x; tx < endX; ++tx) {
+      size_t i = ty * width + tx;
+      positionX[i] = random((uint32_t)tx, (uint32_t)ty, seed);
+      positionY[i] = random((uint32_t)tx, (uint32_t)ty, seed + 1.0f);
+      velocityX[i] = velocityY[i] = 0.0f;
+      jitterX[i] = jitterY[i] = 0.0f;
+      weight[i] = minWeight + (maxWeight - minWeight) * random((uint32_t)tx, (uint32_t)ty, seed + 789.123f);
+    }
+  }
+}
+
+void CpuSimulation::step(const CpuField& field1, const CpuField& field2, const StepParameters& parameters) {
+  interacting = interaction.isEnabled();
+  if (interacting) {
+    // Binning is one linear counting sort; the forces then read only the grid and last step's state
+    grid.build(positionX.data(), positionY.data(), activeCount, interaction.getCellsPerAxis());
+    interactionX.assign(paddedSize(activeCount), 0.0f);
+    interactionY.assign(paddedSize(activeCount), 0.0f);
+    pool.parallelFor(activeCount, GRAIN_SIZE, [&](size_t begin, size_t end) {
+      interactRange(begin, end);
+    });
+  }
+  pool.parallelFor(activeCount, GRAIN_SIZE, [&](size_t begin, size_t end) {
+    stepRange(begin, end, field1, field2, parameters);
+  });
+}
+
+void CpuSimulation::interactRange(size_t begin, size_t end) {
+  const InteractionParameters& q = interaction;
+  float radius = std::min(q.radius, 1.0f / grid.getCellsPerAxis());
+  for (size_t i = begin; i < end; ++i) {
+    float awayX = 0.0f, awayY = 0.0f; // unit offsets from each neighbour, by kernel
+    float velocitySumX = 0.0f, velocitySumY = 0.0f, kernelSum = 0.0f, density = 0.0f;
+    grid.forEachNeighbour(positionX.data(), positionY.data(), i, radius, (size_t)q.maxNeighbours, [&](uint32_t j, float dx, float dy, float distance) {
+      float kernel = 1.0f - distance / radius;
+      float inverseDistance = 1.0f / std::max(distance, 1e-6f);
+      awayX += dx * inverseDistance * kernel;
+      awayY += dy * inverseDistance * kernel;
+      velocitySumX += velocityX[j] * kernel;
+      velocitySumY += velocityY[j] * kernel;
+      kernelSum += kernel;
+      density += kernel * kernel;
+    });
+    float away = q.separation + q.pressure * (density - q.restDensity);
+    float forceX = awayX * away;
+    float forceY = awayY * away;
+    if (kernelSum > 0.0f) {
+      forceX += (velocitySumX / kernelSum - velocityX[i]) * q.alignment;
+      forceY += (velocitySumY / kernelSum - velocityY[i]) * q.alignment;
+    }
+    interactionX[i] = forceX;
+    interactionY[i] = forceY;
+  }
+}
+
+void CpuSimulation::stepRange(size_t begin, size_t end, const CpuField& field1, const CpuField& field2, const StepParameters& p) {
+  using namespace simd;
+
+  alignas(32) float fieldX[BLOCK_SIZE];
+  alignas(32) float fieldY[BLOCK_SIZE];
+  alignas(32) float fragX[BLOCK_SIZE];
+  alignas(32) float fragY[BLOCK_SIZE];
+
+  const Float zero = broadcast(0.0f);
+  const Float half = broadcast(0.5f);
+  const Float jitterScale = broadcast(2.0f * p.jitterStrength);
+  const Float jitterSmoothing = broadcast(p.jitterSmoothing);
+  const Float forceMultiplier = broadcast(p.forceMultiplier);
+  const Float interactionMultiplier = broadcast(p.interactionMultiplier);
+  const Float velocityDamping = broadcast(p.velocityDamping);
+  const Float maxVelocity = broadcast(p.maxVelocity);
+  const Float maxVelocitySafe = broadcast(std::max(p.maxVelocity, 1e-6f));
+  const Float maxDisp = broadcast(p.maxDisplacement);
+  const Float epsilon = broadcast(1e-6f);
+  const Float seedX = broadcast(p.jitterSeed);
+  const Float seedY = broadcast(p.jitterSeed * 1.37f);
+  const Float seedZ = broadcast(p.jitterSeed * 2.17f);
+  const Float seedW = broadcast(p.jitterSeed * 3.13f);
+
+  for (size_t blockBegin = begin; blockBegin < end; blockBegin += BLOCK_SIZE) {
+    size_t blockCount = std::min(BLOCK_SIZE, end - blockBegin);
+
+    // Gather: fields are sampled at arbitrary positions so this part stays scalar
+    for (size_t j = 0; j < blockCount; ++j) {
+      size_t i = blockBegin + j;
+      float u = positionX[i];
+      float v = positionY[i];
+      float f1x = 0.0f, f1y = 0.0f, f2x = 0.0f, f2y = 0.0f;
+      if (field1.isValid()) {
+        field1.sample(u, v, f1x, f1y);
+        f1x = (f1x + p.field1ValueOffset) * p.field1Multiplier;
+        f1y = (f1y + p.field1ValueOffset) * p.field1Multiplier;
+      }
+      if (field2.isValid()) {
+        field2.sample(u, v, f2x, f2y);
+        f2x = (f2x + p.field2ValueOffset) * p.field2Multiplier;
+        f2y = (f2y + p.field2ValueOffset) * p.field2Multiplier;
+      }
+      fieldX[j] = f1x + f2x;
+      fieldY[j] = f1y + f2y;
+      // gl_FragCoord of the particle's texel
+      fragX[j] = (float)(i % width) + 0.5f;
+      fragY[j] = (float)(i / width) + 0.5f;
+    }
+    for (size_t j = blockCount; j < (blockCount + PADDING - 1) / PADDING * PADDING; ++j) {
+      fieldX[j] = fieldY[j] = fragX[j] = fragY[j] = 0.0f;
+    }
+
+    // Integrate
+    for (size_t j = 0; j < blockCount; j += simd::width) {
+      size_t i = blockBegin + j;
+
+      Float fx = load(fieldX + j);
+      Float fy = load(fieldY + j);
+      // FIXME: where are these NaNs coming from with the VideoFlowSourceMod?
+      fx = select(isNan(fx), zero, fx);
+      fy = select(isNan(fy), zero, fy);
+
+      Float gx = load(fragX + j);
+      Float gy = load(fragY + j);
+      Float rndX = ign(gx + seedX, gy + seedY);
+      Float rndY = ign(gy + seedZ, gx + seedW);
+      Float jx = mix(load(&jitterX[i]), (rndX - half) * jitterScale, jitterSmoothing);
+      Float jy = mix(load(&jitterY[i]), (rndY - half) * jitterScale, jitterSmoothing);
+
+      Float w = (p.uniformWeight > 0.0f) ? broadcast(p.uniformWeight) : load(&weight[i]);
+      Float vx = load(&velocityX[i]);
+      Float vy = load(&velocityY[i]);
+      Float forceX = fx * forceMultiplier;
+      Float forceY = fy * forceMultiplier;
+      if (interacting) {
+        forceX = forceX + load(&interactionX[i]) * interactionMultiplier;
+        forceY = forceY + load(&interactionY[i]) * interactionMultiplier;
+      }
+      vx = (vx + forceX / w + jx) * velocityDamping;
+      vy = (vy + forceY / w + jy) * velocityDamping;
+
+      Float dx = vx * maxVelocity;
+      Float dy = vy * maxVelocity;
+      Float dispLen = sqrt(dx * dx + dy * dy);
+      Mask clamp = greaterThan(dispLen, maxDisp);
+      Float scale = maxDisp / (dispLen + epsilon);
+      dx = select(clamp, dx * scale, dx);
+      dy = select(clamp, dy * scale, dy);
+      vx = select(clamp, dx / maxVelocitySafe, vx);
+      vy = select(clamp, dy / maxVelocitySafe, vy);
+
+      store(&positionX[i], fract(load(&positionX[i]) + dx));
+      store(&positionY[i], fract(load(&positionY[i]) + dy));
+      store(&velocityX[i], vx);
+      store(&velocityY[i], vy);
+      store(&jitterX[i], jx);
+      store(&jitterY[i], jy);
+    }
+  }
+}
+
+void CpuSimulation::copyPositions(float* outXY) const {
+  size_t count = getParticleCount();
+  for (size_t i = 0; i < count; ++i) {
+    outXY[i * 2] = positionX[i];
+    outXY[i * 2 + 1] = positionY[i];
+  }
+}
+
+void CpuSimulation::copyVelocities(float* outXY) const {
+  size_t count = getParticleCount();
+  for (size_t i = 0; i < count; ++i) {
+    outXY[i * 2] = velocityX[i];
+    outXY[i * 2 + 1] = velocityY[i];
+  }
+}
+
+void CpuSimulation::copyPositionsAndVelocities(float* outXYZW) const {
+  size_t count = getParticleCount();
+  for (size_t i = 0; i < count; ++i) {
+    outXYZW[i * 4] = positionX[i];
+    outXYZW[i * 4 + 1] = positionY[i];
+    outXYZW[i * 4 + 2] = velocityX[i];
+    outXYZW[i * 4 + 3] = velocityY[i];
+  }
+}
+
+void CpuSimulation::copyFixedPositions(uint16_t* outXY) const {
+  size_t count = getParticleCount();
+  for (size_t i = 0; i < count; ++i) {
+    // fract() can round up to exactly 1.0, which wraps to 0 like the GPU path
+    outXY[i * 2] = (uint16_t)((uint32_t)(positionX[i] * 65536.0f) & 0xFFFFu);
+    outXY[i * 2 + 1] = (uint16_t)((uint32_t)(positionY[i] * 65536.0f) & 0xFFFFu);
+  }
+}
+
+void CpuSimulation::copyFixedPositions(uint32_t* outXY) const {
+  size_t count = getParticleCount();
+  for (size_t i = 0; i < count; ++i) {
+    outXY[i * 2] = (uint32_t)(uint64_t)(positionX[i] * 4294967296.0);
+    outXY[i * 2 + 1] = (uint32_t)(uint64_t)(positionY[i] * 4294967296.0);
+  }
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "NeighbourGrid.h"
+#include "StepParameters.h"
+#include "WorkerPool.h"
+
+namespace ofxParticleField {
+
+
+
+// Read-only view of an interleaved float field; channels 0 and 1 are the vector.
+// Sampled like the GL_LINEAR, GL_CLAMP_TO_EDGE field textures the GPU path uses.
+struct CpuField {
+  const float* data = nullptr;
+  size_t width = 0;
+  size_t height = 0;
+  size_t numChannels = 0;
+
+  bool isValid() const { return data != nullptr && width > 0 && height > 0 && numChannels >= 2; }
+  void sample(float u, float v, float& outX, float& outY) const;
+};
+
+// Structure-of-arrays particle state advanced on the CPU with exactly the step UpdateShader runs.
+// Particle i lives at texel (i % width, i / width) so the arrays upload straight into the state textures.
+class CpuSimulation {
+public:
+  explicit CpuSimulation(WorkerPool& pool = WorkerPool::shared()) : pool(pool) {}
+
+  // Keeps the overlapping region, as resizeParticles() does for the GPU state
+  void resize(size_t newWidth, size_t newHeight);
+  void seedRegion(size_t x, size_t y, size_t regionWidth, size_t regionHeight, float seed, float minWeight, float maxWeight);
+  void step(const CpuField& field1, const CpuField& field2, const StepParameters& parameters);
+  // Particle-particle forces for the following steps, binned through a NeighbourGrid rebuilt every step
+  void setInteraction(const InteractionParameters& interaction_) { interaction = interaction_; }
+  const InteractionParameters& getInteraction() const { return interaction; }
+  // Particle i takes the state of particle sourceIndices[i]; one index per particle
+  void permute(const std::vector<uint32_t>& sourceIndices);
+
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+  size_t getParticleCount() const { return width * height; }
+  // Only the first activeCount particles are stepped; resize() makes them all active
+  void setActiveCount(size_t count) { activeCount = std::min(count, getParticleCount()); }
+  size_t getActiveCount() const { return activeCount; }
+
+  // Interleaved xy pairs in texel order, ready for an RG32F upload
+  void copyPositions(float* outXY) const;
+  void copyVelocities(float* outXY) const;
+  // Interleaved xy position, zw velocity, for the packed RGBA32F layout
+  void copyPositionsAndVelocities(float* outXYZW) const;
+  // Interleaved xy positions as fixed-point fractions of the field, for the FIXED16/FIXED32 position encodings
+  void copyFixedPositions(uint16_t* outXY) const;
+  void copyFixedPositions(uint32_t* outXY) const;
+
+  const std::vector<float>& getPositionX() const { return positionX; }
+  const std::vector<float>& getPositionY() const { return positionY; }
+  const std::vector<float>& getVelocityX() const { return velocityX; }
+  const std::vector<float>& getVelocityY() const { return velocityY; }
+  const std::vector<float>& getWeight() const { return weight; }
+
+private:
+  void stepRange(size_t begin, size_t end, const CpuField& field1, const CpuField& field2, const StepParameters& parameters);
+  void interactRange(size_t begin, size_t end);
+
+  WorkerPool& pool;
+  size_t width = 0;
+  size_t height = 0;
+  size_t activeCount = 0;
+  std::vector<float> positionX, positionY;
+  std::vector<float> velocityX, velocityY;
+  std::vector<float> jitterX, jitterY;
+  std::vector<float> weight;
+  std::vector<float> permuteBuffer;
+
+  InteractionParameters interaction;
+  bool interacting = false; // for the current step
+  NeighbourGrid grid;
+  std::vector<float> interactionX, interactionY; // force on each active particle, padded like the state
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace ofxParticleField {
+
+
+
+// Collects sparse per-particle writes between uploads, then hands them back as
+// contiguous index runs so each run is one sub-range upload. Later writes to the
+// same index win. Cost scales with the number of writes, not the particle count.
+template<typename T>
+class DirtyRangeTracker {
+public:
+  struct Write {
+    size_t index;
+    T value;
+  };
+
+  void set(size_t index, const T& value) { pending.push_back({ index, value }); }
+  void set(const Write* writes, size_t count) { pending.insert(pending.end(), writes, writes + count); }
+  bool isEmpty() const { return pending.empty(); }
+  void clear() { pending.clear(); }
+
+  // uploadRun(size_t startIndex, const T* values, size_t count); indices >= limit are dropped
+  template<typename UploadRun>
+  void flush(size_t limit, UploadRun&& uploadRun) {
+    if (pending.empty()) return;
+
+    std::stable_sort(pending.begin(), pending.end(), [](const Write& a, const Write& b) { return a.index < b.index; });
+
+    runValues.clear();
+    size_t runStart = 0;
+    for (size_t i = 0; i < pending.size(); ++i) {
+      const Write& write = pending[i];
+      if (write.index >= limit) break;
+      if (i + 1 < pending.size() && pending[i + 1].index == write.index) continue; // superseded
+
+      if (!runValues.empty() && write.index != runStart + runValues.size()) {
+        uploadRun(runStart, runValues.data(), runValues.size());
+        runValues.clear();
+      }
+      if (runValues.empty()) runStart = write.index;
+      runValues.push_back(write.value);
+    }
+    if (!runValues.empty()) uploadRun(runStart, runValues.data(), runValues.size());
+
+    pending.clear();
+  }
+
+private:
+  std::vector<Write> pending;
+  std::vector<T> runValues;
+};
+
+
+
+} // namespace ofxParticleField
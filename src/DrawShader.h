@@ -7,66 +7,123 @@
 
 #pragma once
 
-#include "Shader.h"
+#include "CachedShader.h"
 #include "Constants.h"
+#include "GroupParameterBlock.h"
+#include "ParameterBlock.h"
+#include "ParticleColors.h"
+#include "ParticleStateBuffer.h"
+#include "StateLayout.h"
 
 namespace ofxParticleField {
 
 
 
-class DrawShader : public Shader {
+class DrawShader : public CachedShader {
   
 public:
-  void render(const ofVboMesh& mesh, const ofFbo& fbo, PingPongFbo& particleData, float pointSize, float speedThreshold) {
+  void setColorStorage(ColorStorage colorStorage_) { colorStorage = colorStorage_; } // before load()
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load()
+  void setUseStateBuffer(bool useStateBuffer_) { useStateBuffer = useStateBuffer_; } // before load(); state from a ParticleStateBuffer
+  void setGroupParameters(bool groupParameters_) { groupParameters = groupParameters_; } // before load(); reads a GroupParameterBlock
+  void load() {
+    CachedShader::load();
+    ParameterBlock::bindToProgram(shader);
+  }
+
+  // Attribute-less: one point per particle, with the particle's texel derived from gl_VertexID.
+  // Point size and speed threshold are read from the bound ParameterBlock. Velocity is fetched once
+  // per particle in the vertex stage. Particles whose peak alpha is below half an 8-bit step are
+  // culled before rasterization, and sprites shrink to the radius their alpha falloff reaches, but
+  // never below 2 px, so small points rasterize as before.
+  void render(const ofFbo& fbo, PingPongFbo& particleData, const ParticleColors& particleColors, size_t particleCount) {
+    renderPoints(fbo, particleData.getSource().getWidth(), particleColors, particleCount, [&] {
+      stateLayout.bindStateTextures(shader, particleData.getSource());
+    });
+  }
+
+  // Compute backend: positions and velocities come straight from the storage buffer
+  void render(const ofFbo& fbo, const ParticleStateBuffer& stateBuffer, const ParticleColors& particleColors, size_t particleCount) {
+    renderPoints(fbo, stateBuffer.getWidth(), particleColors, particleCount, [&] {
+      stateBuffer.bind(shader);
+    });
+  }
+  
+protected:
+  void renderPoints(const ofFbo& fbo, size_t particleDataWidth, const ParticleColors& particleColors, size_t particleCount, const std::function<void()>& bindState) {
+    if (emptyVao == 0) glGenVertexArrays(1, &emptyVao);
     ofPushStyle();
     glEnable(GL_PROGRAM_POINT_SIZE);
     fbo.begin();
     shader.begin();
-    shader.setUniformTexture("positionData", particleData.getSource().getTexture(POSITION_DATA_INDEX), 0);
-    shader.setUniformTexture("velocityData", particleData.getSource().getTexture(VELOCITY_DATA_INDEX), 1);
+    bindState();
+    shader.setUniformTexture("colorData", particleColors.getParticleTexture(), FIRST_COLOR_TEXTURE_UNIT);
+    if (particleColors.isPalette()) {
+      shader.setUniformTexture("paletteData", particleColors.getPaletteTexture(), FIRST_COLOR_TEXTURE_UNIT + 1);
+    }
+    shader.setUniform1i("particleDataWidth", (int)particleDataWidth);
     shader.setUniform1i("renderW", fbo.getWidth());
     shader.setUniform1i("renderH", fbo.getHeight());
-    shader.setUniform1f("pointSize", pointSize);
-    shader.setUniform1f("speedThreshold", speedThreshold);
-    mesh.draw();
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)particleCount);
+    glBindVertexArray(0);
     shader.end();
     fbo.end();
     glDisable(GL_PROGRAM_POINT_SIZE);
     ofPopStyle();
   }
-  
-protected:
+
   std::string getVertexShader() override {
-    return GLSL(
+    return specialize(GLSL(
                 uniform mat4 modelViewProjectionMatrix;
-                in vec2 texcoord;
-                in vec4 color;
-                uniform sampler2DRect positionData;
+                STATE_DECLARATIONS
+                COLOR_DECLARATIONS
+                uniform int particleDataWidth;
                 uniform int renderW;
                 uniform int renderH;
-                uniform float pointSize;
-                out vec2 texCoordVarying;
+                PARAMETER_BLOCK
+                flat out float speedVarying;
+                flat out float radiusScaleVarying;
                 out vec4 colorVarying;
+
+                const float MIN_VISIBLE_ALPHA = 0.5 / 255.0;
+                const float MIN_SHRUNK_POINT_SIZE = 2.0;
                 
                 void main() {
-                  vec4 normalizedParticlePosition = texture(positionData, texcoord);
+                  ivec2 texel = ivec2(gl_VertexID % particleDataWidth, gl_VertexID / particleDataWidth);
+                  SELECT_PARAMETERS(texel);
+                  float speed = smoothstep(0.0, 1.0, length(READ_VELOCITY(texel)) * speedThreshold);
+                  vec4 color = LOOKUP_COLOR(texel);
+                  if (clamp(color.a, 0.0, 1.0) * speed < MIN_VISIBLE_ALPHA || pointSize <= 0.0) {
+                    // Invisible even at the centre: outside the clip volume with no size, so nothing is rasterized
+                    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+                    gl_PointSize = 0.0;
+                    speedVarying = 0.0;
+                    radiusScaleVarying = 0.0;
+                    colorVarying = vec4(0.0);
+                    return;
+                  }
+                  vec2 normalizedParticlePosition = READ_POSITION(texel);
                   vec4 position = vec4(normalizedParticlePosition.x * renderW,
                                        normalizedParticlePosition.y * renderH,
                                        0.0, 1.0);
                   gl_Position = modelViewProjectionMatrix * position;
-                  gl_PointSize = pointSize;
-                  texCoordVarying = texcoord;
+                  // alpha falls to zero at squared radius speed, so the sprite only needs sqrt(speed) of its size
+                  float spriteSize = max(pointSize * sqrt(speed), min(pointSize, MIN_SHRUNK_POINT_SIZE));
+                  float radiusScale = spriteSize / pointSize;
+                  gl_PointSize = spriteSize;
+                  speedVarying = speed;
+                  radiusScaleVarying = radiusScale * radiusScale;
                   colorVarying = color;
                 }
-                );
+                ));
   }
   
   std::string getFragmentShader() override {
-    return GLSL(
-                in vec2 texCoordVarying;
+    return specialize(GLSL(
+                flat in float speedVarying;
+                flat in float radiusScaleVarying;
                 in vec4 colorVarying;
-                uniform sampler2DRect velocityData;
-                uniform float speedThreshold;
                 out vec4 fragColor;
                 
                 void main(void) {
@@ -77,20 +134,39 @@ protected:
                     discard;
                   }
                   
-                  vec4 particleVelocity = texture(velocityData, texCoordVarying);
-                  float speed = length(particleVelocity.xy);
-                  speed = smoothstep(0.0, 1.0, speed * speedThreshold);
-
-                  // set alpha according to distance to center
-                  float alpha = clamp(speed - r, 0.0, 1.0);
+                  // set alpha according to distance to center, in the full-size sprite's units
+                  float speed = speedVarying;
+                  float alpha = clamp(speed - r * radiusScaleVarying, 0.0, 1.0);
 
                   // Premultiplied alpha output.
                   float a = clamp(colorVarying.a, 0.0, 1.0) * alpha;
                   fragColor = vec4(colorVarying.rgb * a, a);
                 }
-                );
+                ));
   }
   
+private:
+  // Storage buffers need GLSL 430
+  std::string specialize(const std::string& source) const {
+    std::string specialized = injectDefines(source, getShaderDefines());
+    return useStateBuffer ? replaceVersion(specialized, 430) : specialized;
+  }
+
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = useStateBuffer ? ParticleStateBuffer::getShaderDefines(true) : stateLayout.getShaderDefines();
+    ShaderDefines colorDefines = ParticleColors::getShaderDefines(colorStorage);
+    defines.insert(defines.end(), colorDefines.begin(), colorDefines.end());
+    ShaderDefines parameterDefines = groupParameters ? GroupParameterBlock::getShaderDefines() : ParameterBlock::getShaderDefines();
+    defines.insert(defines.end(), parameterDefines.begin(), parameterDefines.end());
+    return defines;
+  }
+
+  GLuint emptyVao = 0;
+  ColorStorage colorStorage = ColorStorage::RGBA;
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  bool useStateBuffer = false;
+  bool groupParameters = false;
+  
 };
 
 
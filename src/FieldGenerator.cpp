@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <thread>
+
+#include "FieldGenerator.h"
+#include "Simd.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+using simd::Float;
+using simd::broadcast;
+
+constexpr float OCTAVE_OFFSET = 17.17f; // decorrelates octaves at the lattice origin
+constexpr float CHANNEL_OFFSET = 71.3f; // decorrelates the two NOISE channels
+
+// Dave Hoskins' sine-free hashes, all in float arithmetic so they vectorize with the simd wrapper.
+// Lattice coordinates stay small enough here for the products to keep their fractional bits.
+void hashGradient2(Float x, Float y, Float& outX, Float& outY) {
+  Float p0 = simd::fract(x * broadcast(0.1031f));
+  Float p1 = simd::fract(y * broadcast(0.1030f));
+  Float p2 = simd::fract(x * broadcast(0.0973f));
+  Float d = p0 * (p1 + broadcast(33.33f)) + p1 * (p2 + broadcast(33.33f)) + p2 * (p0 + broadcast(33.33f));
+  p0 = p0 + d;
+  p1 = p1 + d;
+  p2 = p2 + d;
+  outX = simd::fract((p0 + p1) * p2) * broadcast(2.0f) - broadcast(1.0f);
+  outY = simd::fract((p0 + p2) * p1) * broadcast(2.0f) - broadcast(1.0f);
+}
+
+void hashGradient3(Float x, Float y, Float z, Float& outX, Float& outY, Float& outZ) {
+  Float p0 = simd::fract(x * broadcast(0.1031f));
+  Float p1 = simd::fract(y * broadcast(0.1030f));
+  Float p2 = simd::fract(z * broadcast(0.0973f));
+  Float d = p0 * (p1 + broadcast(33.33f)) + p1 * (p0 + broadcast(33.33f)) + p2 * (p2 + broadcast(33.33f));
+  p0 = p0 + d;
+  p1 = p1 + d;
+  p2 = p2 + d;
+  outX = simd::fract((p0 + p1) * p2) * broadcast(2.0f) - broadcast(1.0f);
+  outY = simd::fract((p0 + p0) * p1) * broadcast(2.0f) - broadcast(1.0f);
+  outZ = simd::fract((p1 + p0) * p0) * broadcast(2.0f) - broadcast(1.0f);
+}
+
+Float quintic(Float t) {
+  return t * t * t * (t * (t * broadcast(6.0f) - broadcast(15.0f)) + broadcast(10.0f));
+}
+
+// Gradient noise, roughly [-1,1]
+Float gradientNoise(Float x, Float y) {
+  Float ix = simd::floor(x);
+  Float iy = simd::floor(y);
+  Float fx = x - ix;
+  Float fy = y - iy;
+  auto corner = [&](float dx, float dy) {
+    Float gx, gy;
+    hashGradient2(ix + broadcast(dx), iy + broadcast(dy), gx, gy);
+    return gx * (fx - broadcast(dx)) + gy * (fy - broadcast(dy));
+  };
+  Float ux = quintic(fx);
+  Float uy = quintic(fy);
+  return simd::mix(simd::mix(corner(0, 0), corner(1, 0), ux), simd::mix(corner(0, 1), corner(1, 1), ux), uy);
+}
+
+Float gradientNoise(Float x, Float y, Float z) {
+  Float ix = simd::floor(x);
+  Float iy = simd::floor(y);
+  Float iz = simd::floor(z);
+  Float fx = x - ix;
+  Float fy = y - iy;
+  Float fz = z - iz;
+  auto corner = [&](float dx, float dy, float dz) {
+    Float gx, gy, gz;
+    hashGradient3(ix + broadcast(dx), iy + broadcast(dy), iz + broadcast(dz), gx, gy, gz);
+    return gx * (fx - broadcast(dx)) + gy * (fy - broadcast(dy)) + gz * (fz - broadcast(dz));
+  };
+  Float ux = quintic(fx);
+  Float uy = quintic(fy);
+  Float uz = quintic(fz);
+  Float z0 = simd::mix(simd::mix(corner(0, 0, 0), corner(1, 0, 0), ux), simd::mix(corner(0, 1, 0), corner(1, 1, 0), ux), uy);
+  Float z1 = simd::mix(simd::mix(corner(0, 0, 1), corner(1, 0, 1), ux), simd::mix(corner(0, 1, 1), corner(1, 1, 1), ux), uy);
+  return simd::mix(z0, z1, uz);
+}
+
+// Normalized by the total amplitude, so the range doesn't grow with octaves
+Float fbm(const FieldGenerator::Settings& settings, Float x, Float y, float time) {
+  Float sum = broadcast(0.0f);
+  float amplitude = 1.0f;
+  float frequency = 1.0f;
+  float totalAmplitude = 0.0f;
+  for (int octave = 0; octave < std::max(settings.octaves, 1); ++octave) {
+    Float offset = broadcast(octave * OCTAVE_OFFSET);
+    Float fx = x * broadcast(frequency) + offset;
+    Float fy = y * broadcast(frequency) + offset;
+    Float noise = settings.threeDimensional ? gradientNoise(fx, fy, broadcast(time * frequency) + offset) : gradientNoise(fx, fy);
+    sum = sum + noise * broadcast(amplitude);
+    totalAmplitude += amplitude;
+    amplitude *= settings.gain;
+    frequency *= settings.lacunarity;
+  }
+  return sum * broadcast(1.0f / totalAmplitude);
+}
+
+} // namespace
+
+FieldGenerator::~FieldGenerator() {
+  waitForTiles();
+}
+
+void FieldGenerator::waitForTiles() const {
+  while (generating && tilesDone.load(std::memory_order_acquire) < nextTile) {
+    std::this_thread::yield();
+  }
+}
+
+void FieldGenerator::setup(const Settings& settings_) {
+  waitForTiles();
+  settings = settings_;
+  settings.tileSize = std::max<size_t>(settings.tileSize, 1);
+  frontPixels.allocate(settings.width, settings.height, OF_PIXELS_RG);
+  backPixels.allocate(settings.width, settings.height, OF_PIXELS_RG);
+  frontPixels.set(0.0f);
+  backPixels.set(0.0f);
+  tilesX = (settings.width + settings.tileSize - 1) / settings.tileSize;
+  numTiles = tilesX * ((settings.height + settings.tileSize - 1) / settings.tileSize);
+  generating = false;
+  nextTile = 0;
+  generation = 0;
+}
+
+bool FieldGenerator::update(float time) {
+  if (numTiles == 0) return false;
+
+  bool swapped = false;
+  if (generating && nextTile == numTiles && tilesDone.load(std::memory_order_acquire) == numTiles) {
+    frontPixels.swap(backPixels);
+    generating = false;
+    ++generation;
+    lastGenerationMs = finishNanoseconds.load() / 1.0e6f;
+    lastWorkMs = workNanoseconds.load() / 1.0e6f;
+    swapped = true;
+  }
+
+  if (!generating) {
+    generating = true;
+    generationTime = time;
+    nextTile = 0;
+    tilesDone = 0;
+    workNanoseconds = 0;
+    finishNanoseconds = 0;
+    generationStart = std::chrono::steady_clock::now();
+  }
+
+  size_t remaining = numTiles - nextTile;
+  size_t count = (settings.tilesPerUpdate == 0) ? remaining : std::min(settings.tilesPerUpdate, remaining);
+  for (size_t i = 0; i < count; ++i) {
+    size_t tile = nextTile++;
+    pool.enqueue([this, tile] { generateTile(tile); });
+  }
+  return swapped;
+}
+
+// Writes one tile of the back buffer; runs on a pool thread
+void FieldGenerator::generateTile(size_t tile) {
+  auto start = std::chrono::steady_clock::now();
+  size_t startX = (tile % tilesX) * settings.tileSize;
+  size_t startY = (tile / tilesX) * settings.tileSize;
+  size_t endX = std::min(startX + settings.tileSize, settings.width);
+  size_t endY = std::min(startY + settings.tileSize, settings.height);
+  float time = generationTime;
+  float scroll = settings.threeDimensional ? 0.0f : time;
+  float epsilon = settings.curlEpsilon * settings.scale;
+  float* data = backPixels.getData();
+
+  float lanes0[simd::width];
+  float lanes1[simd::width];
+  for (size_t y = startY; y < endY; ++y) {
+    Float py = broadcast(y * settings.scale + scroll);
+    for (size_t x = startX; x < endX; x += simd::width) {
+      Float px = simd::iota((float)x) * broadcast(settings.scale) + broadcast(scroll);
+      Float value0, value1;
+      if (settings.type == FieldNoiseType::CURL) {
+        // (dpsi/dy, -dpsi/dx) by central differences
+        Float e = broadcast(epsilon);
+        Float dy = fbm(settings, px, py + e, time) - fbm(settings, px, py - e, time);
+        Float dx = fbm(settings, px + e, py, time) - fbm(settings, px - e, py, time);
+        Float inverseSpan = broadcast(1.0f / (2.0f * epsilon));
+        value0 = dy * inverseSpan;
+        value1 = broadcast(0.0f) - dx * inverseSpan;
+      } else {
+        Float offset = broadcast(CHANNEL_OFFSET);
+        value0 = broadcast(0.5f) + broadcast(0.5f) * fbm(settings, px, py, time);
+        value1 = broadcast(0.5f) + broadcast(0.5f) * fbm(settings, px + offset, py + offset, time);
+      }
+      simd::store(lanes0, value0);
+      simd::store(lanes1, value1);
+      size_t count = std::min(simd::width, endX - x);
+      float* texel = data + (y * settings.width + x) * 2;
+      for (size_t i = 0; i < count; ++i) {
+        texel[i * 2] = lanes0[i];
+        texel[i * 2 + 1] = lanes1[i];
+      }
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  workNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  // Before counting the tile as done, so update() reads the final value
+  int64_t finished = std::chrono::duration_cast<std::chrono::nanoseconds>(end - generationStart).count();
+  int64_t latest = finishNanoseconds.load();
+  while (finished > latest && !finishNanoseconds.compare_exchange_weak(latest, finished)) {}
+  tilesDone.fetch_add(1, std::memory_order_acq_rel);
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include "WorkerPool.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+enum class FieldNoiseType {
+  NOISE, // two decorrelated fBm gradient noise channels in [0,1], like ofNoise; use a field value offset of -0.5
+  CURL   // divergence-free curl of an fBm potential, signed; use a field value offset of 0.0
+};
+
+// Generates RG float noise fields tile by tile on a WorkerPool, in SIMD across each row.
+// Tiles are written into a back buffer and swapped to the front once all are done, so the caller
+// always reads a complete field and update() never waits on the workers.
+class FieldGenerator {
+public:
+  struct Settings {
+    size_t width = 256;
+    size_t height = 256;
+    FieldNoiseType type = FieldNoiseType::NOISE;
+    bool threeDimensional = true; // time is the third coordinate; otherwise it scrolls 2D noise diagonally
+    float scale = 0.01f; // noise frequency per texel
+    int octaves = 1;
+    float lacunarity = 2.0f;
+    float gain = 0.5f;
+    float curlEpsilon = 0.5f; // texels between the finite-difference samples of the potential
+    size_t tileSize = 64;
+    size_t tilesPerUpdate = 0; // time-slices a large field over several update() calls; 0 queues every tile at once
+  };
+
+  explicit FieldGenerator(WorkerPool& pool = WorkerPool::shared()) : pool(pool) {}
+  ~FieldGenerator();
+  FieldGenerator(const FieldGenerator&) = delete;
+  FieldGenerator& operator=(const FieldGenerator&) = delete;
+
+  void setup(const Settings& settings_);
+  const Settings& getSettings() const { return settings; }
+
+  // Once per frame: swaps in a finished field, starts the next one at this time if idle, and queues
+  // its tiles. Returns true when getPixels() changed.
+  bool update(float time);
+  // Zeros until the first field completes. The buffer is handed back to the workers by the next
+  // update(), so copy or upload it (setField1/2 do) rather than keeping the reference.
+  const ofFloatPixels& getPixels() const { return frontPixels; }
+  size_t getGeneration() const { return generation; } // completed fields
+
+  // Of the last completed field: wall clock from its first queued tile to its last finished one,
+  // and the sum of time spent in its tiles across threads
+  float getLastGenerationMs() const { return lastGenerationMs; }
+  float getLastWorkMs() const { return lastWorkMs; }
+
+private:
+  void generateTile(size_t tile);
+  void waitForTiles() const;
+
+  WorkerPool& pool;
+  Settings settings;
+  ofFloatPixels frontPixels, backPixels;
+  size_t tilesX = 0;
+  size_t numTiles = 0;
+
+  bool generating = false;
+  float generationTime = 0.0f;
+  size_t nextTile = 0;
+  std::atomic<size_t> tilesDone { 0 };
+  std::atomic<int64_t> workNanoseconds { 0 };
+  std::atomic<int64_t> finishNanoseconds { 0 };
+  std::chrono::steady_clock::time_point generationStart;
+
+  size_t generation = 0;
+  float lastGenerationMs = 0.0f;
+  float lastWorkMs = 0.0f;
+};
+
+
+
+} // namespace ofxParticleField
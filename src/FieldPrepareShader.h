@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CachedShader.h"
+#include "Constants.h"
+
+namespace ofxParticleField {
+
+
+
+// Combines both fields into one RG texture: (field + offset) * multiplier summed, with NaN
+// components of the source texels zeroed before filtering. With nanCountField set to 1 or 2 it
+// instead passes only the texels of that field holding a NaN, for an occlusion query to count.
+class FieldPrepareShader : public CachedShader {
+
+public:
+  // Within target.begin()/end()
+  void render(const ofFbo& target, const ofTexture& field1Texture, const ofTexture& field2Texture,
+              float field1ValueOffset, float field2ValueOffset, float field1Multiplier, float field2Multiplier) {
+    render(ofRectangle(0, 0, target.getWidth(), target.getHeight()), field1Texture, field2Texture,
+           field1ValueOffset, field2ValueOffset, field1Multiplier, field2Multiplier);
+  }
+
+  // Within the target's begin()/end(): the fields stretched over one region of it, e.g. a ParticleFieldGroup atlas tile
+  void render(const ofRectangle& region, const ofTexture& field1Texture, const ofTexture& field2Texture,
+              float field1ValueOffset, float field2ValueOffset, float field1Multiplier, float field2Multiplier) {
+    shader.begin();
+    shader.setUniformTexture("field1Texture", field1Texture, FIRST_FIELD_TEXTURE_UNIT);
+    shader.setUniformTexture("field2Texture", field2Texture, FIRST_FIELD_TEXTURE_UNIT + 1);
+    shader.setUniform2f("targetOrigin", region.x, region.y);
+    shader.setUniform2f("targetSize", region.width, region.height);
+    shader.setUniform1f("field1ValueOffset", field1ValueOffset);
+    shader.setUniform1f("field2ValueOffset", field2ValueOffset);
+    shader.setUniform1f("field1Multiplier", field1Multiplier);
+    shader.setUniform1f("field2Multiplier", field2Multiplier);
+    shader.setUniform1i("nanCountField", 0);
+    ofDrawRectangle(region);
+    shader.end();
+  }
+
+  // Within target.begin()/end() with color writes masked; fieldTexture must fit in the target
+  void renderNanTexels(const ofTexture& fieldTexture, int fieldIndex) {
+    shader.begin();
+    shader.setUniformTexture(fieldIndex == 1 ? "field1Texture" : "field2Texture", fieldTexture, FIRST_FIELD_TEXTURE_UNIT + fieldIndex - 1);
+    shader.setUniform1i("nanCountField", fieldIndex);
+    ofDrawRectangle(0, 0, fieldTexture.getWidth(), fieldTexture.getHeight());
+    shader.end();
+  }
+
+protected:
+  std::string getVertexShader() override {
+    return GLSL(
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+
+                void main() {
+                  gl_Position = modelViewProjectionMatrix * position;
+                }
+                );
+  }
+
+  std::string getFragmentShader() override {
+    return GLSL(
+                uniform sampler2D field1Texture;
+                uniform sampler2D field2Texture;
+                uniform vec2 targetOrigin;
+                uniform vec2 targetSize;
+                uniform float field1ValueOffset;
+                uniform float field2ValueOffset;
+                uniform float field1Multiplier;
+                uniform float field2Multiplier;
+                uniform int nanCountField;
+                out vec4 fragColor;
+
+                vec2 scrubbed(vec2 value) {
+                  return mix(value, vec2(0.0), isnan(value));
+                }
+
+                // GL_LINEAR with clamp to edge, over scrubbed texels so a NaN can't leak through a zero weight
+                vec2 sampleScrubbed(sampler2D fieldTexture, vec2 uv) {
+                  ivec2 maxTexel = textureSize(fieldTexture, 0) - 1;
+                  vec2 t = uv * vec2(maxTexel + 1) - 0.5;
+                  ivec2 i = ivec2(floor(t));
+                  vec2 f = t - floor(t);
+                  vec2 a = scrubbed(texelFetch(fieldTexture, clamp(i, ivec2(0), maxTexel), 0).xy);
+                  vec2 b = scrubbed(texelFetch(fieldTexture, clamp(i + ivec2(1, 0), ivec2(0), maxTexel), 0).xy);
+                  vec2 c = scrubbed(texelFetch(fieldTexture, clamp(i + ivec2(0, 1), ivec2(0), maxTexel), 0).xy);
+                  vec2 d = scrubbed(texelFetch(fieldTexture, clamp(i + ivec2(1, 1), ivec2(0), maxTexel), 0).xy);
+                  return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
+                }
+
+                void main(void) {
+                  if (nanCountField != 0) {
+                    ivec2 texel = ivec2(gl_FragCoord.xy);
+                    vec2 value = (nanCountField == 1) ? texelFetch(field1Texture, texel, 0).xy : texelFetch(field2Texture, texel, 0).xy;
+                    if (!any(isnan(value))) discard;
+                    fragColor = vec4(0.0);
+                    return;
+                  }
+                  vec2 uv = (gl_FragCoord.xy - targetOrigin) / targetSize;
+                  vec2 field1 = sampleScrubbed(field1Texture, uv) + field1ValueOffset;
+                  vec2 field2 = sampleScrubbed(field2Texture, uv) + field2ValueOffset;
+                  fragColor = vec4(field1 * field1Multiplier + field2 * field2Multiplier, 0.0, 1.0);
+                }
+                );
+  }
+
+};
+
+
+
+} // namespace ofxParticleField
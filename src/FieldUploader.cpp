@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstring>
+
+#include "FieldUploader.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+size_t getBytesPerComponent(FieldPixelType type) {
+  switch (type) {
+    case FieldPixelType::HALF_FLOAT: return 2;
+    case FieldPixelType::UNSIGNED_BYTE: return 1;
+    default: return 4;
+  }
+}
+
+GLenum getGlType(FieldPixelType type) {
+  switch (type) {
+    case FieldPixelType::HALF_FLOAT: return GL_HALF_FLOAT;
+    case FieldPixelType::UNSIGNED_BYTE: return GL_UNSIGNED_BYTE;
+    default: return GL_FLOAT;
+  }
+}
+
+GLenum getGlFormat(size_t numChannels) {
+  switch (numChannels) {
+    case 1: return GL_RED;
+    case 2: return GL_RG;
+    case 3: return GL_RGB;
+    default: return GL_RGBA;
+  }
+}
+
+GLint getInternalFormat(size_t numChannels, FieldPixelType type) {
+  static const GLint floatFormats[] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+  static const GLint halfFormats[] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+  static const GLint byteFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+  size_t i = std::clamp<size_t>(numChannels, 1, 4) - 1;
+  switch (type) {
+    case FieldPixelType::HALF_FLOAT: return halfFormats[i];
+    case FieldPixelType::UNSIGNED_BYTE: return byteFormats[i];
+    default: return floatFormats[i];
+  }
+}
+
+} // namespace
+
+FieldUploader::~FieldUploader() {
+  releaseSlots();
+}
+
+void FieldUploader::releaseSlots() {
+  for (auto& slot : slots) {
+    if (slot.fence) glDeleteSync(slot.fence);
+    if (slot.pixelBuffer != 0) glDeleteBuffers(1, &slot.pixelBuffer);
+    slot = Slot {};
+  }
+  latestSequence = 0;
+}
+
+void FieldUploader::allocateSlots(size_t width_, size_t height_, size_t numChannels_, FieldPixelType type_) {
+  releaseSlots();
+  width = width_;
+  height = height_;
+  numChannels = std::clamp<size_t>(numChannels_, 1, 4);
+  type = type_;
+  glFormat = getGlFormat(numChannels);
+  glType = getGlType(type);
+  byteCount = width * height * numChannels * getBytesPerComponent(type);
+
+  for (auto& slot : slots) {
+    glGenBuffers(1, &slot.pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, byteCount, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    slot.texture.allocate(width, height, getInternalFormat(numChannels, type), false, glFormat, glType);
+  }
+  nextSlot = 0;
+  currentSlot = 0;
+}
+
+bool FieldUploader::isTransferComplete(Slot& slot) {
+  if (!slot.fence) return true;
+  GLenum result = glClientWaitSync(slot.fence, 0, 0);
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return false;
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+  return true;
+}
+
+bool FieldUploader::upload(const void* data, size_t width_, size_t height_, size_t numChannels_, FieldPixelType type_) {
+  if (width_ == 0 || height_ == 0) return false;
+  if (width_ != width || height_ != height || std::clamp<size_t>(numChannels_, 1, 4) != numChannels || type_ != type || slots[0].pixelBuffer == 0) {
+    allocateSlots(width_, height_, numChannels_, type_);
+  }
+
+  // The slot being sampled may still be read by queued steps, and an in-flight one by its transfer
+  Slot& slot = slots[nextSlot];
+  if ((slot.sequence > 0 && nextSlot == currentSlot) || !isTransferComplete(slot)) {
+    ++droppedUploadCount;
+    return false;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pixelBuffer);
+  // Unsynchronized is safe: the fence showed the previous transfer out of this buffer has finished
+  void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, byteCount, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  if (!mapped) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    ++droppedUploadCount;
+    return false;
+  }
+  std::memcpy(mapped, data, byteCount);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  const ofTextureData& textureData = slot.texture.getTextureData();
+  glBindTexture(textureData.textureTarget, textureData.textureID);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(textureData.textureTarget, 0, 0, 0, width, height, glFormat, glType, nullptr); // sourced from the bound buffer
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(textureData.textureTarget, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.sequence = ++latestSequence;
+  nextSlot = (nextSlot + 1) % RING_SIZE;
+  return true;
+}
+
+const ofTexture& FieldUploader::getTexture() {
+  int newestComplete = -1;
+  int newestQueued = -1;
+  for (int i = 0; i < (int)RING_SIZE; ++i) {
+    Slot& slot = slots[i];
+    if (slot.sequence == 0) continue;
+    if (newestQueued < 0 || slot.sequence > slots[newestQueued].sequence) newestQueued = i;
+    if (isTransferComplete(slot) && (newestComplete < 0 || slot.sequence > slots[newestComplete].sequence)) newestComplete = i;
+  }
+  int selected = (newestComplete >= 0) ? newestComplete : newestQueued;
+  // Never step back to an older field than the one already being sampled
+  if (selected >= 0 && slots[selected].sequence >= slots[currentSlot].sequence) currentSlot = selected;
+  return slots[currentSlot].texture;
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+enum class FieldPixelType {
+  FLOAT,
+  HALF_FLOAT, // IEEE 754 binary16 as uint16_t
+  UNSIGNED_BYTE // normalized to [0,1] when sampled
+};
+
+// Streams CPU field buffers to the GPU through a ring of pixel-unpack buffers, each with its own
+// texture and fence. upload() copies into a free slot and queues an asynchronous glTexSubImage2D;
+// getTexture() returns the newest slot whose transfer has finished, so nothing waits on the driver.
+class FieldUploader {
+public:
+  static constexpr size_t RING_SIZE = 3;
+
+  FieldUploader() = default;
+  FieldUploader(const FieldUploader&) = delete;
+  FieldUploader& operator=(const FieldUploader&) = delete;
+  ~FieldUploader();
+
+  // Returns false when the buffer is dropped because every slot is still in flight
+  bool upload(const void* data, size_t width, size_t height, size_t numChannels, FieldPixelType type);
+  bool hasTexture() const { return latestSequence > 0; }
+  // Before the first transfer completes this is the newest queued one, which GL orders correctly
+  const ofTexture& getTexture();
+  size_t getDroppedUploadCount() const { return droppedUploadCount; }
+
+private:
+  struct Slot {
+    GLuint pixelBuffer = 0;
+    ofTexture texture;
+    GLsync fence = nullptr;
+    size_t sequence = 0; // 0 until uploaded into
+  };
+  static bool isTransferComplete(Slot& slot);
+  void allocateSlots(size_t width, size_t height, size_t numChannels, FieldPixelType type);
+  void releaseSlots();
+
+  std::array<Slot, RING_SIZE> slots;
+  size_t nextSlot = 0;
+  size_t latestSequence = 0;
+  size_t currentSlot = 0; // the slot getTexture() last returned
+  size_t droppedUploadCount = 0;
+
+  size_t width = 0;
+  size_t height = 0;
+  size_t numChannels = 0;
+  FieldPixelType type = FieldPixelType::FLOAT;
+  GLenum glFormat = GL_RG;
+  GLenum glType = GL_FLOAT;
+  size_t byteCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
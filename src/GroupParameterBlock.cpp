@@ -0,0 +1,106 @@
+#include <cstring>
+
+#include "GroupParameterBlock.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+// Assigns a member of the selected entry to the global of the same name
+std::string copyMember(const char* name) {
+  return std::string(name) + " = members[m]." + name + "; ";
+}
+
+} // namespace
+
+void GroupParameterBlock::allocate() {
+  buffer.allocate(sizeof(Values), GL_DYNAMIC_DRAW);
+  dirty = true;
+}
+
+void GroupParameterBlock::setLayout(size_t memberCount, size_t atlasWidth) {
+  int32_t count = (int32_t)std::min(memberCount, MAX_MEMBERS);
+  if (values.memberCount == count && values.atlasWidth == (int32_t)atlasWidth) return;
+  values.memberCount = count;
+  values.atlasWidth = (int32_t)atlasWidth;
+  dirty = true;
+}
+
+void GroupParameterBlock::setMember(size_t member, const StepParameters& parameters, float pointSize, float speedThreshold, size_t firstRow, size_t particleCount) {
+  if (member >= MAX_MEMBERS) return;
+  MemberValues newValues;
+  newValues.field1ValueOffset = parameters.field1ValueOffset;
+  newValues.field2ValueOffset = parameters.field2ValueOffset;
+  newValues.field1Multiplier = parameters.field1Multiplier;
+  newValues.field2Multiplier = parameters.field2Multiplier;
+  newValues.velocityDamping = parameters.velocityDamping;
+  newValues.forceMultiplier = parameters.forceMultiplier;
+  newValues.maxVelocity = parameters.maxVelocity;
+  newValues.maxDisplacement = parameters.maxDisplacement;
+  newValues.jitterStrength = parameters.jitterStrength;
+  newValues.jitterSmoothing = parameters.jitterSmoothing;
+  newValues.uniformWeight = parameters.uniformWeight;
+  newValues.pointSize = pointSize;
+  newValues.speedThreshold = speedThreshold;
+  newValues.firstRow = (int32_t)firstRow;
+  newValues.particleCount = (int32_t)particleCount;
+  newValues.fieldTile = (int32_t)member;
+  // Bitwise, so an infinite maxDisplacement compares equal to itself
+  if (std::memcmp(&newValues, &values.members[member], sizeof(MemberValues)) == 0) return;
+  values.members[member] = newValues;
+  dirty = true;
+}
+
+void GroupParameterBlock::bind() {
+  if (!buffer.isAllocated()) return;
+  if (dirty) {
+    buffer.updateData(0, sizeof(Values), &values);
+    dirty = false;
+    ++uploadCount;
+  }
+  buffer.bindBase(GL_UNIFORM_BUFFER, PARAMETER_BLOCK_BINDING);
+}
+
+ShaderDefines GroupParameterBlock::getShaderDefines() {
+  const char* floatMembers[] = {
+    "field1ValueOffset", "field2ValueOffset", "field1Multiplier", "field2Multiplier", "velocityDamping", "forceMultiplier",
+    "maxVelocity", "maxDisplacement", "jitterStrength", "jitterSmoothing", "uniformWeight", "pointSize", "speedThreshold"
+  };
+  std::string structMembers;
+  std::string globals;
+  std::string copies;
+  for (const char* name : floatMembers) {
+    structMembers += std::string("float ") + name + "; ";
+    globals += std::string("float ") + name + "; ";
+    copies += copyMember(name);
+  }
+  return {
+    { "PARAMETER_BLOCK", "struct MemberParameters { " + structMembers + "int firstRow; int particleCount; int fieldTile; }; "
+                         "layout(std140) uniform " + std::string(ParameterBlock::BLOCK_NAME) + " { "
+                         "int memberCount; int atlasWidth; MemberParameters members[" + std::to_string(MAX_MEMBERS) + "]; }; " +
+                         globals + "int fieldTile; "
+                         "void selectParameters(ivec2 texel) { "
+                         "int m = 0; for (int i = 1; i < memberCount; ++i) { if (texel.y >= members[i].firstRow) m = i; } " +
+                         copies + copyMember("fieldTile") +
+                         "if ((texel.y - members[m].firstRow) * atlasWidth + texel.x >= members[m].particleCount) pointSize = 0.0; }" },
+    { "SELECT_PARAMETERS(texel)", "selectParameters(texel)" }
+  };
+}
+
+// The atlas is prepared with offsets and multipliers applied, like a PreparedField; samples are
+// clamped half a texel inside the tile so filtering never reaches a neighbouring member's field
+ShaderDefines GroupParameterBlock::getUpdateShaderDefines() {
+  return {
+    { "FIELD_DECLARATIONS", "uniform sampler2D fieldTexture; "
+                            "vec2 sampleField(vec2 position) { ivec2 atlasSize = textureSize(fieldTexture, 0); "
+                            "float halfTexel = 0.5 / float(atlasSize.y); vec2 uv = clamp(position, vec2(halfTexel), vec2(1.0 - halfTexel)); "
+                            "return texture(fieldTexture, vec2((float(fieldTile) + uv.x) * float(atlasSize.y) / float(atlasSize.x), uv.y)).xy; }" },
+    { "PARTICLE_WEIGHT(stored)", "((uniformWeight > 0.0) ? uniformWeight : (stored))" }
+  };
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Constants.h"
+#include "ParameterBlock.h"
+#include "ShaderDefines.h"
+#include "StepParameters.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// The ParameterBlock of a ParticleFieldGroup: one entry of simulation and draw parameters per member,
+// in one std140 uniform buffer at PARAMETER_BLOCK_BINDING under the same block name. Members own
+// whole rows of the group's state atlas, so SELECT_PARAMETERS(texel) finds a texel's member by row
+// and copies its entry into the globals the update and draw shaders already read.
+class GroupParameterBlock {
+public:
+  static constexpr size_t MAX_MEMBERS = 16;
+
+  void allocate();
+  void setLayout(size_t memberCount, size_t atlasWidth);
+  // Texels of the member's rows past particleCount get a zero pointSize, so draw culls them
+  void setMember(size_t member, const StepParameters& parameters, float pointSize, float speedThreshold, size_t firstRow, size_t particleCount);
+  void bind(); // uploads any change
+  size_t getUploadCount() const { return uploadCount; }
+
+  static ShaderDefines getShaderDefines(); // in place of ParameterBlock::getShaderDefines()
+  // Update shader: FIELD_DECLARATIONS samples the member's tile of a field atlas, one square tile per member
+  // side by side, and PARTICLE_WEIGHT takes each member's uniform weight when it has one
+  static ShaderDefines getUpdateShaderDefines();
+
+private:
+  // Mirrors the GLSL struct: thirteen floats and three ints, 64 bytes apart in a std140 array
+  struct MemberValues {
+    float field1ValueOffset = 0.0f;
+    float field2ValueOffset = 0.0f;
+    float field1Multiplier = 1.0f;
+    float field2Multiplier = 1.0f;
+    float velocityDamping = 1.0f;
+    float forceMultiplier = 1.0f;
+    float maxVelocity = 0.0f;
+    float maxDisplacement = 0.0f;
+    float jitterStrength = 0.0f;
+    float jitterSmoothing = 0.0f;
+    float uniformWeight = 0.0f;
+    float pointSize = 1.0f;
+    float speedThreshold = 1.0f;
+    int32_t firstRow = 0;
+    int32_t particleCount = 0;
+    int32_t fieldTile = 0;
+  };
+  static_assert(sizeof(MemberValues) == 64, "GroupParameterBlock::MemberValues must match the std140 struct");
+
+  // The member array is 16-byte aligned, so the two ints are followed by padding
+  struct Values {
+    int32_t memberCount = 0;
+    int32_t atlasWidth = 1;
+    int32_t padding[2] = {};
+    MemberValues members[MAX_MEMBERS];
+  };
+
+  ofBufferObject buffer;
+  Values values;
+  bool dirty = true;
+  size_t uploadCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "ComputeShader.h"
+#include "ParticleStateBuffer.h"
+
+namespace ofxParticleField {
+
+
+
+// InitShader for the compute backend: same hash, seeds and weights per texel
+class InitComputeShader : public ComputeShader {
+
+public:
+  static constexpr size_t WORKGROUP_SIZE = 64;
+
+  void initializeRegion(const ParticleStateBuffer& stateBuffer, size_t startX, size_t startY, size_t width, size_t height, float randomSeed, float minWeight = 0.5f, float maxWeight = 2.0f) {
+    shader.begin();
+    stateBuffer.bind(shader);
+    shader.setUniform2i("regionStart", (int)startX, (int)startY);
+    shader.setUniform1i("regionWidth", (int)width);
+    shader.setUniform1i("regionCount", (int)(width * height));
+    shader.setUniform1f("randomSeed", randomSeed);
+    shader.setUniform1f("minWeight", minWeight);
+    shader.setUniform1f("maxWeight", maxWeight);
+    dispatch(width * height, WORKGROUP_SIZE);
+    shader.end();
+  }
+
+protected:
+  std::string getComputeShader() override {
+    return injectDefines(GLSL(
+                layout(local_size_x = WORKGROUP_SIZE) in;
+                STATE_DECLARATIONS
+                uniform ivec2 regionStart;
+                uniform int regionWidth;
+                uniform int regionCount;
+                uniform float randomSeed;
+                uniform float minWeight;
+                uniform float maxWeight;
+
+                uint hash(uint x) {
+                  x += (x << 10u);
+                  x ^= (x >> 6u);
+                  x += (x << 3u);
+                  x ^= (x >> 11u);
+                  x += (x << 15u);
+                  return x;
+                }
+
+                uint hash(uvec2 v, uint seed) {
+                  return hash(v.x ^ hash(v.y) ^ seed);
+                }
+
+                float floatConstruct(uint m) {
+                  const uint ieeeMantissa = 0x007FFFFFu;
+                  const uint ieeeOne = 0x3F800000u;
+                  m &= ieeeMantissa;
+                  m |= ieeeOne;
+                  float f = uintBitsToFloat(m);
+                  return f - 1.0;
+                }
+
+                float random(vec2 v, float seed) {
+                  return floatConstruct(hash(uvec2(v), uint(seed * 1000.0)));
+                }
+
+                void main(void) {
+                  int i = int(gl_GlobalInvocationID.x);
+                  if (i >= regionCount) return;
+                  ivec2 texel = regionStart + ivec2(i % regionWidth, i / regionWidth);
+                  vec2 pixelCoord = vec2(texel) + 0.5; // gl_FragCoord in InitShader
+                  Particle particle;
+                  particle.position = vec2(random(pixelCoord, randomSeed), random(pixelCoord, randomSeed + 1.0));
+                  particle.velocity = vec2(0.0);
+                  particle.jitter = vec2(0.0);
+                  particle.weight = mix(minWeight, maxWeight, random(pixelCoord, randomSeed + 789.123));
+                  particle.padding = 0.0;
+                  particles[PARTICLE_INDEX(texel)] = particle;
+                }
+                ), getShaderDefines());
+  }
+
+private:
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = ParticleStateBuffer::getShaderDefines(false);
+    defines.push_back({ "WORKGROUP_SIZE", std::to_string(WORKGROUP_SIZE) });
+    return defines;
+  }
+
+};
+
+
+
+} // namespace ofxParticleField
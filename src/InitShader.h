@@ -1,14 +1,18 @@
 #pragma once
 
-#include "Shader.h"
+#include "CachedShader.h"
+#include "StateLayout.h"
 
 namespace ofxParticleField {
 
-class InitShader : public Shader {
+class InitShader : public CachedShader {
   
 public:
-  void initializeRegion(ofFbo& targetFbo, size_t dataIndex, size_t startX, size_t startY, size_t width, size_t height, float randomSeed, float minWeight = 0.5f, float maxWeight = 2.0f) {
-    glDrawBuffer(GL_COLOR_ATTACHMENT0 + dataIndex);
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load()
+
+  // Writes every state attachment in one pass
+  void initializeRegion(ofFbo& targetFbo, size_t startX, size_t startY, size_t width, size_t height, float randomSeed, float minWeight = 0.5f, float maxWeight = 2.0f) {
+    stateLayout.activateAllDrawBuffers();
     
     ofPushView();
     ofViewport(0, 0, targetFbo.getWidth(), targetFbo.getHeight());
@@ -20,10 +24,10 @@ public:
     glLoadIdentity();
     
     ofPushStyle();
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED); // state is data: the PACKED layout keeps velocity.y in alpha
     ofSetColor(255);
     ofFill();
     shader.begin();
-    shader.setUniform1i("dataIndex", (int)dataIndex);
     shader.setUniform2f("fboSize", (float)targetFbo.getWidth(), (float)targetFbo.getHeight());
     shader.setUniform2f("regionStart", (float)startX, (float)startY);
     shader.setUniform1f("randomSeed", randomSeed);
@@ -53,15 +57,14 @@ protected:
   }
   
   std::string getFragmentShader() override {
-    return GLSL(
+    return injectDefines(GLSL(
                 in vec2 texCoordVarying;
-                uniform int dataIndex;
                 uniform vec2 fboSize;
                 uniform vec2 regionStart;
                 uniform float randomSeed;
                 uniform float minWeight;
                 uniform float maxWeight;
-                out vec4 fragColor;
+                ALL_STATE_OUTPUTS
                 
                 uint hash(uint x) {
                   x += (x << 10u);
@@ -99,21 +102,15 @@ protected:
                 void main(void) {
                   vec2 pixelCoord = gl_FragCoord.xy;
                   vec2 rnd = random2(pixelCoord, randomSeed);
-                  
-                  if (dataIndex == 0) {
-                    fragColor = vec4(rnd.x, rnd.y, 0.0, 1.0);
-                  } else if (dataIndex == 1) {
-                    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
-                  } else if (dataIndex == 3) {
-                    float weight = mix(minWeight, maxWeight, random(pixelCoord, randomSeed + 789.123));
-                    fragColor = vec4(weight, 0.0, 0.0, 1.0);
-                  } else {
-                    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
-                  }
+                  float weight = mix(minWeight, maxWeight, random(pixelCoord, randomSeed + 789.123));
+                  WRITE_ALL_STATE(ENCODE_POSITION(rnd), vec2(0.0), vec2(0.0), weight);
                 }
-                );
+                ), stateLayout.getShaderDefines());
   }
   
+private:
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  
 };
 
 }
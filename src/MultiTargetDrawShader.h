@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <vector>
+
+#include "CachedShader.h"
+#include "Constants.h"
+#include "ParticleColors.h"
+#include "ParticleStateBuffer.h"
+#include "StateLayout.h"
+
+namespace ofxParticleField {
+
+
+
+// DrawShader for several same-sized targets at once: each particle's state and color are fetched and its
+// vertex stage run once, the sprite is rasterized at the largest of the targets' sizes, each shrunk and
+// culled as in DrawShader, and the fragment stage writes to each draw buffer what that target's own point
+// would have covered, so a 1 px target still gets its pixel. Blending applies to every buffer alike.
+class MultiTargetDrawShader : public CachedShader {
+
+public:
+  static constexpr size_t MAX_TARGETS = 4; // one vec4 component each
+
+  struct Target {
+    ofFbo* fbo = nullptr; // the same size as the other targets for a shared pass
+    float pointSize = 0.0f;
+    float speedThreshold = 1.0f;
+  };
+
+  ~MultiTargetDrawShader() {
+    if (framebuffer != 0) glDeleteFramebuffers(1, &framebuffer);
+    if (emptyVao != 0) glDeleteVertexArrays(1, &emptyVao);
+  }
+
+  void setColorStorage(ColorStorage colorStorage_) { colorStorage = colorStorage_; } // before load()
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load()
+  void setUseStateBuffer(bool useStateBuffer_) { useStateBuffer = useStateBuffer_; } // before load()
+
+  // Up to MAX_TARGETS targets, each with an fbo, all the same size and none multisampled: a multisampled
+  // ofFbo draws into a renderbuffer that's resolved into its texture, so its texture can't be attached here
+  static bool canRender(const std::vector<Target>& targets) {
+    if (targets.empty() || targets.size() > MAX_TARGETS) return false;
+    return std::all_of(targets.begin(), targets.end(), [&](const Target& target) {
+      return target.fbo && target.fbo->getId() == target.fbo->getIdDrawBuffer() &&
+             target.fbo->getWidth() == targets[0].fbo->getWidth() && target.fbo->getHeight() == targets[0].fbo->getHeight();
+    });
+  }
+
+  // False, with nothing drawn, when the framebuffer with the targets attached isn't complete
+  bool render(const std::vector<Target>& targets, PingPongFbo& particleData, const ParticleColors& particleColors, size_t particleCount) {
+    return renderPoints(targets, particleData.getSource().getWidth(), particleColors, particleCount, [&] {
+      stateLayout.bindStateTextures(shader, particleData.getSource());
+    });
+  }
+
+  bool render(const std::vector<Target>& targets, const ParticleStateBuffer& stateBuffer, const ParticleColors& particleColors, size_t particleCount) {
+    return renderPoints(targets, stateBuffer.getWidth(), particleColors, particleCount, [&] {
+      stateBuffer.bind(shader);
+    });
+  }
+
+protected:
+  bool renderPoints(const std::vector<Target>& targets, size_t particleDataWidth, const ParticleColors& particleColors, size_t particleCount, const std::function<void()>& bindState) {
+    if (!canRender(targets)) return false;
+    size_t targetCount = targets.size();
+    if (emptyVao == 0) glGenVertexArrays(1, &emptyVao);
+    if (framebuffer == 0) glGenFramebuffers(1, &framebuffer);
+
+    std::array<GLenum, MAX_TARGETS> drawBuffers {};
+    std::array<float, MAX_TARGETS> pointSizes {};
+    std::array<float, MAX_TARGETS> speedThresholds {};
+    for (size_t i = 0; i < targetCount; ++i) {
+      drawBuffers[i] = GL_COLOR_ATTACHMENT0 + (GLenum)i;
+      pointSizes[i] = targets[i].pointSize;
+      speedThresholds[i] = targets[i].speedThreshold;
+    }
+
+    ofFbo& firstTarget = *targets[0].fbo;
+    ofPushStyle();
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    firstTarget.begin(); // viewport and matrices for the shared size; end() restores the previous framebuffer
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    for (size_t i = 0; i < MAX_TARGETS; ++i) {
+      const ofTextureData* textureData = (i < targetCount) ? &targets[i].fbo->getTexture().getTextureData() : nullptr;
+      glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i,
+                             textureData ? textureData->textureTarget : GL_TEXTURE_2D, textureData ? textureData->textureID : 0, 0);
+    }
+    glDrawBuffers((GLsizei)targetCount, drawBuffers.data());
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      firstTarget.end();
+      glDisable(GL_PROGRAM_POINT_SIZE);
+      ofPopStyle();
+      return false;
+    }
+
+    shader.begin();
+    bindState();
+    shader.setUniformTexture("colorData", particleColors.getParticleTexture(), FIRST_COLOR_TEXTURE_UNIT);
+    if (particleColors.isPalette()) {
+      shader.setUniformTexture("paletteData", particleColors.getPaletteTexture(), FIRST_COLOR_TEXTURE_UNIT + 1);
+    }
+    shader.setUniform1i("particleDataWidth", (int)particleDataWidth);
+    shader.setUniform1i("renderW", firstTarget.getWidth());
+    shader.setUniform1i("renderH", firstTarget.getHeight());
+    shader.setUniform4f("targetPointSizes", pointSizes[0], pointSizes[1], pointSizes[2], pointSizes[3]);
+    shader.setUniform4f("targetSpeedThresholds", speedThresholds[0], speedThresholds[1], speedThresholds[2], speedThresholds[3]);
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)particleCount);
+    glBindVertexArray(0);
+    shader.end();
+    firstTarget.end();
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    ofPopStyle();
+    return true;
+  }
+
+  std::string getVertexShader() override {
+    return specialize(GLSL(
+                uniform mat4 modelViewProjectionMatrix;
+                STATE_DECLARATIONS
+                COLOR_DECLARATIONS
+                uniform int particleDataWidth;
+                uniform int renderW;
+                uniform int renderH;
+                uniform vec4 targetPointSizes; // zero for unused targets
+                uniform vec4 targetSpeedThresholds;
+                flat out vec4 targetSpeeds;
+                flat out vec4 targetSpriteSizes; // as rasterized, at least a pixel; zero where invisible
+                flat out vec4 targetRadiusScales;
+                flat out float spriteSizeVarying;
+                out vec4 colorVarying;
+
+                const float MIN_VISIBLE_ALPHA = 0.5 / 255.0;
+                const float MIN_SHRUNK_POINT_SIZE = 2.0;
+
+                void main() {
+                  ivec2 texel = ivec2(gl_VertexID % particleDataWidth, gl_VertexID / particleDataWidth);
+                  vec4 color = LOOKUP_COLOR(texel);
+                  vec4 speeds = smoothstep(0.0, 1.0, vec4(length(READ_VELOCITY(texel))) * targetSpeedThresholds);
+                  // Only the targets the particle shows in, at their peak alpha, count towards the sprite
+                  bvec4 visible = greaterThanEqual(clamp(color.a, 0.0, 1.0) * speeds, vec4(MIN_VISIBLE_ALPHA));
+                  visible = bvec4(vec4(visible) * vec4(greaterThan(targetPointSizes, vec4(0.0))));
+                  speeds = mix(vec4(0.0), speeds, visible);
+                  // Each target's sprite shrinks to the radius its alpha falloff reaches, as in DrawShader
+                  vec4 sizes = max(targetPointSizes * sqrt(speeds), min(targetPointSizes, vec4(MIN_SHRUNK_POINT_SIZE)));
+                  vec4 spriteSizes = mix(vec4(0.0), max(sizes, vec4(1.0)), visible);
+                  float spriteSize = max(max(spriteSizes.x, spriteSizes.y), max(spriteSizes.z, spriteSizes.w));
+                  if (spriteSize <= 0.0) {
+                    // Transparent in every target: outside the clip volume with no size
+                    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+                    gl_PointSize = 0.0;
+                    targetSpeeds = vec4(0.0);
+                    targetSpriteSizes = vec4(0.0);
+                    targetRadiusScales = vec4(0.0);
+                    spriteSizeVarying = 0.0;
+                    colorVarying = vec4(0.0);
+                    return;
+                  }
+                  vec2 normalizedParticlePosition = READ_POSITION(texel);
+                  vec4 position = vec4(normalizedParticlePosition.x * renderW,
+                                       normalizedParticlePosition.y * renderH,
+                                       0.0, 1.0);
+                  gl_Position = modelViewProjectionMatrix * position;
+                  gl_PointSize = spriteSize;
+                  // Squared radius in each target's full-size sprite units per squared radius of its shrunk sprite
+                  vec4 scales = sizes / max(targetPointSizes, vec4(1e-6));
+                  targetSpeeds = speeds;
+                  targetSpriteSizes = spriteSizes;
+                  targetRadiusScales = scales * scales;
+                  spriteSizeVarying = spriteSize;
+                  colorVarying = color;
+                }
+                ));
+  }
+
+  std::string getFragmentShader() override {
+    return specialize(GLSL(
+                flat in vec4 targetSpeeds;
+                flat in vec4 targetSpriteSizes;
+                flat in vec4 targetRadiusScales;
+                flat in float spriteSizeVarying;
+                in vec4 colorVarying;
+                layout(location = 0) out vec4 targetColors[4]; // writes beyond the bound draw buffers are dropped
+
+                void main(void) {
+                  vec2 cxy = 2.0 * gl_PointCoord - 1.0;
+                  float r = dot(cxy, cxy);
+                  if (r > 1.0) {
+                    discard;
+                  }
+
+                  // Each target's own point covers the pixels whose centres fall in its square, as the rasterizer's would,
+                  // with the squared radius measured over that point
+                  vec2 offset = (gl_PointCoord - 0.5) * spriteSizeVarying; // pixels from the particle
+                  vec4 halfSizes = 0.5 * targetSpriteSizes;
+                  vec4 inside = vec4(lessThan(vec4(abs(offset.x)), halfSizes)) * vec4(lessThan(vec4(abs(offset.y)), halfSizes));
+                  vec4 targetR = dot(offset, offset) / max(halfSizes * halfSizes, vec4(1e-6));
+                  inside *= vec4(lessThanEqual(targetR, vec4(1.0)));
+
+                  // Premultiplied, with each target's alpha falling off over its own sprite
+                  vec4 a = clamp(colorVarying.a, 0.0, 1.0) * inside * clamp(targetSpeeds - targetR * targetRadiusScales, 0.0, 1.0);
+                  targetColors[0] = vec4(colorVarying.rgb * a.x, a.x);
+                  targetColors[1] = vec4(colorVarying.rgb * a.y, a.y);
+                  targetColors[2] = vec4(colorVarying.rgb * a.z, a.z);
+                  targetColors[3] = vec4(colorVarying.rgb * a.w, a.w);
+                }
+                ));
+  }
+
+private:
+  // Storage buffers need GLSL 430
+  std::string specialize(const std::string& source) const {
+    std::string specialized = injectDefines(source, getShaderDefines());
+    return useStateBuffer ? replaceVersion(specialized, 430) : specialized;
+  }
+
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = useStateBuffer ? ParticleStateBuffer::getShaderDefines(true) : stateLayout.getShaderDefines();
+    ShaderDefines colorDefines = ParticleColors::getShaderDefines(colorStorage);
+    defines.insert(defines.end(), colorDefines.begin(), colorDefines.end());
+    return defines;
+  }
+
+  GLuint emptyVao = 0;
+  GLuint framebuffer = 0; // the targets' textures are attached to it for each render
+  ColorStorage colorStorage = ColorStorage::RGBA;
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  bool useStateBuffer = false;
+
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,43 @@
+#include <algorithm>
+
+#include "NeighbourGrid.h"
+
+namespace ofxParticleField {
+
+
+
+size_t NeighbourGrid::getCellOf(float x, float y) const {
+  auto axisCell = [this](float value) {
+    if (!(value >= 0.0f)) return 0; // also NaN
+    return std::min((int)(value * cellsPerAxis), cellsPerAxis - 1);
+  };
+  return (size_t)axisCell(y) * cellsPerAxis + axisCell(x);
+}
+
+void NeighbourGrid::build(const float* x, const float* y, size_t count, int cellsPerAxis_) {
+  cellsPerAxis = std::max(cellsPerAxis_, 1);
+  size_t numCells = (size_t)cellsPerAxis * cellsPerAxis;
+
+  // Count into cellStarts[cell + 1], so the prefix sum leaves each cell's start in cellStarts[cell]
+  cellStarts.assign(numCells + 1, 0);
+  pointCells.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t cell = (uint32_t)getCellOf(x[i], y[i]);
+    pointCells[i] = cell;
+    ++cellStarts[cell + 1];
+  }
+  for (size_t cell = 0; cell < numCells; ++cell) {
+    cellStarts[cell + 1] += cellStarts[cell];
+  }
+
+  // Scatter in index order through a running cursor per cell, so each cell lists its points in order
+  sortedIndices.resize(count);
+  cellCursors.assign(cellStarts.begin(), cellStarts.end() - 1);
+  for (size_t i = 0; i < count; ++i) {
+    sortedIndices[cellCursors[pointCells[i]]++] = (uint32_t)i;
+  }
+}
+
+
+
+} // namespace ofxParticleField
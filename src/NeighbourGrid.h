@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ofxParticleField {
+
+
+
+// Bins points on the unit torus into cellsPerAxis^2 cells by counting sort: one pass counts the points
+// per cell, a prefix sum turns counts into cell starts, and a second pass scatters the point indices,
+// so a build is linear in the point count. Queries visit the 3x3 cells around a point, which covers
+// any radius up to the cell size, with offsets wrapped the way positions wrap.
+class NeighbourGrid {
+public:
+  void build(const float* x, const float* y, size_t count, int cellsPerAxis);
+
+  int getCellsPerAxis() const { return cellsPerAxis; }
+  size_t getCellOf(float x, float y) const;
+  const std::vector<uint32_t>& getCellStarts() const { return cellStarts; } // cells + 1 entries
+  const std::vector<uint32_t>& getSortedIndices() const { return sortedIndices; } // point indices by cell
+
+  // Calls visit(j, dx, dy, distance) for up to maxNeighbours points j != self within radius of (x, y), where
+  // (dx, dy) is the wrapped offset from j to the point. Returns the number visited.
+  template<typename Visit>
+  size_t forEachNeighbour(const float* x, const float* y, size_t self, float radius, size_t maxNeighbours, Visit visit) const {
+    float px = x[self];
+    float py = y[self];
+    size_t cell = getCellOf(px, py);
+    int cellX = (int)(cell % cellsPerAxis);
+    int cellY = (int)(cell / cellsPerAxis);
+    int span = std::min(3, cellsPerAxis); // fewer cells than that would be visited twice
+    int first = (span == 3) ? -1 : 0;
+    float radiusSquared = radius * radius;
+    size_t visited = 0;
+    for (int offsetY = first; offsetY < first + span; ++offsetY) {
+      int neighbourY = (cellY + offsetY + cellsPerAxis) % cellsPerAxis;
+      for (int offsetX = first; offsetX < first + span; ++offsetX) {
+        size_t neighbourCell = (size_t)neighbourY * cellsPerAxis + (cellX + offsetX + cellsPerAxis) % cellsPerAxis;
+        for (uint32_t k = cellStarts[neighbourCell]; k < cellStarts[neighbourCell + 1]; ++k) {
+          uint32_t j = sortedIndices[k];
+          if (j == self) continue;
+          float dx = wrap(px - x[j]);
+          float dy = wrap(py - y[j]);
+          float distanceSquared = dx * dx + dy * dy;
+          if (distanceSquared >= radiusSquared) continue;
+          visit(j, dx, dy, std::sqrt(distanceSquared));
+          if (++visited >= maxNeighbours) return visited;
+        }
+      }
+    }
+    return visited;
+  }
+
+private:
+  static float wrap(float d) { return d - std::round(d); } // to [-0.5, 0.5] across the torus
+
+  int cellsPerAxis = 1;
+  std::vector<uint32_t> pointCells;
+  std::vector<uint32_t> cellStarts;
+  std::vector<uint32_t> cellCursors;
+  std::vector<uint32_t> sortedIndices;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,49 @@
+#include "NeighbourGridCompute.h"
+
+namespace ofxParticleField {
+
+
+
+void NeighbourGridCompute::load() {
+  const NeighbourGridShader::Pass passes[] = { NeighbourGridShader::Pass::COUNT, NeighbourGridShader::Pass::SCAN, NeighbourGridShader::Pass::SCATTER, NeighbourGridShader::Pass::INTERACT };
+  for (size_t i = 0; i < shaders.size(); ++i) {
+    shaders[i].setPass(passes[i]);
+    shaders[i].load();
+  }
+  loaded = true;
+}
+
+void NeighbourGridCompute::allocate(size_t capacity, size_t numCells) {
+  if (capacity != allocatedCapacity) {
+    sortedIndices.allocate(capacity * sizeof(uint32_t), GL_DYNAMIC_COPY);
+    interactionForces.allocate(capacity * 2 * sizeof(float), GL_DYNAMIC_COPY);
+    allocatedCapacity = capacity;
+  }
+  if (numCells != allocatedCells) {
+    cellCounts.allocate(numCells * sizeof(uint32_t), GL_DYNAMIC_COPY);
+    cellStarts.allocate((numCells + 1) * sizeof(uint32_t), GL_DYNAMIC_COPY);
+    allocatedCells = numCells;
+  }
+}
+
+void NeighbourGridCompute::compute(const ParticleStateBuffer& stateBuffer, size_t activeCount, const InteractionParameters& interaction) {
+  if (!loaded || activeCount == 0) return;
+  int cellsPerAxis = interaction.getCellsPerAxis();
+  allocate(stateBuffer.getWidth() * stateBuffer.getHeight(), (size_t)cellsPerAxis * cellsPerAxis);
+
+  cellCounts.bind(GL_SHADER_STORAGE_BUFFER);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  cellCounts.unbind(GL_SHADER_STORAGE_BUFFER);
+
+  cellCounts.bindBase(GL_SHADER_STORAGE_BUFFER, CELL_COUNT_BINDING);
+  cellStarts.bindBase(GL_SHADER_STORAGE_BUFFER, CELL_START_BINDING);
+  sortedIndices.bindBase(GL_SHADER_STORAGE_BUFFER, SORTED_INDEX_BINDING);
+  interactionForces.bindBase(GL_SHADER_STORAGE_BUFFER, INTERACTION_FORCE_BINDING);
+  for (auto& shader : shaders) {
+    shader.dispatch(stateBuffer, activeCount, cellsPerAxis, interaction);
+  }
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+
+#include "NeighbourGridShader.h"
+#include "ParticleStateBuffer.h"
+#include "StepParameters.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// NeighbourGrid for the compute backend: the particles in the state buffer are binned by a counting
+// sort on the GPU (atomic counts, a one-workgroup scan, an atomic scatter) and the interaction force
+// of every active particle is written to a buffer that the interaction variant of UpdateComputeShader
+// reads at INTERACTION_FORCE_BINDING. Every pass is linear in the particle count.
+class NeighbourGridCompute {
+public:
+  void load(); // needs a current GL 4.3 context
+  bool isLoaded() const { return loaded; }
+
+  // Before each update step; leaves the forces bound for it
+  void compute(const ParticleStateBuffer& stateBuffer, size_t activeCount, const InteractionParameters& interaction);
+
+private:
+  void allocate(size_t capacity, size_t numCells);
+
+  bool loaded = false;
+  std::array<NeighbourGridShader, 4> shaders; // by NeighbourGridShader::Pass
+  ofBufferObject cellCounts;
+  ofBufferObject cellStarts;
+  ofBufferObject sortedIndices;
+  ofBufferObject interactionForces;
+  size_t allocatedCapacity = 0;
+  size_t allocatedCells = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+
+#include "ComputeShader.h"
+#include "Constants.h"
+#include "ParticleStateBuffer.h"
+#include "StepParameters.h"
+
+namespace ofxParticleField {
+
+
+
+// The passes of NeighbourGridCompute, one program each: COUNT adds every active particle to its cell's
+// count, SCAN turns the counts into cell starts in one workgroup, SCATTER writes particle indices in
+// cell order through the counts reused as cursors, and INTERACT sums the forces from each particle's
+// neighbours the way CpuSimulation does.
+class NeighbourGridShader : public ComputeShader {
+
+public:
+  enum class Pass { COUNT, SCAN, SCATTER, INTERACT };
+  static constexpr size_t WORKGROUP_SIZE = 256;
+  static constexpr size_t SCAN_WORKGROUP_SIZE = 1024; // the minimum GL 4.3 guarantees
+
+  void setPass(Pass pass_) { pass = pass_; } // before load()
+
+  // Grid buffers are bound by the caller
+  void dispatch(const ParticleStateBuffer& stateBuffer, size_t activeCount, int cellsPerAxis, const InteractionParameters& interaction) {
+    shader.begin();
+    stateBuffer.bind(shader);
+    shader.setUniform1i("activeCount", (int)activeCount);
+    shader.setUniform1i("cellsPerAxis", cellsPerAxis);
+    if (pass == Pass::INTERACT) {
+      shader.setUniform1f("radius", std::min(interaction.radius, 1.0f / cellsPerAxis));
+      shader.setUniform1f("separation", interaction.separation);
+      shader.setUniform1f("alignment", interaction.alignment);
+      shader.setUniform1f("pressure", interaction.pressure);
+      shader.setUniform1f("restDensity", interaction.restDensity);
+      shader.setUniform1i("maxNeighbours", interaction.maxNeighbours);
+    }
+    if (pass == Pass::SCAN) {
+      ComputeShader::dispatch(SCAN_WORKGROUP_SIZE, SCAN_WORKGROUP_SIZE);
+    } else {
+      ComputeShader::dispatch(activeCount, WORKGROUP_SIZE);
+    }
+    shader.end();
+  }
+
+protected:
+  std::string getComputeShader() override {
+    return injectDefines(GLSL(
+                layout(local_size_x = LOCAL_SIZE) in;
+                STATE_DECLARATIONS
+                layout(std430, binding = CELL_COUNT_BINDING) buffer CellCounts { uint cellCounts[]; };
+                layout(std430, binding = CELL_START_BINDING) buffer CellStarts { uint cellStarts[]; };
+                layout(std430, binding = SORTED_INDEX_BINDING) buffer SortedIndices { uint sortedIndices[]; };
+                layout(std430, binding = INTERACTION_FORCE_BINDING) writeonly buffer InteractionForces { vec2 interactionForces[]; };
+                uniform int activeCount;
+                uniform int cellsPerAxis;
+                uniform float radius;
+                uniform float separation;
+                uniform float alignment;
+                uniform float pressure;
+                uniform float restDensity;
+                uniform int maxNeighbours;
+                shared uint partialSums[LOCAL_SIZE];
+
+                ivec2 cellOf(vec2 position) {
+                  return clamp(ivec2(position * float(cellsPerAxis)), ivec2(0), ivec2(cellsPerAxis - 1));
+                }
+
+                int cellIndex(ivec2 cell) {
+                  return cell.y * cellsPerAxis + cell.x;
+                }
+
+                void count(int i) {
+                  if (i >= activeCount) return;
+                  atomicAdd(cellCounts[cellIndex(cellOf(particles[i].position))], 1u);
+                }
+
+                // Each invocation sums a run of cells, the run totals are scanned in shared memory,
+                // then each run is written out as exclusive starts
+                void scan() {
+                  uint t = gl_LocalInvocationID.x;
+                  uint numCells = uint(cellsPerAxis * cellsPerAxis);
+                  uint run = (numCells + uint(LOCAL_SIZE) - 1u) / uint(LOCAL_SIZE);
+                  uint begin = min(t * run, numCells);
+                  uint end = min(begin + run, numCells);
+                  uint sum = 0u;
+                  for (uint cell = begin; cell < end; ++cell) sum += cellCounts[cell];
+                  partialSums[t] = sum;
+                  barrier();
+                  for (uint offset = 1u; offset < uint(LOCAL_SIZE); offset <<= 1) {
+                    uint previous = (t >= offset) ? partialSums[t - offset] : 0u;
+                    barrier();
+                    partialSums[t] += previous;
+                    barrier();
+                  }
+                  uint start = partialSums[t] - sum;
+                  for (uint cell = begin; cell < end; ++cell) {
+                    uint cellCount = cellCounts[cell];
+                    cellStarts[cell] = start;
+                    cellCounts[cell] = start; // cursor for the scatter
+                    start += cellCount;
+                  }
+                  if (t == uint(LOCAL_SIZE) - 1u) cellStarts[numCells] = partialSums[t];
+                }
+
+                void scatter(int i) {
+                  if (i >= activeCount) return;
+                  uint slot = atomicAdd(cellCounts[cellIndex(cellOf(particles[i].position))], 1u);
+                  sortedIndices[slot] = uint(i);
+                }
+
+                void interact(int i) {
+                  if (i >= activeCount) return;
+                  vec2 position = particles[i].position;
+                  ivec2 cell = cellOf(position);
+                  int span = min(3, cellsPerAxis);
+                  int first = (span == 3) ? -1 : 0;
+                  vec2 away = vec2(0.0);
+                  vec2 velocitySum = vec2(0.0);
+                  float kernelSum = 0.0;
+                  float density = 0.0;
+                  int visited = 0;
+                  for (int offsetY = first; offsetY < first + span && visited < maxNeighbours; ++offsetY) {
+                    for (int offsetX = first; offsetX < first + span && visited < maxNeighbours; ++offsetX) {
+                      int neighbourCell = cellIndex((cell + ivec2(offsetX, offsetY) + cellsPerAxis) % cellsPerAxis);
+                      for (uint k = cellStarts[neighbourCell]; k < cellStarts[neighbourCell + 1] && visited < maxNeighbours; ++k) {
+                        uint j = sortedIndices[k];
+                        if (j == uint(i)) continue;
+                        vec2 offset = position - particles[j].position;
+                        offset -= round(offset); // wrapped across the torus
+                        float distance = length(offset);
+                        if (distance >= radius) continue;
+                        float kernel = 1.0 - distance / radius;
+                        away += offset / max(distance, 1e-6) * kernel;
+                        velocitySum += particles[j].velocity * kernel;
+                        kernelSum += kernel;
+                        density += kernel * kernel;
+                        ++visited;
+                      }
+                    }
+                  }
+                  vec2 force = away * (separation + pressure * (density - restDensity));
+                  if (kernelSum > 0.0) force += (velocitySum / kernelSum - particles[i].velocity) * alignment;
+                  interactionForces[i] = force;
+                }
+
+                void main(void) {
+                  RUN_PASS;
+                }
+                ), getShaderDefines());
+  }
+
+private:
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = ParticleStateBuffer::getShaderDefines(true);
+    defines.push_back({ "LOCAL_SIZE", std::to_string(pass == Pass::SCAN ? SCAN_WORKGROUP_SIZE : WORKGROUP_SIZE) });
+    defines.push_back({ "CELL_COUNT_BINDING", std::to_string(CELL_COUNT_BINDING) });
+    defines.push_back({ "CELL_START_BINDING", std::to_string(CELL_START_BINDING) });
+    defines.push_back({ "SORTED_INDEX_BINDING", std::to_string(SORTED_INDEX_BINDING) });
+    defines.push_back({ "INTERACTION_FORCE_BINDING", std::to_string(INTERACTION_FORCE_BINDING) });
+    const char* passes[] = { "count(int(gl_GlobalInvocationID.x))", "scan()", "scatter(int(gl_GlobalInvocationID.x))", "interact(int(gl_GlobalInvocationID.x))" };
+    defines.push_back({ "RUN_PASS", passes[(int)pass] });
+    return defines;
+  }
+
+  Pass pass = Pass::COUNT;
+
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstring>
+
+#include "ParameterBlock.h"
+
+namespace ofxParticleField {
+
+
+
+void ParameterBlock::allocate() {
+  GLint alignment = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = std::max(alignment, 1);
+  slotStride = (sizeof(Values) + alignment - 1) / alignment * alignment;
+  buffer.allocate(slotStride * slots.size(), GL_DYNAMIC_DRAW);
+  for (auto& slot : slots) slot.dirty = true;
+}
+
+void ParameterBlock::setStepParameters(const StepParameters& parameters) {
+  Values newValues = slots[STEP_SLOT].values;
+  newValues.field1ValueOffset = parameters.field1ValueOffset;
+  newValues.field2ValueOffset = parameters.field2ValueOffset;
+  newValues.field1Multiplier = parameters.field1Multiplier;
+  newValues.field2Multiplier = parameters.field2Multiplier;
+  newValues.velocityDamping = parameters.velocityDamping;
+  newValues.forceMultiplier = parameters.forceMultiplier;
+  newValues.maxVelocity = parameters.maxVelocity;
+  newValues.maxDisplacement = parameters.maxDisplacement;
+  newValues.jitterStrength = parameters.jitterStrength;
+  newValues.jitterSmoothing = parameters.jitterSmoothing;
+  newValues.uniformWeight = parameters.uniformWeight;
+  newValues.interactionMultiplier = parameters.interactionMultiplier;
+  setValues(STEP_SLOT, newValues);
+}
+
+// The draw shader reads only the draw parameters, so the step values in draw slots don't matter
+void ParameterBlock::setDrawParameters(float pointSize, float speedThreshold) {
+  size_t slotIndex = STEP_SLOT + 1;
+  for (size_t i = STEP_SLOT + 1; i < slots.size(); ++i) {
+    const Values& slotValues = slots[i].values;
+    if (slotValues.pointSize == pointSize && slotValues.speedThreshold == speedThreshold) {
+      slotIndex = i;
+      break;
+    }
+    if (slots[i].lastUse < slots[slotIndex].lastUse) slotIndex = i;
+  }
+  Values newValues = slots[slotIndex].values;
+  newValues.pointSize = pointSize;
+  newValues.speedThreshold = speedThreshold;
+  setValues(slotIndex, newValues);
+}
+
+// Bitwise, so an infinite maxDisplacement compares equal to itself
+void ParameterBlock::setValues(size_t slotIndex, const Values& newValues) {
+  Slot& slot = slots[slotIndex];
+  currentSlot = slotIndex;
+  slot.lastUse = ++useCount;
+  if (std::memcmp(&newValues, &slot.values, sizeof(Values)) == 0) return;
+  slot.values = newValues;
+  slot.dirty = true;
+}
+
+void ParameterBlock::bind() {
+  if (!buffer.isAllocated()) return;
+  Slot& slot = slots[currentSlot];
+  size_t offset = currentSlot * slotStride;
+  if (slot.dirty) {
+    buffer.updateData(offset, sizeof(Values), &slot.values);
+    slot.dirty = false;
+    ++uploadCount;
+  }
+  buffer.bindRange(GL_UNIFORM_BUFFER, PARAMETER_BLOCK_BINDING, offset, sizeof(Values));
+}
+
+// Binding in GLSL would need 420, above the version GLSL() emits
+void ParameterBlock::bindToProgram(const ofShader& shader) {
+  GLuint index = glGetUniformBlockIndex(shader.getProgram(), BLOCK_NAME);
+  if (index != GL_INVALID_INDEX) glUniformBlockBinding(shader.getProgram(), index, PARAMETER_BLOCK_BINDING);
+}
+
+ShaderDefines ParameterBlock::getShaderDefines() {
+  return {
+    { "PARAMETER_BLOCK", std::string("layout(std140) uniform ") + BLOCK_NAME + " { "
+                         "float field1ValueOffset; float field2ValueOffset; float field1Multiplier; float field2Multiplier; "
+                         "float velocityDamping; float forceMultiplier; float maxVelocity; float maxDisplacement; "
+                         "float jitterStrength; float jitterSmoothing; float uniformWeight; float pointSize; "
+                         "float speedThreshold; float interactionMultiplier; };" },
+    { "SELECT_PARAMETERS(texel)", "" }
+  };
+}
+
+
+
+} // namespace ofxParticleField
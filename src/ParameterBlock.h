@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Constants.h"
+#include "ShaderDefines.h"
+#include "StepParameters.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Simulation and draw parameters in one std140 uniform block that the update and draw shaders
+// read at PARAMETER_BLOCK_BINDING. The buffer holds a slot for the step parameters and a few for
+// draw parameters, bound by offset; a draw reuses the slot already holding its point size and speed
+// threshold. Slots are only written when a value differs, so a steady-state frame drawing up to
+// DRAW_SLOT_COUNT targets in turn binds them and uploads nothing.
+class ParameterBlock {
+public:
+  static constexpr const char* BLOCK_NAME = "ParticleFieldParameters"; // GroupParameterBlock's too, so programs bind either alike
+
+  void allocate();
+  void setStepParameters(const StepParameters& parameters); // all but jitterSeed, which changes every substep
+  void setDrawParameters(float pointSize, float speedThreshold);
+  void bind(); // the slot last set, uploading any change; before the shaders run, as other fields bind their own blocks
+  size_t getUploadCount() const { return uploadCount; }
+
+  static void bindToProgram(const ofShader& shader); // after load()
+  // PARAMETER_BLOCK declares the block's members as globals; SELECT_PARAMETERS(texel) is empty, see GroupParameterBlock
+  static ShaderDefines getShaderDefines();
+
+private:
+  // Mirrors the GLSL block: std140 packs consecutive floats at 4 bytes and rounds the block to 16
+  struct Values {
+    float field1ValueOffset = 0.0f;
+    float field2ValueOffset = 0.0f;
+    float field1Multiplier = 1.0f;
+    float field2Multiplier = 1.0f;
+    float velocityDamping = 1.0f;
+    float forceMultiplier = 1.0f;
+    float maxVelocity = 0.0f;
+    float maxDisplacement = 0.0f;
+    float jitterStrength = 0.0f;
+    float jitterSmoothing = 0.0f;
+    float uniformWeight = 0.0f;
+    float pointSize = 1.0f;
+    float speedThreshold = 1.0f;
+    float interactionMultiplier = 1.0f;
+    float padding[2] = {};
+  };
+  static_assert(sizeof(Values) == 64, "ParameterBlock::Values must match the std140 block");
+
+  struct Slot {
+    Values values;
+    bool dirty = true;
+    uint64_t lastUse = 0;
+  };
+
+  static constexpr size_t STEP_SLOT = 0;
+  static constexpr size_t DRAW_SLOT_COUNT = 4; // one per target drawn in turn; the least recently used is replaced
+
+  void setValues(size_t slotIndex, const Values& newValues);
+
+  ofBufferObject buffer;
+  std::array<Slot, 1 + DRAW_SLOT_COUNT> slots;
+  size_t slotStride = sizeof(Values); // rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  size_t currentSlot = STEP_SLOT;
+  uint64_t useCount = 0;
+  size_t uploadCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
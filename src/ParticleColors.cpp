@@ -0,0 +1,240 @@
+#include "ParticleColors.h"
+
+namespace ofxParticleField {
+
+
+
+void ParticleColors::setup(ColorStorage storage_, const ofFloatColor& defaultColor_, size_t paletteSize_) {
+  storage = storage_;
+  defaultColor = defaultColor_;
+  if (!isPalette()) return;
+
+  size_t maxPaletteSize = (storage == ColorStorage::PALETTE8) ? 256 : 65536;
+  paletteSize = std::clamp<size_t>(paletteSize_, 1, maxPaletteSize);
+  size_t rows = (paletteSize + PALETTE_TEXTURE_WIDTH - 1) / PALETTE_TEXTURE_WIDTH;
+  paletteTexture.allocate(PALETTE_TEXTURE_WIDTH, rows, GL_RGBA32F, true, GL_RGBA, GL_FLOAT);
+  paletteTexture.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+  std::vector<ofFloatColor> entries(PALETTE_TEXTURE_WIDTH * rows, defaultColor);
+  paletteTexture.loadData(&entries[0].r, PALETTE_TEXTURE_WIDTH, rows, GL_RGBA);
+}
+
+bool ParticleColors::isAllocated() const {
+  return isPalette() ? paletteIndexTexture.isAllocated() : colorFbo.isAllocated();
+}
+
+size_t ParticleColors::getBytesPerParticle() const {
+  switch (storage) {
+    case ColorStorage::PALETTE8: return 1;
+    case ColorStorage::PALETTE16: return 2;
+    default: return sizeof(ofFloatColor);
+  }
+}
+
+const ofTexture& ParticleColors::getParticleTexture() const {
+  return isPalette() ? paletteIndexTexture : colorFbo.getTexture();
+}
+
+ShaderDefines ParticleColors::getShaderDefines(ColorStorage storage) {
+  if (storage == ColorStorage::RGBA) {
+    return {
+      { "COLOR_DECLARATIONS", "uniform sampler2DRect colorData;" },
+      { "LOOKUP_COLOR(texel)", "texelFetch(colorData, texel)" }
+    };
+  }
+  return {
+    { "COLOR_DECLARATIONS", "uniform usampler2DRect colorData; uniform sampler2DRect paletteData;" },
+    { "PALETTE_TEXEL(i)", "ivec2(int(i) % " + std::to_string(PALETTE_TEXTURE_WIDTH) + ", int(i) / " + std::to_string(PALETTE_TEXTURE_WIDTH) + ")" },
+    { "LOOKUP_COLOR(texel)", "texelFetch(paletteData, PALETTE_TEXEL(texelFetch(colorData, texel).r))" }
+  };
+}
+
+void ParticleColors::resize(size_t newWidth, size_t newHeight) {
+  if (newWidth == width && newHeight == height && isAllocated()) return;
+  flush(); // pending indices refer to the old width
+  if (isPalette()) {
+    resizePaletteIndexTexture(newWidth, newHeight);
+  } else {
+    resizeColorFbo(newWidth, newHeight);
+  }
+  width = newWidth;
+  height = newHeight;
+}
+
+ofFboSettings ParticleColors::createColorFboSettings(size_t width, size_t height) const {
+  ofFboSettings fboSettings;
+  fboSettings.width = width;
+  fboSettings.height = height;
+  fboSettings.numColorbuffers = 1;
+  fboSettings.internalformat = GL_RGBA32F;
+  fboSettings.textureTarget = GL_TEXTURE_RECTANGLE;
+  fboSettings.minFilter = GL_NEAREST;
+  fboSettings.maxFilter = GL_NEAREST;
+  fboSettings.wrapModeHorizontal = GL_CLAMP_TO_EDGE;
+  fboSettings.wrapModeVertical = GL_CLAMP_TO_EDGE;
+  return fboSettings;
+}
+
+// Colors stay on the GPU: surviving particles keep theirs, new ones get defaultColor
+void ParticleColors::resizeColorFbo(size_t newWidth, size_t newHeight) {
+  bool hasColors = colorFbo.isAllocated();
+  ofFbo tempFbo;
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+
+  if (hasColors) {
+    tempFbo.allocate(createColorFboSettings(colorFbo.getWidth(), colorFbo.getHeight()));
+    tempFbo.begin();
+    ofSetColor(255);
+    colorFbo.getTexture().draw(0, 0);
+    tempFbo.end();
+  }
+
+  colorFbo.allocate(createColorFboSettings(newWidth, newHeight));
+  colorFbo.begin();
+  glClearColor(defaultColor.r, defaultColor.g, defaultColor.b, defaultColor.a);
+  glClear(GL_COLOR_BUFFER_BIT);
+  if (hasColors) {
+    ofSetColor(255);
+    tempFbo.getTexture().draw(0, 0);
+  }
+  colorFbo.end();
+
+  ofPopStyle();
+}
+
+// Integer textures can't go through ofTexture::draw, so the surviving region is blitted
+void ParticleColors::resizePaletteIndexTexture(size_t newWidth, size_t newHeight) {
+  ofTextureData textureData;
+  textureData.width = newWidth;
+  textureData.height = newHeight;
+  textureData.textureTarget = GL_TEXTURE_RECTANGLE;
+  textureData.glInternalFormat = (storage == ColorStorage::PALETTE8) ? GL_R8UI : GL_R16UI;
+  ofTexture resized;
+  resized.allocate(textureData, GL_RED_INTEGER, (storage == ColorStorage::PALETTE8) ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT);
+  resized.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+
+  GLint previousDrawFramebuffer, previousReadFramebuffer;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+  GLuint framebuffers[2];
+  glGenFramebuffers(2, framebuffers);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[0]);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, resized.getTextureData().textureID, 0);
+  const GLuint defaultPaletteIndex[4] = { 0, 0, 0, 0 };
+  glClearBufferuiv(GL_COLOR, 0, defaultPaletteIndex);
+
+  if (paletteIndexTexture.isAllocated()) {
+    GLint minWidth = (GLint)std::min<size_t>(width, newWidth);
+    GLint minHeight = (GLint)std::min<size_t>(height, newHeight);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[1]);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, paletteIndexTexture.getTextureData().textureID, 0);
+    glBlitFramebuffer(0, 0, minWidth, minHeight, 0, 0, minWidth, minHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDrawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+  glDeleteFramebuffers(2, framebuffers);
+
+  paletteIndexTexture = resized;
+}
+
+// Splits the index range into row runs of the texture
+void ParticleColors::uploadRows(const ofTexture& texture, size_t startIndex, const void* data, size_t count, size_t bytesPerTexel, GLenum format, GLenum type) {
+  const ofTextureData& textureData = texture.getTextureData();
+  size_t textureWidth = textureData.width;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  glBindTexture(textureData.textureTarget, textureData.textureID);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  while (count > 0) {
+    size_t x = startIndex % textureWidth;
+    size_t y = startIndex / textureWidth;
+    size_t run = std::min(count, textureWidth - x);
+    glTexSubImage2D(textureData.textureTarget, 0, x, y, run, 1, format, type, bytes);
+    startIndex += run;
+    bytes += run * bytesPerTexel;
+    count -= run;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(textureData.textureTarget, 0);
+}
+
+void ParticleColors::flush() {
+  if (!isAllocated()) return;
+  size_t limit = getParticleCount();
+
+  if (!isPalette()) {
+    pendingColors.flush(limit, [this](size_t startIndex, const ofFloatColor* colors, size_t count) {
+      uploadRows(colorFbo.getTexture(), startIndex, colors, count, sizeof(ofFloatColor), GL_RGBA, GL_FLOAT);
+    });
+    return;
+  }
+
+  pendingPaletteIndices.flush(limit, [this](size_t startIndex, const uint16_t* paletteIndices, size_t count) {
+    uint16_t maxPaletteIndex = (uint16_t)(paletteSize - 1);
+    if (storage == ColorStorage::PALETTE8) {
+      paletteIndexUploadBuffer.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+        paletteIndexUploadBuffer[i] = (uint8_t)std::min(paletteIndices[i], maxPaletteIndex);
+      }
+      uploadRows(paletteIndexTexture, startIndex, paletteIndexUploadBuffer.data(), count, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE);
+    } else {
+      paletteIndexUploadBuffer.resize(count * sizeof(uint16_t));
+      uint16_t* clamped = reinterpret_cast<uint16_t*>(paletteIndexUploadBuffer.data());
+      for (size_t i = 0; i < count; ++i) {
+        clamped[i] = std::min(paletteIndices[i], maxPaletteIndex);
+      }
+      uploadRows(paletteIndexTexture, startIndex, clamped, count, sizeof(uint16_t), GL_RED_INTEGER, GL_UNSIGNED_SHORT);
+    }
+  });
+}
+
+void ParticleColors::permute(const ofTexture& permutation) {
+  if (!isAllocated()) return;
+  flush(); // pending writes address particles in the old order
+  if (!permuteShaderLoaded) {
+    permuteShader.setSingleTexture(isPalette());
+    permuteShader.load();
+    permuteShaderLoaded = true;
+  }
+
+  ofFboSettings fboSettings = createColorFboSettings(width, height);
+  if (isPalette()) fboSettings.internalformat = (storage == ColorStorage::PALETTE8) ? GL_R8UI : GL_R16UI;
+  ofFbo permuted;
+  permuted.allocate(fboSettings);
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  permuted.begin();
+  permuteShader.render(permutation, width, height, [this](ofShader& shader) {
+    shader.setUniformTexture("stateData0", getParticleTexture(), 0);
+  });
+  permuted.end();
+  ofPopStyle();
+
+  if (!isPalette()) {
+    copyAttachments(permuted, colorFbo, 0, 1, width, height);
+    return;
+  }
+  // The index texture isn't an FBO attachment, so it's blitted back through a temporary framebuffer
+  GLint previousDrawFramebuffer, previousReadFramebuffer;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, paletteIndexTexture.getTextureData().textureID, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, permuted.getId());
+  glBlitFramebuffer(0, 0, (GLint)width, (GLint)height, 0, 0, (GLint)width, (GLint)height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDrawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+  glDeleteFramebuffers(1, &framebuffer);
+}
+
+void ParticleColors::setPaletteColor(size_t paletteIndex, const ofFloatColor& color) {
+  if (paletteIndex >= paletteSize) return;
+  uploadRows(paletteTexture, paletteIndex, &color.r, 1, sizeof(ofFloatColor), GL_RGBA, GL_FLOAT);
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include "DirtyRangeTracker.h"
+#include "PermuteShader.h"
+#include "ShaderDefines.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+enum class ColorStorage {
+  RGBA,      // an RGBA32F color per particle
+  PALETTE8,  // an 8-bit palette index per particle, up to 256 palette entries
+  PALETTE16  // a 16-bit palette index per particle, up to 65536 palette entries
+};
+
+// Per-particle color on the GPU, one texel per particle laid out like the particle state.
+// Writes are queued and uploaded as coalesced sub-ranges by flush().
+class ParticleColors {
+public:
+  using IndexedColor = DirtyRangeTracker<ofFloatColor>::Write;
+  using IndexedPaletteIndex = DirtyRangeTracker<uint16_t>::Write;
+
+  static constexpr size_t PALETTE_TEXTURE_WIDTH = 256;
+
+  void setup(ColorStorage storage, const ofFloatColor& defaultColor, size_t paletteSize = 256);
+  void resize(size_t width, size_t height); // surviving particles keep their color, new ones get the default
+  void flush();
+  // Keeps each color with its particle when particles are reordered: particle i takes the color of
+  // particle permutation[i], from an R32UI texture laid out like the particles. Flushes first.
+  void permute(const ofTexture& permutation);
+
+  ColorStorage getStorage() const { return storage; }
+  bool isPalette() const { return storage != ColorStorage::RGBA; }
+  bool isAllocated() const;
+  size_t getParticleCount() const { return width * height; }
+  size_t getBytesPerParticle() const;
+
+  // RGBA storage
+  void setColor(size_t index, const ofFloatColor& color) { pendingColors.set(index, color); }
+  void setColors(const IndexedColor* indexedColors, size_t count) { pendingColors.set(indexedColors, count); }
+
+  // Palette storage: recoloring a palette entry recolors all of its particles with one texel upload
+  size_t getPaletteSize() const { return paletteSize; }
+  void setPaletteColor(size_t paletteIndex, const ofFloatColor& color);
+  void setPaletteIndex(size_t index, uint16_t paletteIndex) { pendingPaletteIndices.set(index, paletteIndex); }
+  void setPaletteIndices(const IndexedPaletteIndex* indexedPaletteIndices, size_t count) { pendingPaletteIndices.set(indexedPaletteIndices, count); }
+
+  // Sampled by DrawShader: colors, or palette indices plus the palette
+  const ofTexture& getParticleTexture() const;
+  const ofTexture& getPaletteTexture() const { return paletteTexture; }
+  static ShaderDefines getShaderDefines(ColorStorage storage);
+
+private:
+  ofFboSettings createColorFboSettings(size_t width, size_t height) const;
+  void resizeColorFbo(size_t width, size_t height);
+  void resizePaletteIndexTexture(size_t width, size_t height);
+  void uploadRows(const ofTexture& texture, size_t startIndex, const void* data, size_t count, size_t bytesPerTexel, GLenum format, GLenum type);
+
+  ColorStorage storage = ColorStorage::RGBA;
+  ofFloatColor defaultColor;
+  size_t width = 0;
+  size_t height = 0;
+
+  ofFbo colorFbo;
+  DirtyRangeTracker<ofFloatColor> pendingColors;
+
+  size_t paletteSize = 0;
+  ofTexture paletteIndexTexture;
+  ofTexture paletteTexture;
+  DirtyRangeTracker<uint16_t> pendingPaletteIndices;
+  std::vector<uint8_t> paletteIndexUploadBuffer;
+
+  PermuteShader permuteShader; // loaded on first permute()
+  bool permuteShaderLoaded = false;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "ParticleCountGovernor.h"
+#include "ofLog.h"
+
+namespace ofxParticleField {
+
+
+
+void ParticleCountGovernor::setup(const Settings& settings_) {
+  settings = settings_;
+  settings.minParticleCount = std::max<size_t>(settings.minParticleCount, 1);
+  settings.maxParticleCount = std::max(settings.maxParticleCount, settings.minParticleCount);
+  pointSizeScale = 1.0f;
+  lastCostMs = 0.0f;
+  overloadedEvaluations = 0;
+  underloadedEvaluations = 0;
+  ceilingCount = 0;
+  decisions.clear();
+}
+
+std::optional<ParticleCountGovernor::Decision> ParticleCountGovernor::evaluate(float costMs, size_t currentCount, float time) {
+  lastCostMs = costMs;
+  if (ceilingCount > 0 && ++evaluationsSinceCeiling >= settings.ceilingRetryEvaluations) {
+    ceilingCount = 0; // load may have changed since, so the count gets another chance
+  }
+
+  if (costMs > settings.budgetMs) {
+    ++overloadedEvaluations;
+    underloadedEvaluations = 0;
+  } else if (costMs < settings.budgetMs * settings.raiseBelowFraction) {
+    ++underloadedEvaluations;
+    overloadedEvaluations = 0;
+  } else {
+    overloadedEvaluations = 0;
+    underloadedEvaluations = 0;
+  }
+
+  if (overloadedEvaluations >= settings.overloadedEvaluationsToLower) {
+    overloadedEvaluations = 0;
+    if (currentCount > settings.minParticleCount) {
+      ceilingCount = currentCount;
+      evaluationsSinceCeiling = 0;
+      size_t toCount = std::max(settings.minParticleCount, (size_t)(currentCount * settings.lowerFactor));
+      return record(costMs, currentCount, toCount, pointSizeScale, "over budget", time);
+    }
+    if (settings.adjustPointSize && pointSizeScale > settings.minPointSizeScale) {
+      float fromPointSizeScale = pointSizeScale;
+      pointSizeScale = std::max(settings.minPointSizeScale, pointSizeScale * settings.pointSizeStep);
+      return record(costMs, currentCount, currentCount, fromPointSizeScale, "over budget at minimum count", time);
+    }
+    return std::nullopt;
+  }
+
+  if (underloadedEvaluations >= settings.underloadedEvaluationsToRaise) {
+    underloadedEvaluations = 0;
+    if (pointSizeScale < 1.0f) {
+      float fromPointSizeScale = pointSizeScale;
+      pointSizeScale = std::min(1.0f, pointSizeScale / settings.pointSizeStep);
+      return record(costMs, currentCount, currentCount, fromPointSizeScale, "under budget, restoring point size", time);
+    }
+    size_t limit = settings.maxParticleCount;
+    if (ceilingCount > 0) limit = std::min(limit, ceilingCount - 1);
+    size_t toCount = std::min(limit, (size_t)(currentCount * settings.raiseFactor));
+    if (toCount <= currentCount) return std::nullopt;
+    return record(costMs, currentCount, toCount, pointSizeScale, "under budget", time);
+  }
+  return std::nullopt;
+}
+
+ParticleCountGovernor::Decision& ParticleCountGovernor::record(float costMs, size_t fromCount, size_t toCount, float fromPointSizeScale, const std::string& reason, float time) {
+  ofLogNotice("ParticleCountGovernor") << reason << ": " << fromCount << " -> " << toCount << " particles, point size x"
+                                       << fromPointSizeScale << " -> x" << pointSizeScale << ", cost " << costMs << "ms of " << settings.budgetMs << "ms";
+  decisions.push_back({ time, costMs, settings.budgetMs, fromCount, toCount, fromPointSizeScale, pointSizeScale, reason });
+  while (decisions.size() > std::max<size_t>(settings.maxLoggedDecisions, 1)) {
+    decisions.pop_front();
+  }
+  return decisions.back();
+}
+
+
+
+} // namespace ofxParticleField
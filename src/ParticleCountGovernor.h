@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <string>
+
+namespace ofxParticleField {
+
+
+
+// Steers the particle count toward a per-frame cost budget. The count drops after sustained
+// overload and only grows after a longer run under a lower threshold, so there is a dead band
+// between the two. A count that overloaded becomes a ceiling for raises until it is retried.
+class ParticleCountGovernor {
+public:
+  struct Settings {
+    float budgetMs = 8.0f; // per-frame cost of every stage, summed over all draws, to stay under
+    float raiseBelowFraction = 0.75f; // of budgetMs; between this and budgetMs nothing changes
+    size_t minParticleCount = 1 << 12;
+    size_t maxParticleCount = 1 << 18;
+    float raiseFactor = 1.1f;
+    float lowerFactor = 0.85f;
+    size_t evaluationInterval = 30; // frames per evaluation; cost is the mean over the latest half of them
+    int overloadedEvaluationsToLower = 2;
+    int underloadedEvaluationsToRaise = 4;
+    int ceilingRetryEvaluations = 20; // evaluations before a count that overloaded may be tried again
+    // Shrinks the point size once the count is at minParticleCount, and restores it before raising the count
+    bool adjustPointSize = false;
+    float minPointSizeScale = 0.5f;
+    float pointSizeStep = 0.9f;
+    size_t maxLoggedDecisions = 256;
+  };
+
+  struct Decision {
+    float time; // seconds since app start
+    float costMs;
+    float budgetMs;
+    size_t fromCount;
+    size_t toCount;
+    float fromPointSizeScale;
+    float toPointSizeScale;
+    std::string reason;
+  };
+
+  void setup(const Settings& settings_);
+  const Settings& getSettings() const { return settings; }
+
+  // Returns a decision when the count or point size should change; it is also logged
+  std::optional<Decision> evaluate(float costMs, size_t currentCount, float time);
+
+  float getPointSizeScale() const { return pointSizeScale; }
+  float getLastCostMs() const { return lastCostMs; }
+  float getHeadroomMs() const { return settings.budgetMs - lastCostMs; } // negative when over budget
+  const std::deque<Decision>& getDecisions() const { return decisions; }
+
+private:
+  Decision& record(float costMs, size_t fromCount, size_t toCount, float fromPointSizeScale, const std::string& reason, float time);
+
+  Settings settings;
+  float pointSizeScale = 1.0f;
+  float lastCostMs = 0.0f;
+  int overloadedEvaluations = 0;
+  int underloadedEvaluations = 0;
+  size_t ceilingCount = 0; // 0 when there is none
+  int evaluationsSinceCeiling = 0;
+  std::deque<Decision> decisions;
+};
+
+
+
+} // namespace ofxParticleField
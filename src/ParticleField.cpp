@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 #include "ParticleField.h"
 #include "ofLog.h"
@@ -9,25 +12,110 @@ namespace ofxParticleField {
 
 
 ParticleField::ParticleField() {
-  ofPixels emptyFieldPixels;
-  emptyFieldPixels.allocate(1, 1, OF_PIXELS_RG);
-  emptyFieldPixels.setColor(ofColor::black);
   ofDisableArbTex();
-  emptyFieldTexture.allocate(emptyFieldPixels);
-  emptyFieldTexture.loadData(emptyFieldPixels);
 }
 
 void ParticleField::setup(ofFloatColor particleColor_, float field1ValueOffset_, float field2ValueOffset_) {
+  setup(particleColor_, field1ValueOffset_, field2ValueOffset_, Settings {});
+}
+
+void ParticleField::setup(ofFloatColor particleColor_, float field1ValueOffset_, float field2ValueOffset_, const Settings& settings_) {
   particleColor = particleColor_;
   field1ValueOffset = field1ValueOffset_;
   field2ValueOffset = field2ValueOffset_;
+  settings = settings_;
+  if (settings.backend == Backend::COMPUTE && !ParticleStateBuffer::isSupported()) {
+    ofLogWarning("ParticleField") << "compute backend needs a GL 4.3 context; using the GPU backend";
+    settings.backend = Backend::GPU;
+  }
+  stateLayout = StateLayout::create(settings.stateLayout, settings.positionEncoding);
+
+  int initialParticleCount = (int)std::pow(2.0f, ln2ParticleCountParameter.get());
+  int storageParticleCount = hasCapacity() ? (int)settings.particleCapacity : initialParticleCount;
+  if (settings.backend == Backend::CPU) {
+    // GL resources wait for the first draw() so headless nodes never need a context
+    size_t width, height;
+    calculateParticleDimensions(storageParticleCount, width, height);
+    resizeCpuParticles(width, height);
+  } else {
+    resizeParticleStorage(storageParticleCount);
+  }
+  if (hasCapacity()) setActiveParticleCount(initialParticleCount);
+}
+
+void ParticleField::allocateGpuResources(size_t width, size_t height) {
+  ofPixels emptyFieldPixels;
+  emptyFieldPixels.allocate(1, 1, OF_PIXELS_RG);
+  emptyFieldPixels.setColor(ofColor::black);
+  emptyFieldTexture.allocate(emptyFieldPixels);
+  emptyFieldTexture.loadData(emptyFieldPixels);
+
+  particleColors.setup(settings.colorStorage, particleColor, settings.paletteSize);
+  parameterBlock.allocate();
 
+  const ProgramCache& programCache = ProgramCache::shared();
+  size_t cachedLoadsBefore = programCache.getCachedLoadCount();
+  size_t compiledLoadsBefore = programCache.getCompiledLoadCount();
+
+  drawShader.setColorStorage(settings.colorStorage);
+  bool prepareFields = settings.prepareFields && settings.backend != Backend::CPU;
+  if (prepareFields) preparedField.load();
+  // Every update variant the settings allow is compiled here, so parameter changes never compile in the frame loop
+  bool interacting = neighbourGridCompute.isLoaded(); // set up again after setInteractionParameters()
+  auto isVariantNeeded = [prepareFields, interacting](uint32_t key) {
+    UpdateVariant variant = UpdateVariant::fromKey(key);
+    return UpdateVariant::isCanonicalKey(key) && variant.preparedField == prepareFields && (interacting || !variant.interaction);
+  };
+  if (settings.backend == Backend::COMPUTE) {
+    drawShader.setUseStateBuffer(true);
+    size_t workgroupSize = settings.computeWorkgroupSize;
+    updateComputeShaders.setup([workgroupSize](UpdateComputeShader& shader, const UpdateVariant& variant) {
+      shader.setWorkgroupSize(workgroupSize);
+      shader.setVariant(variant);
+    });
+    updateComputeShaders.warm(UpdateVariant::NUM_KEYS, isVariantNeeded);
+    initComputeShader.load();
+  } else if (settings.backend == Backend::GPU) {
+    drawShader.setStateLayout(stateLayout);
+    StateLayout layout = stateLayout;
+    updateShaders.setup([layout](UpdateShader& shader, const UpdateVariant& variant) {
+      shader.setStateLayout(layout);
+      shader.setVariant(variant);
+    });
+    updateShaders.warm(UpdateVariant::NUM_KEYS, isVariantNeeded);
+    initShader.setStateLayout(stateLayout);
+    initShader.load();
+  } else {
+    drawShader.setStateLayout(stateLayout);
+    initShader.setStateLayout(stateLayout);
+    initShader.load();
+  }
   drawShader.load();
-  updateShader.load();
-  initShader.load();
 
-  int initialParticleCount = (int)std::pow(2.0f, ln2ParticleCountParameter.get());
-  resizeParticles(initialParticleCount);
+  cachedProgramCount = programCache.getCachedLoadCount() - cachedLoadsBefore;
+  compiledProgramCount = programCache.getCompiledLoadCount() - compiledLoadsBefore;
+  ofLogNotice("ParticleField") << "shader programs: " << cachedProgramCount << " from cache, " << compiledProgramCount << " compiled";
+
+  gpuResourcesAllocated = true;
+
+  if (settings.backend == Backend::CPU) {
+    // State lives in cpuSimulation; the FBO only carries it to DrawShader
+    particleDataFbo.allocate(createParticleDataFboSettings(width, height));
+    particleColors.resize(width, height);
+    cpuStateDirty = true;
+  }
+}
+
+int ParticleField::getParticleCount() const {
+  if (settings.backend == Backend::CPU) return (int)cpuSimulation.getActiveCount();
+  return (int)activeParticleCount;
+}
+
+size_t ParticleField::getParticleCapacity() const {
+  if (settings.backend == Backend::CPU) return cpuSimulation.getParticleCount();
+  if (settings.backend == Backend::COMPUTE) return stateBuffer.getWidth() * stateBuffer.getHeight();
+  if (!particleDataFbo.isAllocated()) return 0;
+  return particleDataFbo.getWidth() * particleDataFbo.getHeight();
 }
 
 void ParticleField::setParameterOverrides(const ParameterOverrides& overrides) {
@@ -41,7 +129,8 @@ void ParticleField::setParameterOverrides(const ParameterOverrides& overrides) {
       parameterOverrides.minWeight == overrides.minWeight &&
       parameterOverrides.maxWeight == overrides.maxWeight &&
       parameterOverrides.field1Multiplier == overrides.field1Multiplier &&
-      parameterOverrides.field2Multiplier == overrides.field2Multiplier) {
+      parameterOverrides.field2Multiplier == overrides.field2Multiplier &&
+      parameterOverrides.clampDisplacement == overrides.clampDisplacement) {
     return;
   }
 
@@ -100,11 +189,54 @@ float ParticleField::getField2MultiplierEffective() const {
   return parameterOverrides.field2Multiplier.value_or(field2MultiplierParameter.get());
 }
 
+bool ParticleField::getClampDisplacementEffective() const {
+  return parameterOverrides.clampDisplacement.value_or(clampDisplacementParameter.get());
+}
+
 void ParticleField::resizeParticles(int newApproxNumParticles) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::RESIZE, gpuResourcesAllocated);
+  if (hasCapacity()) {
+    setActiveParticleCount(std::max(newApproxNumParticles, 0));
+    return;
+  }
+  resizeParticleStorage(newApproxNumParticles);
+}
+
+// Inactive particles past the count are left as they are and reseeded when they become active again
+void ParticleField::setActiveParticleCount(size_t count) {
+  count = std::min(count, getParticleCapacity());
+  size_t oldCount = getParticleCount();
+  if (count > oldCount) initializeParticleRange(oldCount, count);
+
+  if (settings.backend == Backend::CPU) {
+    cpuSimulation.setActiveCount(count);
+  } else {
+    activeParticleCount = count;
+  }
+}
+
+size_t ParticleField::getActiveRows() const {
+  size_t width = particleDataFbo.getWidth();
+  return (activeParticleCount + width - 1) / width;
+}
+
+void ParticleField::resizeParticleStorage(int newApproxNumParticles) {
   size_t newWidth, newHeight;
   calculateParticleDimensions(newApproxNumParticles, newWidth, newHeight);
   size_t newCount = newWidth * newHeight;
 
+  if (settings.backend == Backend::CPU) {
+    resizeCpuParticles(newWidth, newHeight);
+    return;
+  }
+
+  if (!gpuResourcesAllocated) allocateGpuResources(newWidth, newHeight);
+
+  if (settings.backend == Backend::COMPUTE) {
+    resizeComputeParticles(newWidth, newHeight);
+    return;
+  }
+
   bool isInitialSetup = !particleDataFbo.isAllocated();
 
   if (!isInitialSetup) {
@@ -118,15 +250,7 @@ void ParticleField::resizeParticles(int newApproxNumParticles) {
 
     ofFbo tempFbo;
     tempFbo.allocate(createParticleDataFboSettings(oldWidth, oldHeight));
-
-    tempFbo.begin();
-    for (size_t i = 0; i < numDataBuffers; ++i) {
-      glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
-      ofSetColor(255);
-      particleDataFbo.getSource().getTexture(i).draw(0, 0);
-    }
-    glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to default attachment
-    tempFbo.end();
+    copyAttachments(particleDataFbo.getSource(), tempFbo, 0, stateLayout.getNumAttachments(), oldWidth, oldHeight);
 
     particleDataFbo.allocate(createParticleDataFboSettings(newWidth, newHeight));
 
@@ -134,16 +258,12 @@ void ParticleField::resizeParticles(int newApproxNumParticles) {
     size_t minHeight = (oldHeight < newHeight) ? oldHeight : newHeight;
 
     particleDataFbo.getSource().begin();
-    for (size_t i = 0; i < numDataBuffers; ++i) {
-      glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
-      glClearColor(0, 0, 0, 0);
-      glClear(GL_COLOR_BUFFER_BIT);
-      ofSetColor(255);
-      tempFbo.getTexture(i).draw(0, 0, minWidth, minHeight);
-    }
-    glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to default attachment
+    stateLayout.clearAllAttachments();
+    particleDataFbo.getSource().end();
+    copyAttachments(tempFbo, particleDataFbo.getSource(), 0, stateLayout.getNumAttachments(), minWidth, minHeight);
 
     if (newCount > oldCount) {
+      particleDataFbo.getSource().begin();
       size_t initMinHeight = (oldHeight < newHeight) ? oldHeight : newHeight;
       if (newWidth > oldWidth) {
         initializeParticleRegion(oldWidth, 0, newWidth - oldWidth, initMinHeight);
@@ -151,8 +271,8 @@ void ParticleField::resizeParticles(int newApproxNumParticles) {
       if (newHeight > oldHeight) {
         initializeParticleRegion(0, oldHeight, newWidth, newHeight - oldHeight);
       }
+      particleDataFbo.getSource().end();
     }
-    particleDataFbo.getSource().end();
   } else {
     particleDataFbo.allocate(createParticleDataFboSettings(newWidth, newHeight));
 
@@ -160,8 +280,101 @@ void ParticleField::resizeParticles(int newApproxNumParticles) {
     initializeParticleRegion(0, 0, newWidth, newHeight);
     particleDataFbo.getSource().end();
   }
+  copyStaticState();
+
+  activeParticleCount = newCount;
+  particleColors.resize(newWidth, newHeight);
+}
+
+void ParticleField::resizeCpuParticles(size_t newWidth, size_t newHeight) {
+  size_t oldWidth = cpuSimulation.getWidth();
+  size_t oldHeight = cpuSimulation.getHeight();
+  if (oldWidth == newWidth && oldHeight == newHeight) return;
+
+  cpuSimulation.resize(newWidth, newHeight);
+
+  // Seed the same regions the GPU path initializes
+  float minWeight = getMinWeightEffective();
+  float maxWeight = getMaxWeightEffective();
+  if (oldWidth * oldHeight == 0) {
+    cpuSimulation.seedRegion(0, 0, newWidth, newHeight, ofRandom(10000.0f, 99999.0f), minWeight, maxWeight);
+  } else if (newWidth * newHeight > oldWidth * oldHeight) {
+    size_t initMinHeight = std::min(oldHeight, newHeight);
+    if (newWidth > oldWidth) {
+      cpuSimulation.seedRegion(oldWidth, 0, newWidth - oldWidth, initMinHeight, ofRandom(10000.0f, 99999.0f), minWeight, maxWeight);
+    }
+    if (newHeight > oldHeight) {
+      cpuSimulation.seedRegion(0, oldHeight, newWidth, newHeight - oldHeight, ofRandom(10000.0f, 99999.0f), minWeight, maxWeight);
+    }
+  }
+
+  if (gpuResourcesAllocated) {
+    particleDataFbo.allocate(createParticleDataFboSettings(newWidth, newHeight));
+    particleColors.resize(newWidth, newHeight);
+  }
+  cpuStateDirty = true;
+}
+
+void ParticleField::resizeComputeParticles(size_t newWidth, size_t newHeight) {
+  size_t oldWidth = stateBuffer.getWidth();
+  size_t oldHeight = stateBuffer.getHeight();
+  if (oldWidth == newWidth && oldHeight == newHeight) return;
+
+  stateBuffer.resize(newWidth, newHeight);
+
+  // Seed the same regions the GPU path initializes
+  if (oldWidth * oldHeight == 0) {
+    initializeParticleRegion(0, 0, newWidth, newHeight);
+  } else {
+    size_t initMinHeight = std::min(oldHeight, newHeight);
+    if (newWidth > oldWidth) {
+      initializeParticleRegion(oldWidth, 0, newWidth - oldWidth, initMinHeight);
+    }
+    if (newHeight > oldHeight) {
+      initializeParticleRegion(0, oldHeight, newWidth, newHeight - oldHeight);
+    }
+  }
+
+  activeParticleCount = newWidth * newHeight;
+  particleColors.resize(newWidth, newHeight);
+}
+
+void ParticleField::reinitializeParticles() {
+  if (settings.backend == Backend::CPU) {
+    cpuSimulation.seedRegion(0, 0, cpuSimulation.getWidth(), cpuSimulation.getHeight(), ofRandom(10000.0f, 99999.0f), getMinWeightEffective(), getMaxWeightEffective());
+    cpuStateDirty = true;
+    return;
+  }
+  if (settings.backend == Backend::COMPUTE) {
+    if (stateBuffer.isAllocated()) initializeParticleRegion(0, 0, stateBuffer.getWidth(), stateBuffer.getHeight());
+    return;
+  }
+  if (!particleDataFbo.isAllocated()) return;
+  particleDataFbo.getSource().begin();
+  initializeParticleRegion(0, 0, particleDataFbo.getWidth(), particleDataFbo.getHeight());
+  particleDataFbo.getSource().end();
+  copyStaticState();
+}
 
-  rebuildMesh(newWidth, newHeight);
+// Update steps only write the dynamic attachments, so both ping-pong sides need the static ones
+void ParticleField::copyStaticState() {
+  stateLayout.copyStaticAttachments(particleDataFbo.getSource(), particleDataFbo.getTarget());
+}
+
+size_t ParticleField::getUpdateBytesPerParticle() const {
+  if (settings.backend == Backend::CPU) {
+    return (7 + 6) * sizeof(float); // SoA: position, velocity, jitter, weight read; all but weight written
+  }
+  if (settings.backend == Backend::COMPUTE) return stateBuffer.getUpdateBytesPerParticle();
+  return stateLayout.getUpdateBytesPerParticle();
+}
+
+size_t ParticleField::getDrawBytesPerParticle() const {
+  // Position and velocity are fetched once per particle in the vertex stage
+  size_t positionFetchBytes = (settings.backend == Backend::COMPUTE) ? 4 * sizeof(float) : stateLayout.getPositionBytesPerParticle() + stateLayout.getVelocityBytesPerParticle();
+  size_t colorFetchBytes = particleColors.getBytesPerParticle() + (particleColors.isPalette() ? sizeof(ofFloatColor) : 0);
+  size_t cpuUploadBytes = (settings.backend == Backend::CPU) ? 4 * sizeof(float) : 0;
+  return positionFetchBytes + colorFetchBytes + cpuUploadBytes;
 }
 
 void ParticleField::calculateParticleDimensions(int approxNumParticles, size_t& outWidth, size_t& outHeight) const {
@@ -169,38 +382,93 @@ void ParticleField::calculateParticleDimensions(int approxNumParticles, size_t&
   outHeight = approxNumParticles / outWidth;
 }
 
-void ParticleField::initializeParticleRegion(size_t x, size_t y, size_t width, size_t height) {
-  for (size_t i = 0; i < numDataBuffers; ++i) {
-    initShader.initializeRegion(particleDataFbo.getTarget(),
-                               i,
-                               x,
-                               y,
-                               width,
-                               height,
-                               ofRandom(10000.0f, 99999.0f) + i * 123.45f,
-                               getMinWeightEffective(),
-                               getMaxWeightEffective());
-  }
-}
-
-void ParticleField::rebuildMesh(size_t width, size_t height) {
-  mesh.clear();
-  mesh.setMode(OF_PRIMITIVE_POINTS);
-  for (size_t x = 0; x < width; ++x) {
-    for (size_t y = 0; y < height; ++y) {
-      mesh.addVertex({ (float)x, (float)y, 0.0f });
-      mesh.addTexCoord({ (float)x, (float)y });
-      mesh.addColor(particleColor);
+namespace {
+
+// Splits particle indices [begin, end) into texel rectangles: the rest of the first row, whole rows, then the start of the last row
+template<typename RegionFunction>
+void forEachRegionInRange(size_t begin, size_t end, size_t width, RegionFunction&& regionFunction) {
+  while (begin < end) {
+    size_t x = begin % width;
+    size_t y = begin / width;
+    if (x == 0 && end - begin >= width) {
+      size_t rows = (end - begin) / width;
+      regionFunction(0, y, width, rows);
+      begin += rows * width;
+    } else {
+      size_t run = std::min(end - begin, width - x);
+      regionFunction(x, y, run, 1);
+      begin += run;
     }
   }
 }
 
+} // namespace
+
+// Reseeds particles in place, with no reallocation
+void ParticleField::initializeParticleRange(size_t begin, size_t end) {
+  if (settings.backend == Backend::CPU) {
+    forEachRegionInRange(begin, end, cpuSimulation.getWidth(), [this](size_t x, size_t y, size_t width, size_t height) {
+      cpuSimulation.seedRegion(x, y, width, height, ofRandom(10000.0f, 99999.0f), getMinWeightEffective(), getMaxWeightEffective());
+    });
+    cpuStateDirty = true;
+    return;
+  }
+  if (settings.backend == Backend::COMPUTE) {
+    forEachRegionInRange(begin, end, stateBuffer.getWidth(), [this](size_t x, size_t y, size_t width, size_t height) {
+      initializeParticleRegion(x, y, width, height);
+    });
+    return;
+  }
+  particleDataFbo.getSource().begin();
+  forEachRegionInRange(begin, end, particleDataFbo.getWidth(), [this](size_t x, size_t y, size_t width, size_t height) {
+    initializeParticleRegion(x, y, width, height);
+  });
+  particleDataFbo.getSource().end();
+  copyStaticState();
+}
+
+// GPU: within particleDataFbo.getSource().begin()/end()
+void ParticleField::initializeParticleRegion(size_t x, size_t y, size_t width, size_t height) {
+  if (settings.backend == Backend::COMPUTE) {
+    initComputeShader.initializeRegion(stateBuffer, x, y, width, height, ofRandom(10000.0f, 99999.0f), getMinWeightEffective(), getMaxWeightEffective());
+    return;
+  }
+  initShader.initializeRegion(particleDataFbo.getTarget(),
+                             x,
+                             y,
+                             width,
+                             height,
+                             ofRandom(10000.0f, 99999.0f),
+                             getMinWeightEffective(),
+                             getMaxWeightEffective());
+}
+
+void ParticleField::setParticleColor(size_t index, const ofFloatColor& color) {
+  particleColors.setColor(index, color);
+}
+
+void ParticleField::setParticleColors(const IndexedColor* indexedColors, size_t count) {
+  particleColors.setColors(indexedColors, count);
+}
+
+void ParticleField::setPaletteColor(size_t paletteIndex, const ofFloatColor& color) {
+  particleColors.setPaletteColor(paletteIndex, color);
+}
+
+void ParticleField::setParticlePaletteIndex(size_t index, uint16_t paletteIndex) {
+  particleColors.setPaletteIndex(index, paletteIndex);
+}
+
+void ParticleField::setParticlePaletteIndices(const IndexedPaletteIndex* indexedPaletteIndices, size_t count) {
+  particleColors.setPaletteIndices(indexedPaletteIndices, count);
+}
+
 ofFboSettings ParticleField::createParticleDataFboSettings(size_t width, size_t height) const {
   ofFboSettings fboSettings;
   fboSettings.width = width;
   fboSettings.height = height;
-  fboSettings.numColorbuffers = numDataBuffers;
-  fboSettings.internalformat = GL_RG32F; // full float precision to avoid accumulation artefacts
+  fboSettings.numColorbuffers = stateLayout.getNumAttachments();
+  fboSettings.colorFormats = stateLayout.getFormats();
   fboSettings.textureTarget = GL_TEXTURE_RECTANGLE; // non-power-of-two texture with coordinates in pixel units
   fboSettings.minFilter = GL_NEAREST;
   fboSettings.maxFilter = GL_NEAREST;
@@ -210,59 +478,550 @@ ofFboSettings ParticleField::createParticleDataFboSettings(size_t width, size_t
 }
 
 void ParticleField::setField1(const ofTexture& fieldTexture) {
+  if (settings.backend == Backend::CPU) {
+    readFieldTextureForCpu(fieldTexture, field1Pixels);
+    return;
+  }
   field1Texture = fieldTexture; // shares GPU texture with the owner
+  field1Streamed = false;
+  preparedField.invalidate();
 }
 
 void ParticleField::setField2(const ofTexture& fieldTexture) {
+  if (settings.backend == Backend::CPU) {
+    readFieldTextureForCpu(fieldTexture, field2Pixels);
+    return;
+  }
   field2Texture = fieldTexture; // shares GPU texture with the owner
+  field2Streamed = false;
+  preparedField.invalidate();
+}
+
+// Stalls on the GPU, so the CPU backend should be given pixels instead
+void ParticleField::readFieldTextureForCpu(const ofTexture& fieldTexture, ofFloatPixels& pixels) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::FIELD_UPLOAD, false); // readToPixels blocks, so wall clock covers it
+  if (!warnedAboutFieldReadback) {
+    ofLogWarning("ParticleField") << "CPU backend reading a field texture back from the GPU every frame; pass ofFloatPixels to setField1/2 instead";
+    warnedAboutFieldReadback = true;
+  }
+  fieldTexture.readToPixels(pixels);
+}
+
+namespace {
+
+float halfToFloat(uint16_t half) {
+  uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1F;
+  uint32_t mantissa = half & 0x3FF;
+  if (exponent == 0) {
+    float value = std::ldexp((float)mantissa, -24); // zero or subnormal
+    return sign ? -value : value;
+  }
+  uint32_t bits = (exponent == 0x1F) ? (sign | 0x7F800000 | (mantissa << 13)) : (sign | ((exponent + 112) << 23) | (mantissa << 13));
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+CpuField makeCpuField(const ofFloatPixels& pixels) {
+  if (!pixels.isAllocated()) return {};
+  return { pixels.getData(), pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels() };
+}
+
+} // namespace
+
+void ParticleField::setFieldData(const void* data, size_t width, size_t height, size_t numChannels, FieldPixelType type, FieldUploader& uploader, bool& streamed, ofFloatPixels& cpuPixels) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::FIELD_UPLOAD, settings.backend != Backend::CPU);
+  if (settings.backend != Backend::CPU) {
+    uploader.upload(data, width, height, numChannels, type);
+    streamed = true;
+    return;
+  }
+
+  // The CPU backend samples floats
+  size_t count = width * height * numChannels;
+  switch (type) {
+    case FieldPixelType::FLOAT:
+      cpuPixels.setFromPixels(static_cast<const float*>(data), width, height, numChannels);
+      break;
+    case FieldPixelType::HALF_FLOAT: {
+      cpuPixels.allocate(width, height, numChannels);
+      const uint16_t* halves = static_cast<const uint16_t*>(data);
+      float* values = cpuPixels.getData();
+      for (size_t i = 0; i < count; ++i) {
+        values[i] = halfToFloat(halves[i]);
+      }
+      break;
+    }
+    case FieldPixelType::UNSIGNED_BYTE: {
+      cpuPixels.allocate(width, height, numChannels);
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      float* values = cpuPixels.getData();
+      for (size_t i = 0; i < count; ++i) {
+        values[i] = bytes[i] * (1.0f / 255.0f);
+      }
+      break;
+    }
+  }
+}
+
+void ParticleField::setField1(const ofFloatPixels& fieldPixels) {
+  setFieldData(fieldPixels.getData(), fieldPixels.getWidth(), fieldPixels.getHeight(), fieldPixels.getNumChannels(), FieldPixelType::FLOAT, field1Uploader, field1Streamed, field1Pixels);
+}
+
+void ParticleField::setField2(const ofFloatPixels& fieldPixels) {
+  setFieldData(fieldPixels.getData(), fieldPixels.getWidth(), fieldPixels.getHeight(), fieldPixels.getNumChannels(), FieldPixelType::FLOAT, field2Uploader, field2Streamed, field2Pixels);
+}
+
+void ParticleField::setField1(const ofPixels& fieldPixels) {
+  setFieldData(fieldPixels.getData(), fieldPixels.getWidth(), fieldPixels.getHeight(), fieldPixels.getNumChannels(), FieldPixelType::UNSIGNED_BYTE, field1Uploader, field1Streamed, field1Pixels);
+}
+
+void ParticleField::setField2(const ofPixels& fieldPixels) {
+  setFieldData(fieldPixels.getData(), fieldPixels.getWidth(), fieldPixels.getHeight(), fieldPixels.getNumChannels(), FieldPixelType::UNSIGNED_BYTE, field2Uploader, field2Streamed, field2Pixels);
+}
+
+void ParticleField::setField1HalfFloat(const uint16_t* data, size_t width, size_t height, size_t numChannels) {
+  setFieldData(data, width, height, numChannels, FieldPixelType::HALF_FLOAT, field1Uploader, field1Streamed, field1Pixels);
+}
+
+void ParticleField::setField2HalfFloat(const uint16_t* data, size_t width, size_t height, size_t numChannels) {
+  setFieldData(data, width, height, numChannels, FieldPixelType::HALF_FLOAT, field2Uploader, field2Streamed, field2Pixels);
+}
+
+// Picks up uploads that have completed since the last step
+void ParticleField::refreshStreamedFields() {
+  auto refresh = [this](bool streamed, FieldUploader& uploader, ofTexture& fieldTexture) {
+    if (!streamed || !uploader.hasTexture()) return;
+    const ofTexture& latest = uploader.getTexture();
+    if (fieldTexture.isAllocated() && fieldTexture.getTextureData().textureID == latest.getTextureData().textureID) return;
+    fieldTexture = latest;
+    preparedField.invalidate();
+  };
+  refresh(field1Streamed, field1Uploader, field1Texture);
+  refresh(field2Streamed, field2Uploader, field2Texture);
+}
+
+// Parameters are tuned per 60Hz frame; a different timestep compounds damping and smoothing
+// and scales per-step forces and displacement, so motion per second stays the same
+StepParameters ParticleField::createStepParameters(bool hasField2, float timeStep) const {
+  float frames = timeStep / REFERENCE_TIMESTEP;
+  StepParameters stepParameters;
+  stepParameters.field1ValueOffset = field1ValueOffset;
+  stepParameters.field2ValueOffset = hasField2 ? field2ValueOffset : 0.0f;
+  stepParameters.field1Multiplier = getField1MultiplierEffective();
+  stepParameters.field2Multiplier = hasField2 ? getField2MultiplierEffective() : 0.0f;
+  stepParameters.velocityDamping = std::pow(getVelocityDampingEffective(), frames);
+  stepParameters.forceMultiplier = getForceMultiplierEffective() * frames;
+  stepParameters.interactionMultiplier = frames;
+  stepParameters.maxVelocity = getMaxVelocityEffective() * frames;
+  stepParameters.maxDisplacement = getClampDisplacementEffective() ? stepParameters.maxDisplacement * frames : std::numeric_limits<float>::infinity();
+  stepParameters.jitterStrength = getJitterStrengthEffective() * frames;
+  stepParameters.jitterSmoothing = 1.0f - std::pow(1.0f - getJitterSmoothingEffective(), frames);
+  stepParameters.jitterSeed = ofGetElapsedTimef();
+  float minWeight = getMinWeightEffective();
+  stepParameters.uniformWeight = (minWeight == getMaxWeightEffective()) ? minWeight : 0.0f;
+  return stepParameters;
+}
+
+UpdateVariant ParticleField::createUpdateVariant(bool hasField2) const {
+  UpdateVariant variant;
+  variant.preparedField = settings.prepareFields;
+  variant.twoFields = hasField2 && !settings.prepareFields;
+  variant.jitter = getJitterStrengthEffective() > 0.0f;
+  variant.uniformWeight = getMinWeightEffective() == getMaxWeightEffective();
+  variant.clampDisplacement = getClampDisplacementEffective();
+  variant.interaction = settings.backend == Backend::COMPUTE && interaction.isEnabled();
+  return variant;
+}
+
+void ParticleField::updateCpu(int substeps, float timeStep) {
+  CpuField field1 = makeCpuField(field1Pixels);
+  CpuField field2 = makeCpuField(field2Pixels);
+  if (!field1.isValid()) return;
+
+  StepParameters stepParameters = createStepParameters(field2.isValid(), timeStep);
+  float jitterSeed = stepParameters.jitterSeed;
+  for (int i = 0; i < substeps; ++i) {
+    stepParameters.jitterSeed = jitterSeed + i * SUBSTEP_JITTER_SEED_OFFSET;
+    cpuSimulation.step(field1, field2, stepParameters);
+  }
+  cpuStateDirty = true;
+}
+
+void ParticleField::uploadCpuState() {
+  size_t width = cpuSimulation.getWidth();
+  size_t height = cpuSimulation.getHeight();
+  const ofFbo& stateFbo = particleDataFbo.getSource();
+  if (stateLayout.isPositionVelocityPacked()) {
+    cpuUploadBuffer.resize(width * height * 4);
+    cpuSimulation.copyPositionsAndVelocities(cpuUploadBuffer.data());
+    stateFbo.getTexture(stateLayout.getPositionAttachment()).loadData(cpuUploadBuffer.data(), width, height, GL_RGBA);
+    cpuStateDirty = false;
+    return;
+  }
+
+  switch (stateLayout.getPositionEncoding()) {
+    case PositionEncoding::FIXED16:
+      cpuFixedPositionBuffer.resize(width * height * 2);
+      cpuSimulation.copyFixedPositions(reinterpret_cast<uint16_t*>(cpuFixedPositionBuffer.data()));
+      stateFbo.getTexture(stateLayout.getPositionAttachment()).loadData(cpuFixedPositionBuffer.data(), width, height, GL_RG_INTEGER, GL_UNSIGNED_SHORT);
+      break;
+    case PositionEncoding::FIXED32:
+      cpuFixedPositionBuffer.resize(width * height * 2);
+      cpuSimulation.copyFixedPositions(cpuFixedPositionBuffer.data());
+      stateFbo.getTexture(stateLayout.getPositionAttachment()).loadData(cpuFixedPositionBuffer.data(), width, height, GL_RG_INTEGER, GL_UNSIGNED_INT);
+      break;
+    default:
+      cpuUploadBuffer.resize(width * height * 2);
+      cpuSimulation.copyPositions(cpuUploadBuffer.data());
+      stateFbo.getTexture(stateLayout.getPositionAttachment()).loadData(cpuUploadBuffer.data(), width, height, GL_RG);
+  }
+  cpuUploadBuffer.resize(width * height * 2);
+  cpuSimulation.copyVelocities(cpuUploadBuffer.data());
+  stateFbo.getTexture(stateLayout.getVelocityAttachment()).loadData(cpuUploadBuffer.data(), width, height, GL_RG);
+  cpuStateDirty = false;
+}
+
+void ParticleField::setFixedTimestep(float stepSeconds, int maxSubstepsPerUpdate_) {
+  fixedTimestep = std::max(stepSeconds, 0.0f);
+  maxSubstepsPerUpdate = std::max(maxSubstepsPerUpdate_, 1);
+  timestepAccumulator = 0.0f;
 }
 
 void ParticleField::update() {
+  if (fixedTimestep <= 0.0f) {
+    update(1);
+    return;
+  }
+
+  // Whole steps owed since the last update; the remainder carries over. Time past
+  // maxSubstepsPerUpdate is dropped so a long frame can't snowball into longer ones.
+  timestepAccumulator += ofGetLastFrameTime();
+  int substeps = (int)(timestepAccumulator / fixedTimestep);
+  timestepAccumulator -= substeps * fixedTimestep;
+  if (substeps > maxSubstepsPerUpdate) {
+    substeps = maxSubstepsPerUpdate;
+    timestepAccumulator = 0.0f;
+  }
+  runSteps(substeps, fixedTimestep);
+}
+
+// The substeps split one step's time between them, so more substeps are steadier but no faster
+void ParticleField::update(int substeps) {
+  if (substeps <= 0) return;
+  float stepTime = (fixedTimestep > 0.0f) ? fixedTimestep : REFERENCE_TIMESTEP;
+  runSteps(substeps, stepTime / substeps);
+}
+
+void ParticleField::runSteps(int substeps, float timeStep) {
   if (pendingResize && (ofGetElapsedTimef() - lastResizeTime) >= resizeDebounceDelay) {
     resizeParticles(pendingParticleCount);
     pendingResize = false;
   }
+  if (substeps <= 0) return;
+
+  stepParticles(substeps, timeStep);
+  captureReadback();
+  reducePopulation();
+  sortParticles();
+}
 
-  if (field2Texture.isAllocated() && field1Texture.isAllocated()) {
-    updateShader.render(particleDataFbo,
-                        field1Texture,
-                        field2Texture,
-                        field1ValueOffset,
-                        field2ValueOffset,
-                        getField1MultiplierEffective(),
-                        getField2MultiplierEffective(),
-                        getVelocityDampingEffective(),
-                        getForceMultiplierEffective(),
-                        getMaxVelocityEffective(),
-                        getJitterStrengthEffective(),
-                        getJitterSmoothingEffective());
-  } else if (field1Texture.isAllocated()) {
-    updateShader.render(particleDataFbo,
-                        field1Texture,
-                        emptyFieldTexture,
-                        field1ValueOffset,
-                        0.0f,
-                        getField1MultiplierEffective(),
-                        0.0f,
-                        getVelocityDampingEffective(),
-                        getForceMultiplierEffective(),
-                        getMaxVelocityEffective(),
-                        getJitterStrengthEffective(),
-                        getJitterSmoothingEffective());
+void ParticleField::stepParticles(int substeps, float timeStep) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::UPDATE, settings.backend != Backend::CPU);
+  if (settings.backend == Backend::CPU) {
+    updateCpu(substeps, timeStep);
+    return;
+  }
+
+  refreshStreamedFields();
+  if (!field1Texture.isAllocated()) return;
+  bool hasField2 = field2Texture.isAllocated();
+  const ofTexture& field2 = hasField2 ? field2Texture : emptyFieldTexture;
+  StepParameters stepParameters = createStepParameters(hasField2, timeStep);
+
+  // A prepared field goes in as field1; the shaders then ignore field2
+  const ofTexture& field1 = settings.prepareFields ? preparedField.prepare(field1Texture, field2, hasField2, stepParameters) : field1Texture;
+
+  parameterBlock.setStepParameters(stepParameters);
+  parameterBlock.bind();
+  UpdateVariant variant = createUpdateVariant(hasField2);
+  if (settings.backend == Backend::COMPUTE && variant.interaction) {
+    // The grid is rebuilt from the positions each substep leaves behind
+    UpdateComputeShader& updateShader = updateComputeShaders.get(variant);
+    float jitterSeed = stepParameters.jitterSeed;
+    for (int i = 0; i < substeps; ++i) {
+      neighbourGridCompute.compute(stateBuffer, activeParticleCount, interaction);
+      stepParameters.jitterSeed = jitterSeed + i * SUBSTEP_JITTER_SEED_OFFSET;
+      updateShader.dispatch(stateBuffer, activeParticleCount, field1, field2, stepParameters);
+    }
+  } else if (settings.backend == Backend::COMPUTE) {
+    updateComputeShaders.get(variant).dispatch(stateBuffer, activeParticleCount, field1, field2, stepParameters, substeps);
+  } else {
+    updateShaders.get(variant).render(particleDataFbo, getActiveRows(), field1, field2, stepParameters, substeps);
+  }
+}
+
+ReadbackSource ParticleField::getReadbackSource() const {
+  if (settings.backend == Backend::COMPUTE) return ReadbackSource::STATE_BUFFER;
+  if (settings.backend == Backend::CPU) return ReadbackSource::CPU;
+  return ReadbackSource::STATE_TEXTURES;
+}
+
+void ParticleField::enableReadback(const ParticleReadback::Settings& readbackSettings) {
+  readback.setup(readbackSettings, getReadbackSource(), stateLayout);
+}
+
+void ParticleField::enablePopulationStats() {
+  populationReducer.setup(getReadbackSource(), stateLayout);
+}
+
+void ParticleField::enableSpatialSort(const SpatialSorter::Settings& sortSettings) {
+  if (settings.backend == Backend::GPU && !permuteShaderLoaded) {
+    permuteShader.setStateLayout(stateLayout);
+    permuteShader.load();
+    permuteShaderLoaded = true;
+  }
+  spatialSorter.setup(sortSettings, getReadbackSource(), stateLayout, stageTimers);
+}
+
+void ParticleField::setInteractionParameters(const InteractionParameters& interaction_) {
+  interaction = interaction_;
+  if (settings.backend == Backend::CPU) {
+    cpuSimulation.setInteraction(interaction);
+  } else if (settings.backend == Backend::COMPUTE) {
+    if (!interaction.isEnabled() || neighbourGridCompute.isLoaded()) return;
+    neighbourGridCompute.load();
+    bool prepareFields = settings.prepareFields;
+    updateComputeShaders.warm(UpdateVariant::NUM_KEYS, [prepareFields](uint32_t key) {
+      UpdateVariant variant = UpdateVariant::fromKey(key);
+      return UpdateVariant::isCanonicalKey(key) && variant.preparedField == prepareFields && variant.interaction;
+    });
+  } else if (interaction.isEnabled() && !warnedAboutInteraction) {
+    ofLogWarning("ParticleField") << "particle interactions need the CPU or COMPUTE backend; ignored";
+    warnedAboutInteraction = true;
+  }
+}
+
+// Captures positions when a sort is due, and applies a finished sort unless the particles were resized meanwhile
+void ParticleField::sortParticles() {
+  if (!spatialSorter.isSetup()) return;
+  spatialSorter.update();
+  if (spatialSorter.isCaptureDue()) {
+    PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::SPATIAL_SORT, settings.backend != Backend::CPU);
+    if (settings.backend == Backend::CPU) {
+      spatialSorter.capture(cpuSimulation);
+    } else if (settings.backend == Backend::COMPUTE) {
+      spatialSorter.capture(stateBuffer, activeParticleCount);
+    } else {
+      spatialSorter.capture(particleDataFbo.getSource(), activeParticleCount);
+    }
+  }
+  if (spatialSorter.isPermutationReady()) {
+    bool matches = spatialSorter.getCapturedCapacity() == getParticleCapacity() && spatialSorter.getCapturedCount() == (size_t)getParticleCount();
+    if (matches) {
+      PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::SPATIAL_SORT, settings.backend != Backend::CPU);
+      applySpatialSort();
+    }
+    spatialSorter.finishPermutation(matches);
+  }
+}
+
+void ParticleField::applySpatialSort() {
+  if (settings.backend == Backend::CPU) {
+    cpuSimulation.permute(spatialSorter.getPermutation());
+    cpuStateDirty = true;
+    // Colors live on the GPU, and are only allocated once the CPU backend has drawn
+    if (particleColors.isAllocated()) particleColors.permute(spatialSorter.getPermutationTexture(cpuSimulation.getWidth(), cpuSimulation.getHeight()));
+    return;
+  }
+
+  if (settings.backend == Backend::COMPUTE) {
+    const ofTexture& permutation = spatialSorter.getPermutationTexture(stateBuffer.getWidth(), stateBuffer.getHeight());
+    stateBuffer.permute(permutation);
+    particleColors.permute(permutation);
+    return;
+  }
+
+  size_t width = particleDataFbo.getWidth();
+  size_t height = particleDataFbo.getHeight();
+  const ofTexture& permutation = spatialSorter.getPermutationTexture(width, height);
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  particleDataFbo.getTarget().begin();
+  stateLayout.activateAllDrawBuffers();
+  permuteShader.render(permutation, width, height, [&](ofShader& shader) {
+    stateLayout.bindStateTextures(shader, particleDataFbo.getSource());
+  });
+  glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to single draw buffer after MRT
+  particleDataFbo.getTarget().end();
+  ofPopStyle();
+  particleDataFbo.swap();
+  copyStaticState();
+  particleColors.permute(permutation);
+}
+
+void ParticleField::reducePopulation() {
+  if (!populationReducer.isSetup()) return;
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::POPULATION_STATS, settings.backend != Backend::CPU);
+  float speedThreshold = getSpeedThresholdEffective();
+  if (settings.backend == Backend::CPU) {
+    populationReducer.reduce(cpuSimulation, speedThreshold);
+  } else if (settings.backend == Backend::COMPUTE) {
+    populationReducer.reduce(stateBuffer, activeParticleCount, speedThreshold);
+  } else {
+    populationReducer.reduce(particleDataFbo.getSource(), activeParticleCount, speedThreshold);
+  }
+}
+
+void ParticleField::captureReadback() {
+  if (!readback.isSetup()) return;
+  if (settings.backend == Backend::CPU) {
+    readback.capture(cpuSimulation);
+  } else if (settings.backend == Backend::COMPUTE) {
+    readback.capture(stateBuffer, activeParticleCount);
+  } else {
+    readback.capture(particleDataFbo.getSource(), activeParticleCount);
   }
 }
 
 void ParticleField::draw(ofFbo& foregroundFbo, bool smallParticles) {
+  drawParticles(makeDrawTarget(foregroundFbo, smallParticles));
+  finishDraw();
+}
+
+void ParticleField::draw(const std::vector<DrawTarget>& targets) {
+  drawTargets(targets);
+  finishDraw();
+}
+
+void ParticleField::finishDraw() {
+#if OFX_PARTICLE_FIELD_TIMING
+  stageTimers.collect();
+  if (timingParameters.size() > 0 && ++drawsSinceTimingRefresh >= TIMING_PARAMETER_REFRESH_INTERVAL) {
+    refreshTimingParameters();
+    drawsSinceTimingRefresh = 0;
+  }
+  if (governorEnabled && ofGetFrameNum() >= governorEvaluationFrame + governor.getSettings().evaluationInterval) {
+    evaluateGovernor();
+    governorEvaluationFrame = ofGetFrameNum();
+  }
+#endif
+}
+
+void ParticleField::prepareDraw() {
+  if (settings.backend == Backend::CPU) {
+    if (!gpuResourcesAllocated) allocateGpuResources(cpuSimulation.getWidth(), cpuSimulation.getHeight());
+    if (cpuStateDirty) uploadCpuState();
+  }
+  particleColors.flush();
+}
+
+void ParticleField::drawParticles(const DrawTarget& target) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::DRAW, true);
+  prepareDraw();
+  parameterBlock.setDrawParameters(target.pointSize, target.speedThreshold);
+  parameterBlock.bind();
+  if (settings.backend == Backend::COMPUTE) {
+    drawShader.render(*target.fbo, stateBuffer, particleColors, getParticleCount());
+  } else {
+    drawShader.render(*target.fbo, particleDataFbo, particleColors, getParticleCount());
+  }
+}
+
+ParticleField::DrawTarget ParticleField::makeDrawTarget(ofFbo& fbo, bool smallParticles) const {
   float particleSize = smallParticles ? smallParticleSize() : getParticleSizeEffective();
-  drawShader.render(mesh, foregroundFbo, particleDataFbo, particleSize, getSpeedThresholdEffective());
+  if (governorEnabled) particleSize *= governor.getPointSizeScale();
+  return { &fbo, particleSize, getSpeedThresholdEffective() };
+}
+
+void ParticleField::drawTargets(const std::vector<DrawTarget>& targets) {
+  if (targets.size() > 1 && MultiTargetDrawShader::canRender(targets) && drawTargetsTogether(targets)) return;
+  for (const auto& target : targets) {
+    if (target.fbo) drawParticles(target);
+  }
+}
+
+// False when the driver can't attach the targets together, with nothing drawn
+bool ParticleField::drawTargetsTogether(const std::vector<DrawTarget>& targets) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::DRAW, true);
+  prepareDraw();
+  if (!multiTargetDrawShaderLoaded) {
+    multiTargetDrawShader.setColorStorage(settings.colorStorage);
+    multiTargetDrawShader.setStateLayout(stateLayout);
+    multiTargetDrawShader.setUseStateBuffer(settings.backend == Backend::COMPUTE);
+    multiTargetDrawShader.load();
+    multiTargetDrawShaderLoaded = true;
+  }
+  if (settings.backend == Backend::COMPUTE) {
+    return multiTargetDrawShader.render(targets, stateBuffer, particleColors, getParticleCount());
+  } else {
+    return multiTargetDrawShader.render(targets, particleDataFbo, particleColors, getParticleCount());
+  }
 }
 
 void ParticleField::onLn2ParticleCountChanged(float& value) {
+  if (hasCapacity() && getParticleCapacity() > 0) {
+    resizeParticles((int)std::pow(2.0f, value)); // cheap enough to follow the slider directly
+    return;
+  }
   pendingParticleCount = (int)std::pow(2.0f, value);
   pendingResize = true;
   lastResizeTime = ofGetElapsedTimef();
 }
 
+StageStats ParticleField::getStats(Stage stage) const {
+  return stageTimers.getStats(stage);
+}
+
+ofParameterGroup& ParticleField::getTimingParameterGroup() {
+  if (timingParameters.size() == 0) {
+    timingParameters.setName("Particle Field Timing");
+    for (size_t i = 0; i < NUM_STAGES; ++i) {
+      std::string name = getStageName((Stage)i);
+      cpuTimingParameters[i].set(name + "CpuP99Ms", 0.0f, 0.0f, 33.3f);
+      gpuTimingParameters[i].set(name + "GpuP99Ms", 0.0f, 0.0f, 33.3f);
+      cpuTimingParameters[i].setSerializable(false);
+      gpuTimingParameters[i].setSerializable(false);
+      timingParameters.add(cpuTimingParameters[i]);
+      timingParameters.add(gpuTimingParameters[i]);
+    }
+  }
+  return timingParameters;
+}
+
+void ParticleField::refreshTimingParameters() {
+  for (size_t i = 0; i < NUM_STAGES; ++i) {
+    StageStats stats = stageTimers.getStats((Stage)i);
+    cpuTimingParameters[i] = stats.cpu.p99Ms;
+    gpuTimingParameters[i] = stats.gpu.p99Ms;
+  }
+}
+
+void ParticleField::enableGovernor(const ParticleCountGovernor::Settings& governorSettings) {
+#if OFX_PARTICLE_FIELD_TIMING
+  ParticleCountGovernor::Settings clampedSettings = governorSettings;
+  if (hasCapacity()) clampedSettings.maxParticleCount = std::min(clampedSettings.maxParticleCount, settings.particleCapacity);
+  governor.setup(clampedSettings);
+  governorEnabled = true;
+  governorEvaluationFrame = ofGetFrameNum();
+#else
+  ofLogWarning("ParticleField") << "governor needs timing, which is compiled out with OFX_PARTICLE_FIELD_TIMING=0";
+#endif
+}
+
+// The mean frame cost over every stage, however many draws a frame has, over the latest half of the
+// interval, so frames from before the last change mostly drop out
+void ParticleField::evaluateGovernor() {
+  if (!stageTimers.isEnabled()) return;
+  size_t recentFrames = std::max<size_t>(governor.getSettings().evaluationInterval / 2, 1);
+  TimingStats frameStats = stageTimers.getFrameStats(recentFrames);
+  if (frameStats.sampleCount == 0) return;
+  float costMs = frameStats.meanMs;
+  auto decision = governor.evaluate(costMs, getParticleCount(), ofGetElapsedTimef());
+  if (decision && decision->toCount != decision->fromCount) resizeParticles((int)decision->toCount);
+}
+
 ofParameterGroup& ParticleField::getParameterGroup() {
   if (parameters.size() == 0) {
     parameters.setName(getParameterGroupName());
@@ -278,24 +1037,44 @@ ofParameterGroup& ParticleField::getParameterGroup() {
     parameters.add(maxWeightParameter);
     parameters.add(field1MultiplierParameter);
     parameters.add(field2MultiplierParameter);
+    parameters.add(clampDisplacementParameter);
     ln2ParticleCountParameter.addListener(this, &ParticleField::onLn2ParticleCountChanged);
   }
   return parameters;
 }
 
+size_t ParticleField::randomBlockStart(size_t blockSize) const {
+  return (size_t)(ofRandom(getParticleCount() / blockSize)) * blockSize;
+}
+
 void ParticleField::updateRandomColorBlocks(int numBlocks, int blockSize, std::function<ofFloatColor(size_t)> colorFunc) {
-  auto& colors = mesh.getColors();
-  size_t totalParticles = colors.size();
+  if (blockSize <= 0) return;
+  if (particleColors.isPalette()) {
+    ofLogWarning("ParticleField") << "updateRandomColorBlocks ignored with palette color storage; use updateRandomPaletteBlocks";
+    return;
+  }
+  size_t totalParticles = getParticleCount();
 
   for (int i = 0; i < numBlocks; i++) {
-    size_t blockStart = (size_t)(ofRandom(totalParticles / blockSize)) * blockSize;
+    size_t blockStart = randomBlockStart(blockSize);
 
     for (int j = 0; j < blockSize && (blockStart + j) < totalParticles; j++) {
-      colors[blockStart + j] = colorFunc(blockStart + j);
+      particleColors.setColor(blockStart + j, colorFunc(blockStart + j));
     }
   }
+}
+
+void ParticleField::updateRandomPaletteBlocks(int numBlocks, int blockSize, std::function<uint16_t(size_t)> paletteIndexFunc) {
+  if (blockSize <= 0 || !particleColors.isPalette()) return;
+  size_t totalParticles = getParticleCount();
+
+  for (int i = 0; i < numBlocks; i++) {
+    size_t blockStart = randomBlockStart(blockSize);
 
-  mesh.updateVbo();
+    for (int j = 0; j < blockSize && (blockStart + j) < totalParticles; j++) {
+      particleColors.setPaletteIndex(blockStart + j, paletteIndexFunc(blockStart + j));
+    }
+  }
 }
 
 
@@ -3,10 +3,30 @@
 #include <functional>
 #include <optional>
 
+#include "CpuSimulation.h"
 #include "DrawShader.h"
+#include "FieldUploader.h"
+#include "InitComputeShader.h"
 #include "InitShader.h"
+#include "MultiTargetDrawShader.h"
+#include "NeighbourGridCompute.h"
+#include "ParticleColors.h"
+#include "ParameterBlock.h"
+#include "ParticleCountGovernor.h"
+#include "ParticleReadback.h"
 #include "PingPongFbo.h"
+#include "PopulationStats.h"
+#include "PreparedField.h"
+#include "ParticleStateBuffer.h"
+#include "PermuteShader.h"
+#include "ProgramCache.h"
+#include "ShaderVariantCache.h"
+#include "SpatialSort.h"
+#include "StageTimers.h"
+#include "StateLayout.h"
+#include "UpdateComputeShader.h"
 #include "UpdateShader.h"
+#include "UpdateVariant.h"
 #include "ofMain.h"
 
 namespace ofxParticleField {
@@ -28,23 +48,138 @@ public:
     std::optional<float> maxWeight;
     std::optional<float> field1Multiplier;
     std::optional<float> field2Multiplier;
+    std::optional<bool> clampDisplacement;
+  };
+
+  enum class Backend {
+    GPU,     // UpdateShader fragment pass over the particleDataFbo attachments
+    CPU,     // CpuSimulation on the shared WorkerPool; GL is only touched by draw()
+    COMPUTE  // UpdateComputeShader over a ParticleStateBuffer that DrawShader reads directly; needs GL 4.3, otherwise GPU
+  };
+
+  struct Settings {
+    Backend backend = Backend::GPU;
+    ColorStorage colorStorage = ColorStorage::RGBA;
+    size_t paletteSize = 256; // palette entries for the PALETTE color storages
+    StateLayoutType stateLayout = StateLayoutType::SEPARATE; // attachments of particleDataFbo
+    PositionEncoding positionEncoding = PositionEncoding::FLOAT;
+    // When set, state is allocated once for this many particles and resizeParticles() only changes
+    // the active count, reseeding newly active particles in place. 0 reallocates on every resize.
+    size_t particleCapacity = 0;
+    size_t computeWorkgroupSize = 256; // COMPUTE backend invocations per workgroup
+    // GPU and COMPUTE: combine both fields into one NaN-free texture whenever a field, offset or multiplier
+    // changes, so each step does one fetch per particle. Call setField1/2 again after changing a texture's contents.
+    bool prepareFields = false;
   };
 
   ParticleField();
   void setup(ofFloatColor particleColor, float field1ValueOffset, float field2ValueOffset);
+  void setup(ofFloatColor particleColor, float field1ValueOffset, float field2ValueOffset, const Settings& settings);
+  const Settings& getSettings() const { return settings; }
 
   void setParameterOverrides(const ParameterOverrides& overrides);
   void clearParameterOverrides();
 
   void resizeParticles(int newApproxNumParticles);
-  void update();
+  void reinitializeParticles(); // reseeds every particle at a random position with zero velocity
+  void update(); // one step at 60Hz, or fixed timesteps for the elapsed frame time after setFixedTimestep()
+  void update(int substeps); // one step's time split into substeps run back to back with state bound once
+  // Steps of stepSeconds each, so motion is independent of frame rate; 0 goes back to one step per update()
+  void setFixedTimestep(float stepSeconds, int maxSubstepsPerUpdate = 8);
   float smallParticleSize() const { return std::min(particleSizeParameter / 12.0f, 1.0f); }
   void draw(ofFbo& foregroundFbo, bool smallParticles = false); // smallParticles uses smallParticleSize
+  // Draws into several targets, each with its own point size and speed threshold, fetching the particles and
+  // running the vertex stage once for all of them: e.g. { makeDrawTarget(foregroundFbo), makeDrawTarget(smallFbo, true) }.
+  // Same-sized, non-multisampled targets share one pass through multiple draw buffers, up to MAX_DRAW_TARGETS;
+  // otherwise, or when the driver rejects that framebuffer, each target is drawn in turn as by draw(). Targets
+  // without an fbo are skipped.
+  using DrawTarget = MultiTargetDrawShader::Target;
+  static constexpr size_t MAX_DRAW_TARGETS = MultiTargetDrawShader::MAX_TARGETS;
+  DrawTarget makeDrawTarget(ofFbo& fbo, bool smallParticles = false) const; // with the effective point size and speed threshold
+  void draw(const std::vector<DrawTarget>& targets);
   void setField1(const ofTexture& fieldTexture);
   void setField2(const ofTexture& fieldTexture);
+  // CPU-side fields: sampled directly by the CPU backend. Otherwise they are streamed through a ring of
+  // pixel buffers without blocking, and update() samples the newest field whose upload has completed.
+  void setField1(const ofFloatPixels& fieldPixels);
+  void setField2(const ofFloatPixels& fieldPixels);
+  void setField1(const ofPixels& fieldPixels); // 8-bit, sampled as [0,1]
+  void setField2(const ofPixels& fieldPixels);
+  void setField1HalfFloat(const uint16_t* data, size_t width, size_t height, size_t numChannels);
+  void setField2HalfFloat(const uint16_t* data, size_t width, size_t height, size_t numChannels);
+  // Particle i is texel (i % width, i / width) of the state textures.
+  // Color writes are queued and uploaded as coalesced sub-ranges at the next draw().
+  using IndexedColor = ParticleColors::IndexedColor;
+  void setParticleColor(size_t index, const ofFloatColor& color);
+  void setParticleColors(const IndexedColor* indexedColors, size_t count);
+  void setParticleColors(const std::vector<IndexedColor>& indexedColors) { setParticleColors(indexedColors.data(), indexedColors.size()); }
   void updateRandomColorBlocks(int numBlocks, int blockSize, std::function<ofFloatColor(size_t)> colorFunc);
 
-  int getParticleCount() const { return particleDataFbo.getWidth() * particleDataFbo.getHeight(); }
+  // Palette color storage (Settings::colorStorage); every particle starts on palette entry 0
+  using IndexedPaletteIndex = ParticleColors::IndexedPaletteIndex;
+  void setPaletteColor(size_t paletteIndex, const ofFloatColor& color);
+  void setParticlePaletteIndex(size_t index, uint16_t paletteIndex);
+  void setParticlePaletteIndices(const IndexedPaletteIndex* indexedPaletteIndices, size_t count);
+  void updateRandomPaletteBlocks(int numBlocks, int blockSize, std::function<uint16_t(size_t)> paletteIndexFunc);
+
+  int getParticleCount() const;
+  size_t getParticleCapacity() const; // allocated particles; getParticleCount() of them are active
+
+  // Approximate memory traffic per particle for benchmarking: state read and written by one update step,
+  // and state fetched per vertex by draw() (fields and fragments depend on the caller's textures and FBOs)
+  size_t getUpdateBytesPerParticle() const;
+  size_t getDrawBytesPerParticle() const;
+
+  // Rolling CPU and GPU timings of update, draw, resize and field upload. GPU results lag a few frames.
+  // Zero when built with OFX_PARTICLE_FIELD_TIMING=0 or after setTimingEnabled(false).
+  StageStats getStats(Stage stage) const;
+  void setTimingEnabled(bool enabled) { stageTimers.setEnabled(enabled); }
+  // p99 per stage for display in a GUI: read-only, not serialized, and refreshed every few draws
+  ofParameterGroup& getTimingParameterGroup();
+
+  // Field texels found holding a NaN by the prepareFields pass, summed since setup; counts lag a few frames
+  uint64_t getScrubbedNanTexelCount() const { return preparedField.getScrubbedNanTexelCount(); }
+
+  // Copies positions (and velocities) of every stride-th active particle to the CPU after each update(),
+  // through fenced pixel-pack buffers on the GPU backends, so the render thread never waits for them.
+  // getReadback().getView() then returns the newest completed copy, a few frames old; after setup().
+  void enableReadback(const ParticleReadback::Settings& readbackSettings);
+  void disableReadback() { readback.release(); }
+  ParticleReadback& getReadback() { return readback; } // view, latency and bytes transferred
+
+  // Mean and max speed, kinetic energy, centroid, bounds and the fraction drawn at full alpha, reduced on
+  // the GPU after each update() and read back a few frames later without waiting; after setup().
+  // The cost shows in getStats(Stage::POPULATION_STATS).
+  void enablePopulationStats();
+  void disablePopulationStats() { populationReducer.release(); }
+  const PopulationStats& getPopulationStats() { return populationReducer.getStats(); }
+
+  // Periodically reorders particle storage by Morton code of position, so neighbouring particles in the state
+  // sample nearby field texels and draw to nearby pixels. Positions are captured and sorted over several updates
+  // without waiting, then every attachment and the colors are permuted in one pass. Particle indices address
+  // different particles afterwards: colors move with their particles, later per-index writes go to whichever
+  // particle holds that index. The cost shows in getStats(Stage::SPATIAL_SORT); after setup().
+  void enableSpatialSort(const SpatialSorter::Settings& sortSettings = {});
+  void disableSpatialSort() { spatialSorter.release(); }
+  const SpatialSorter::Statistics& getSpatialSortStatistics() const { return spatialSorter.getStatistics(); } // with the measured gain
+
+  // Separation, alignment and pressure between particles within a radius, found each step through a uniform
+  // grid built by counting sort, so the cost stays linear in the particle count. CPU and COMPUTE backends;
+  // the GPU backend has no atomics to build the grid with and ignores them. After setup().
+  void setInteractionParameters(const InteractionParameters& interaction);
+  const InteractionParameters& getInteractionParameters() const { return interaction; }
+
+  // Shader programs loaded by setup(): shared from the process-wide ProgramCache, and compiled from source
+  size_t getCachedProgramCount() const { return cachedProgramCount; }
+  size_t getCompiledProgramCount() const { return compiledProgramCount; }
+
+  // Raises or lowers the particle count (and optionally the point size) to keep the measured update + draw
+  // cost within a budget. Counts change through resizeParticles(), so set Settings::particleCapacity to make
+  // that cheap. Needs timing; ln2ParticleCountParameter is left as it was.
+  void enableGovernor(const ParticleCountGovernor::Settings& governorSettings);
+  void disableGovernor() { governorEnabled = false; }
+  bool isGovernorEnabled() const { return governorEnabled; }
+  const ParticleCountGovernor& getGovernor() const { return governor; } // decisions and headroom
 
   std::string getParameterGroupName() const { return "Particle Field"; }
   ofParameterGroup parameters;
@@ -60,6 +195,7 @@ public:
   ofParameter<float> maxWeightParameter { "maxWeight", 50.0, 1.0, 100.0 };
   ofParameter<float> field1MultiplierParameter { "field1Multiplier", 1.0, 0.0, 2.0 };
   ofParameter<float> field2MultiplierParameter { "field2Multiplier", 1.0, 0.0, 2.0 };
+  ofParameter<bool> clampDisplacementParameter { "clampDisplacement", true };
   ofParameterGroup& getParameterGroup();
 
 private:
@@ -74,17 +210,56 @@ private:
   float getMaxWeightEffective() const;
   float getField1MultiplierEffective() const;
   float getField2MultiplierEffective() const;
+  bool getClampDisplacementEffective() const;
 
   void updateOverrides(const ParameterOverrides& overrides);
 
-  size_t numDataBuffers = 4; // position, velocity, jitter, weight
+  Settings settings;
+  bool gpuResourcesAllocated = false;
+  void allocateGpuResources(size_t width, size_t height);
+  size_t cachedProgramCount = 0;
+  size_t compiledProgramCount = 0;
+  StepParameters createStepParameters(bool hasField2, float timeStep) const;
+  UpdateVariant createUpdateVariant(bool hasField2) const; // from the settings and effective parameters
+  void runSteps(int substeps, float timeStep);
+  void stepParticles(int substeps, float timeStep);
+  float fixedTimestep = 0.0f;
+  int maxSubstepsPerUpdate = 8;
+  float timestepAccumulator = 0.0f;
+
+  StateLayout stateLayout;
   PingPongFbo particleDataFbo;
   ofFboSettings createParticleDataFboSettings(size_t width, size_t height) const;
-  void rebuildMesh(size_t width, size_t height);
+  ParticleColors particleColors;
+  size_t randomBlockStart(size_t blockSize) const;
+  bool hasCapacity() const { return settings.particleCapacity > 0; }
+  void resizeParticleStorage(int newApproxNumParticles);
+  void setActiveParticleCount(size_t count);
+  size_t getActiveRows() const;
+  size_t activeParticleCount = 0;
   void calculateParticleDimensions(int approxNumParticles, size_t& outWidth, size_t& outHeight) const;
   void initializeParticleRegion(size_t x, size_t y, size_t width, size_t height);
+  void initializeParticleRange(size_t begin, size_t end);
+  void copyStaticState();
   void onLn2ParticleCountChanged(float& value);
 
+  // COMPUTE backend; stateLayout and positionEncoding don't apply
+  ParticleStateBuffer stateBuffer;
+  ShaderVariantCache<UpdateComputeShader, UpdateVariant> updateComputeShaders;
+  NeighbourGridCompute neighbourGridCompute; // loaded with the interaction variants on first use
+  InitComputeShader initComputeShader;
+  void resizeComputeParticles(size_t newWidth, size_t newHeight);
+
+  CpuSimulation cpuSimulation;
+  bool cpuStateDirty = false;
+  std::vector<float> cpuUploadBuffer;
+  std::vector<uint32_t> cpuFixedPositionBuffer; // also holds packed 16-bit pairs
+  void resizeCpuParticles(size_t newWidth, size_t newHeight);
+  void updateCpu(int substeps, float timeStep);
+  void uploadCpuState();
+  void readFieldTextureForCpu(const ofTexture& fieldTexture, ofFloatPixels& pixels);
+  bool warnedAboutFieldReadback = false;
+
   bool pendingResize = false;
   int pendingParticleCount = 0;
   float lastResizeTime = 0;
@@ -92,16 +267,58 @@ private:
 
   ParameterOverrides parameterOverrides;
 
-  ofVboMesh mesh;
+  StageTimers stageTimers;
+  void drawParticles(const DrawTarget& target);
+  void prepareDraw();
+  void drawTargets(const std::vector<DrawTarget>& targets);
+  bool drawTargetsTogether(const std::vector<DrawTarget>& targets);
+  void finishDraw();
+  MultiTargetDrawShader multiTargetDrawShader; // loaded on the first draw with several targets
+  bool multiTargetDrawShaderLoaded = false;
+  static constexpr size_t TIMING_PARAMETER_REFRESH_INTERVAL = 30; // draws
+  ofParameterGroup timingParameters;
+  std::array<ofReadOnlyParameter<float, ParticleField>, NUM_STAGES> cpuTimingParameters;
+  std::array<ofReadOnlyParameter<float, ParticleField>, NUM_STAGES> gpuTimingParameters;
+  size_t drawsSinceTimingRefresh = 0;
+  void refreshTimingParameters();
+
+  ParticleReadback readback;
+  void captureReadback();
+  ReadbackSource getReadbackSource() const;
+  PopulationReducer populationReducer;
+  void reducePopulation();
+  SpatialSorter spatialSorter;
+  PermuteShader permuteShader; // GPU backend state, loaded by enableSpatialSort()
+  bool permuteShaderLoaded = false;
+  void sortParticles();
+  void applySpatialSort();
+  InteractionParameters interaction;
+  bool warnedAboutInteraction = false;
+
+  ParticleCountGovernor governor;
+  bool governorEnabled = false;
+  uint64_t governorEvaluationFrame = 0; // ofGetFrameNum() at the last evaluation
+  void evaluateGovernor();
+
   ofFloatColor particleColor;
 
+  // Holds the state of member fields, and reads their effective parameters, fields and colors
+  friend class ParticleFieldGroup;
+
+  ParameterBlock parameterBlock; // read by the update and draw shaders
   DrawShader drawShader;
-  UpdateShader updateShader;
+  ShaderVariantCache<UpdateShader, UpdateVariant> updateShaders; // warmed in allocateGpuResources
   InitShader initShader;
 
   float field1ValueOffset, field2ValueOffset; // -0.5 when values are [0,v]; 0.0 when values are [-v,v]
   ofTexture field1Texture, field2Texture;
   ofTexture emptyFieldTexture;
+  ofFloatPixels field1Pixels, field2Pixels; // CPU backend fields
+  FieldUploader field1Uploader, field2Uploader; // back setField*(pixels) on the GPU backends
+  bool field1Streamed = false, field2Streamed = false; // fieldNTexture follows its uploader
+  void setFieldData(const void* data, size_t width, size_t height, size_t numChannels, FieldPixelType type, FieldUploader& uploader, bool& streamed, ofFloatPixels& cpuPixels);
+  void refreshStreamedFields();
+  PreparedField preparedField;
 
 };
 
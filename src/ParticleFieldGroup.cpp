@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ParticleFieldGroup.h"
+#include "ofLog.h"
+
+namespace ofxParticleField {
+
+
+
+ParticleField* ParticleFieldGroup::addMember(ofFloatColor particleColor, float field1ValueOffset, float field2ValueOffset) {
+  if (members.size() >= MAX_MEMBERS) {
+    ofLogWarning("ParticleFieldGroup") << "a group holds at most " << MAX_MEMBERS << " members";
+    return nullptr;
+  }
+  if (isSetup()) {
+    ofLogWarning("ParticleFieldGroup") << "members are added before setup()";
+    return nullptr;
+  }
+  Member member;
+  member.field = std::make_unique<ParticleField>();
+  member.field->particleColor = particleColor;
+  member.field->field1ValueOffset = field1ValueOffset;
+  member.field->field2ValueOffset = field2ValueOffset;
+  members.push_back(std::move(member));
+  return members.back().field.get();
+}
+
+void ParticleFieldGroup::setup() {
+  setup(Settings {});
+}
+
+void ParticleFieldGroup::setup(const Settings& settings_) {
+  if (members.empty()) {
+    ofLogWarning("ParticleFieldGroup") << "setup() with no members";
+    return;
+  }
+  settings = settings_;
+  settings.fieldResolution = std::max<size_t>(settings.fieldResolution, 1);
+  stateLayout = StateLayout::create(settings.stateLayout, settings.positionEncoding);
+  layoutMembers();
+
+  ofPixels emptyFieldPixels;
+  emptyFieldPixels.allocate(1, 1, OF_PIXELS_RG);
+  emptyFieldPixels.setColor(ofColor::black);
+  emptyFieldTexture.allocate(emptyFieldPixels);
+  emptyFieldTexture.loadData(emptyFieldPixels);
+
+  parameterBlock.allocate();
+  parameterBlock.setLayout(members.size(), atlasWidth);
+
+  // One program per stage for the whole group: the most general variant, with what a member leaves out
+  // reduced to a no-op by its parameters (zero jitter strength, infinite maxDisplacement)
+  UpdateVariant variant;
+  variant.preparedField = true;
+  variant.twoFields = false;
+  updateShader.setStateLayout(stateLayout);
+  updateShader.setVariant(variant);
+  updateShader.setGroupParameters(true);
+  updateShader.load();
+  drawShader.setStateLayout(stateLayout);
+  drawShader.setColorStorage(ColorStorage::RGBA);
+  drawShader.setGroupParameters(true);
+  drawShader.load();
+  initShader.setStateLayout(stateLayout);
+  initShader.load();
+  fieldPrepareShader.load();
+
+  ofFboSettings fieldSettings;
+  fieldSettings.width = settings.fieldResolution * members.size();
+  fieldSettings.height = settings.fieldResolution;
+  fieldSettings.internalformat = GL_RG32F;
+  fieldSettings.textureTarget = GL_TEXTURE_2D;
+  fieldSettings.minFilter = GL_LINEAR;
+  fieldSettings.maxFilter = GL_LINEAR;
+  fieldSettings.wrapModeHorizontal = GL_CLAMP_TO_EDGE;
+  fieldSettings.wrapModeVertical = GL_CLAMP_TO_EDGE;
+  fieldAtlas.allocate(fieldSettings);
+
+  particleDataFbo.allocate(createParticleDataFboSettings(atlasWidth, atlasHeight));
+  initializeMembers();
+
+  particleColors.setup(ColorStorage::RGBA, ofFloatColor(1.0f, 1.0f, 1.0f, 1.0f));
+  particleColors.resize(atlasWidth, atlasHeight);
+  initializeMemberColors();
+}
+
+// Members take whole rows of a roughly square atlas, in the order they were added
+void ParticleFieldGroup::layoutMembers() {
+  size_t totalCount = 0;
+  for (auto& member : members) {
+    member.particleCount = (size_t)std::pow(2.0f, member.field->ln2ParticleCountParameter.get());
+    totalCount += member.particleCount;
+  }
+  atlasWidth = std::max<size_t>((size_t)std::sqrt((float)totalCount), 1);
+  atlasHeight = 0;
+  for (auto& member : members) {
+    member.firstRow = atlasHeight;
+    member.rows = (member.particleCount + atlasWidth - 1) / atlasWidth;
+    atlasHeight += member.rows;
+  }
+}
+
+ofFboSettings ParticleFieldGroup::createParticleDataFboSettings(size_t width, size_t height) const {
+  ofFboSettings fboSettings;
+  fboSettings.width = width;
+  fboSettings.height = height;
+  fboSettings.numColorbuffers = stateLayout.getNumAttachments();
+  fboSettings.colorFormats = stateLayout.getFormats();
+  fboSettings.textureTarget = GL_TEXTURE_RECTANGLE;
+  fboSettings.minFilter = GL_NEAREST;
+  fboSettings.maxFilter = GL_NEAREST;
+  fboSettings.wrapModeHorizontal = GL_CLAMP_TO_EDGE;
+  fboSettings.wrapModeVertical = GL_CLAMP_TO_EDGE;
+  return fboSettings;
+}
+
+// Each member's rows are seeded with its own weights; texels past its count are seeded too but never drawn
+void ParticleFieldGroup::initializeMembers() {
+  particleDataFbo.getSource().begin();
+  for (const auto& member : members) {
+    initShader.initializeRegion(particleDataFbo.getTarget(), 0, member.firstRow, atlasWidth, member.rows,
+                                ofRandom(10000.0f, 99999.0f), member.field->getMinWeightEffective(), member.field->getMaxWeightEffective());
+  }
+  particleDataFbo.getSource().end();
+  stateLayout.copyStaticAttachments(particleDataFbo.getSource(), particleDataFbo.getTarget());
+}
+
+void ParticleFieldGroup::initializeMemberColors() {
+  std::vector<ParticleColors::IndexedColor> colors;
+  colors.reserve(getParticleCount());
+  for (const auto& member : members) {
+    size_t firstIndex = member.firstRow * atlasWidth;
+    for (size_t i = 0; i < member.particleCount; ++i) {
+      colors.push_back({ firstIndex + i, member.field->particleColor });
+    }
+  }
+  particleColors.setColors(colors.data(), colors.size());
+}
+
+void ParticleFieldGroup::reinitializeParticles() {
+  if (!isSetup()) return;
+  initializeMembers();
+}
+
+int ParticleFieldGroup::getParticleCount() const {
+  size_t count = 0;
+  for (const auto& member : members) count += member.particleCount;
+  return (int)count;
+}
+
+void ParticleFieldGroup::setParticleColor(size_t member, size_t index, const ofFloatColor& color) {
+  if (member >= members.size() || index >= members[member].particleCount) return;
+  particleColors.setColor(members[member].firstRow * atlasWidth + index, color);
+}
+
+// Only uploaded when some member's effective parameters changed
+void ParticleFieldGroup::refreshMemberParameters(float timeStep) {
+  for (size_t i = 0; i < members.size(); ++i) {
+    Member& member = members[i];
+    const ParticleField& field = *member.field;
+    member.hasField2 = field.field2Texture.isAllocated();
+    member.stepParameters = field.createStepParameters(member.hasField2, timeStep);
+    parameterBlock.setMember(i, member.stepParameters, field.getParticleSizeEffective(), field.getSpeedThresholdEffective(), member.firstRow, member.particleCount);
+  }
+}
+
+// Rebuilds only the tiles whose textures, offsets or multipliers changed, or whose member had setField called
+void ParticleFieldGroup::prepareFields() {
+  bool began = false;
+  for (size_t i = 0; i < members.size(); ++i) {
+    Member& member = members[i];
+    ParticleField& field = *member.field;
+    bool hasField1 = field.field1Texture.isAllocated();
+    const ofTexture& field1 = hasField1 ? field.field1Texture : emptyFieldTexture;
+    const ofTexture& field2 = member.hasField2 ? field.field2Texture : emptyFieldTexture;
+    const StepParameters& parameters = member.stepParameters;
+    // A member without a field stays still, as a ParticleField does
+    std::array<float, 4> fieldParameters { parameters.field1ValueOffset, parameters.field2ValueOffset,
+                                           hasField1 ? parameters.field1Multiplier : 0.0f, hasField1 ? parameters.field2Multiplier : 0.0f };
+    std::array<GLuint, 2> textureIds { field1.getTextureData().textureID, field2.getTextureData().textureID };
+    if (member.prepared && !field.preparedField.isInvalidated() && textureIds == member.preparedTextureIds && fieldParameters == member.preparedParameters) continue;
+
+    if (!began) {
+      ofPushStyle();
+      ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+      ofSetColor(255);
+      ofFill();
+      fieldAtlas.begin();
+      began = true;
+    }
+    float resolution = settings.fieldResolution;
+    fieldPrepareShader.render(ofRectangle(i * resolution, 0, resolution, resolution), field1, field2,
+                              fieldParameters[0], fieldParameters[1], fieldParameters[2], fieldParameters[3]);
+    field.preparedField.clearInvalidation();
+    member.preparedTextureIds = textureIds;
+    member.preparedParameters = fieldParameters;
+    member.prepared = true;
+  }
+  if (began) {
+    fieldAtlas.end();
+    ofPopStyle();
+  }
+}
+
+void ParticleFieldGroup::update(int substeps) {
+  if (!isSetup() || substeps <= 0) return;
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::UPDATE, true);
+  lastTimeStep = REFERENCE_TIMESTEP / substeps;
+  refreshMemberParameters(lastTimeStep);
+  prepareFields();
+  parameterBlock.bind();
+  StepParameters stepParameters; // only the jitterSeed is read; the rest comes from the block
+  stepParameters.jitterSeed = ofGetElapsedTimef();
+  updateShader.render(particleDataFbo, atlasHeight, fieldAtlas.getTexture(), emptyFieldTexture, stepParameters, substeps);
+}
+
+void ParticleFieldGroup::draw(ofFbo& foregroundFbo) {
+  if (!isSetup()) return;
+  drawParticles(foregroundFbo);
+#if OFX_PARTICLE_FIELD_TIMING
+  stageTimers.collect();
+#endif
+}
+
+void ParticleFieldGroup::drawParticles(ofFbo& foregroundFbo) {
+  PARTICLE_FIELD_TIME_STAGE(stageTimers, Stage::DRAW, true);
+  refreshMemberParameters(lastTimeStep); // point sizes and speed thresholds may have changed since update()
+  particleColors.flush();
+  parameterBlock.bind();
+  drawShader.render(foregroundFbo, particleDataFbo, particleColors, atlasWidth * atlasHeight);
+}
+
+
+
+} // namespace ofxParticleField
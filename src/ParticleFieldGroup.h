@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "DrawShader.h"
+#include "FieldPrepareShader.h"
+#include "GroupParameterBlock.h"
+#include "InitShader.h"
+#include "ParticleColors.h"
+#include "ParticleField.h"
+#include "PingPongFbo.h"
+#include "StageTimers.h"
+#include "StateLayout.h"
+#include "UpdateShader.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Several ParticleFields stepped in one update pass and drawn with one draw call. Members are configured
+// like any ParticleField, with their own parameters, overrides and field textures, but their particles
+// live in whole rows of one state atlas and their fields in square tiles of one field atlas. The shaders
+// find each texel's parameters in a GroupParameterBlock entry by row, so there is one program bind, one
+// buffer upload and one full-atlas pass per step however many members there are. GPU backend only.
+class ParticleFieldGroup {
+public:
+  static constexpr size_t MAX_MEMBERS = GroupParameterBlock::MAX_MEMBERS;
+
+  struct Settings {
+    StateLayoutType stateLayout = StateLayoutType::SEPARATE;
+    PositionEncoding positionEncoding = PositionEncoding::FLOAT;
+    size_t fieldResolution = 256; // side of each member's field atlas tile
+  };
+
+  // Before setup(), which reads each member's ln2ParticleCountParameter; nullptr beyond MAX_MEMBERS.
+  // Members are never set up themselves: give them fields with setField1/2(const ofTexture&), and call
+  // setField again after changing a texture's contents, as with Settings::prepareFields.
+  ParticleField* addMember(ofFloatColor particleColor, float field1ValueOffset, float field2ValueOffset);
+  void setup();
+  void setup(const Settings& settings);
+  bool isSetup() const { return particleDataFbo.isAllocated(); }
+
+  size_t getMemberCount() const { return members.size(); }
+  ParticleField& getMember(size_t member) { return *members[member].field; }
+  int getParticleCount(size_t member) const { return (int)members[member].particleCount; }
+  int getParticleCount() const; // all members
+
+  void update(int substeps = 1); // one 60Hz step of every member split into substeps, one atlas pass each
+  void draw(ofFbo& foregroundFbo); // every member with one draw call
+  void reinitializeParticles();
+
+  // index is the particle's index within the member; uploaded at the next draw()
+  void setParticleColor(size_t member, size_t index, const ofFloatColor& color);
+
+  StageStats getStats(Stage stage) const { return stageTimers.getStats(stage); } // UPDATE and DRAW
+
+private:
+  struct Member {
+    std::unique_ptr<ParticleField> field;
+    size_t particleCount = 0;
+    size_t firstRow = 0;
+    size_t rows = 0;
+    StepParameters stepParameters; // this update's, from the member's effective parameters
+    bool hasField2 = false;
+    // What its field atlas tile was prepared from
+    std::array<GLuint, 2> preparedTextureIds {};
+    std::array<float, 4> preparedParameters {};
+    bool prepared = false;
+  };
+
+  void layoutMembers();
+  ofFboSettings createParticleDataFboSettings(size_t width, size_t height) const;
+  void initializeMembers();
+  void initializeMemberColors();
+  void refreshMemberParameters(float timeStep);
+  float lastTimeStep = REFERENCE_TIMESTEP; // of the last update's substeps
+  void prepareFields();
+  void drawParticles(ofFbo& foregroundFbo);
+
+  Settings settings;
+  std::vector<Member> members;
+  size_t atlasWidth = 0;
+  size_t atlasHeight = 0;
+
+  StateLayout stateLayout;
+  PingPongFbo particleDataFbo;
+  ParticleColors particleColors;
+  ofFbo fieldAtlas;
+  ofTexture emptyFieldTexture;
+
+  GroupParameterBlock parameterBlock;
+  UpdateShader updateShader;
+  DrawShader drawShader;
+  InitShader initShader;
+  FieldPrepareShader fieldPrepareShader;
+
+  StageTimers stageTimers;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,220 @@
+#include <algorithm>
+
+#include "ParticleReadback.h"
+
+namespace ofxParticleField {
+
+
+
+ParticleReadback::~ParticleReadback() {
+  releaseSlots();
+}
+
+void ParticleReadback::setup(const Settings& settings_, ReadbackSource source_, const StateLayout& stateLayout) {
+  release();
+  settings = settings_;
+  settings.stride = std::max<size_t>(settings.stride, 1);
+  source = source_;
+  if (source != ReadbackSource::CPU) {
+    shader.setStateLayout(stateLayout);
+    shader.setUseStateBuffer(source == ReadbackSource::STATE_BUFFER);
+    shader.setIncludeVelocity(settings.includeVelocity);
+    shader.load();
+  }
+  latencyFrames = 0;
+  bytesTransferred = 0;
+  lastCaptureBytes = 0;
+  droppedCaptureCount = 0;
+  setupDone = true;
+}
+
+void ParticleReadback::release() {
+  releaseSlots();
+  target.clear();
+  sampleCount = 0;
+  cpuSamples.clear();
+  setupDone = false;
+}
+
+void ParticleReadback::unmapView() {
+  if (viewSlot < 0) return;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[viewSlot].pixelBuffer);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  viewSlot = -1;
+  viewData = nullptr;
+}
+
+void ParticleReadback::releaseSlots() {
+  unmapView();
+  for (auto& slot : slots) {
+    if (slot.fence) glDeleteSync(slot.fence);
+    if (slot.pixelBuffer != 0) glDeleteBuffers(1, &slot.pixelBuffer);
+    slot = Slot {};
+  }
+  nextSlot = 0;
+  latestSequence = 0;
+}
+
+// Samples are laid out in rows of up to MAX_TARGET_WIDTH texels
+void ParticleReadback::allocateTarget(size_t count) {
+  releaseSlots();
+  size_t width = std::min(count, MAX_TARGET_WIDTH);
+  size_t height = (count + width - 1) / width;
+
+  ofFboSettings fboSettings;
+  fboSettings.width = width;
+  fboSettings.height = height;
+  fboSettings.internalformat = settings.includeVelocity ? GL_RGBA32F : GL_RG32F;
+  fboSettings.textureTarget = GL_TEXTURE_2D;
+  fboSettings.minFilter = GL_NEAREST;
+  fboSettings.maxFilter = GL_NEAREST;
+  target.allocate(fboSettings);
+
+  bufferBytes = width * height * getNumComponents() * sizeof(float);
+  for (auto& slot : slots) {
+    glGenBuffers(1, &slot.pixelBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, bufferBytes, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  sampleCount = count;
+}
+
+bool ParticleReadback::isTransferComplete(Slot& slot) {
+  if (!slot.fence) return true;
+  GLenum result = glClientWaitSync(slot.fence, 0, 0);
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return false;
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+  return true;
+}
+
+// A finished slot that was never viewed is reused: a newer capture supersedes it
+int ParticleReadback::acquireSlot() {
+  for (size_t i = 0; i < RING_SIZE; ++i) {
+    int candidate = (int)((nextSlot + i) % RING_SIZE);
+    if (candidate != viewSlot && isTransferComplete(slots[candidate])) return candidate;
+  }
+  return -1;
+}
+
+template<typename RenderFunction>
+void ParticleReadback::captureGpu(size_t activeCount, RenderFunction render) {
+  if (!setupDone) return;
+  size_t count = (activeCount + settings.stride - 1) / settings.stride;
+  if (count == 0) return;
+  if (count != sampleCount || !target.isAllocated()) allocateTarget(count);
+  int slotIndex = acquireSlot();
+  if (slotIndex < 0) {
+    ++droppedCaptureCount;
+    return;
+  }
+  Slot& slot = slots[slotIndex];
+
+  target.begin();
+  ofPushStyle();
+  ofFill();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED); // alpha carries velocity
+  render();
+  ofPopStyle();
+  target.end();
+
+  GLint previousReadFramebuffer = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, target.getId());
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, target.getWidth(), target.getHeight(), settings.includeVelocity ? GL_RGBA : GL_RG, GL_FLOAT, nullptr); // into the bound buffer
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.sequence = ++latestSequence;
+  slot.count = count;
+  slot.frame = ofGetFrameNum();
+  nextSlot = (slotIndex + 1) % RING_SIZE;
+  lastCaptureBytes = bufferBytes;
+  bytesTransferred += bufferBytes;
+}
+
+void ParticleReadback::capture(const ofFbo& stateFbo, size_t activeCount) {
+  captureGpu(activeCount, [&] { shader.render(target, stateFbo, activeCount, settings.stride); });
+}
+
+void ParticleReadback::capture(const ParticleStateBuffer& stateBuffer, size_t activeCount) {
+  captureGpu(activeCount, [&] { shader.render(target, stateBuffer, activeCount, settings.stride); });
+}
+
+void ParticleReadback::capture(const CpuSimulation& simulation) {
+  if (!setupDone) return;
+  size_t numComponents = getNumComponents();
+  size_t count = (simulation.getActiveCount() + settings.stride - 1) / settings.stride;
+  cpuSamples.resize(count * numComponents);
+  const auto& positionX = simulation.getPositionX();
+  const auto& positionY = simulation.getPositionY();
+  const auto& velocityX = simulation.getVelocityX();
+  const auto& velocityY = simulation.getVelocityY();
+  for (size_t i = 0; i < count; ++i) {
+    size_t particle = i * settings.stride;
+    float* sample = &cpuSamples[i * numComponents];
+    sample[0] = positionX[particle];
+    sample[1] = positionY[particle];
+    if (settings.includeVelocity) {
+      sample[2] = velocityX[particle];
+      sample[3] = velocityY[particle];
+    }
+  }
+  cpuFrame = ofGetFrameNum();
+  ++cpuSequence;
+  lastCaptureBytes = cpuSamples.size() * sizeof(float);
+  bytesTransferred += lastCaptureBytes;
+}
+
+ParticleReadback::View ParticleReadback::getView() {
+  View view;
+  view.numComponents = getNumComponents();
+  view.stride = settings.stride;
+
+  if (source == ReadbackSource::CPU) {
+    if (cpuSamples.empty()) return view;
+    view.data = cpuSamples.data();
+    view.count = cpuSamples.size() / view.numComponents;
+    view.frame = cpuFrame;
+    view.sequence = cpuSequence;
+    latencyFrames = ofGetFrameNum() - cpuFrame;
+    return view;
+  }
+
+  int newest = -1;
+  size_t viewSequence = (viewSlot >= 0) ? slots[viewSlot].sequence : 0;
+  for (int i = 0; i < (int)RING_SIZE; ++i) {
+    Slot& slot = slots[i];
+    if (slot.sequence <= viewSequence || i == viewSlot) continue;
+    if (isTransferComplete(slot) && (newest < 0 || slot.sequence > slots[newest].sequence)) newest = i;
+  }
+  if (newest >= 0) {
+    unmapView();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[newest].pixelBuffer);
+    // The fence has signalled, so mapping doesn't wait on the transfer
+    viewData = static_cast<const float*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bufferBytes, GL_MAP_READ_BIT));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (viewData) {
+      viewSlot = newest;
+      latencyFrames = ofGetFrameNum() - slots[newest].frame;
+    }
+  }
+  if (viewSlot < 0) return view;
+
+  const Slot& slot = slots[viewSlot];
+  view.data = viewData;
+  view.count = slot.count;
+  view.frame = slot.frame;
+  view.sequence = slot.sequence;
+  return view;
+}
+
+
+
+} // namespace ofxParticleField
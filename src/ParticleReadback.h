@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "CpuSimulation.h"
+#include "ParticleStateBuffer.h"
+#include "ReadbackShader.h"
+#include "StateLayout.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+enum class ReadbackSource {
+  STATE_TEXTURES, // GPU backend
+  STATE_BUFFER,   // COMPUTE backend
+  CPU             // copied straight from the CpuSimulation, without GL
+};
+
+// Copies particle state to the CPU without stalling. capture() gathers every stride-th active
+// particle into a float target and queues glReadPixels into a ring of pixel-pack buffers, each
+// with a fence; getView() maps the newest slot whose transfer has finished and hands out its
+// memory directly. A capture with no free slot is dropped rather than waited for.
+class ParticleReadback {
+public:
+  static constexpr size_t RING_SIZE = 3;
+  static constexpr size_t MAX_TARGET_WIDTH = 1024;
+
+  struct Settings {
+    bool includeVelocity = true; // xy position, zw velocity per particle; otherwise xy position only
+    size_t stride = 1; // particles 0, stride, 2 * stride...
+  };
+
+  // Normalized positions, and velocities in the units of the state (displacement per step is
+  // velocity * maxVelocity). Points into mapped memory, valid until the next capture() or getView().
+  struct View {
+    const float* data = nullptr;
+    size_t count = 0; // particles
+    size_t numComponents = 0; // floats per particle
+    size_t stride = 1;
+    uint64_t frame = 0; // ofGetFrameNum() at capture
+    size_t sequence = 0; // counts captures, so a view can be told apart from the one before
+    bool empty() const { return count == 0; }
+    const float* getParticle(size_t i) const { return data + i * numComponents; }
+    size_t getParticleIndex(size_t i) const { return i * stride; } // in the state, for colors and the like
+  };
+
+  ParticleReadback() = default;
+  ParticleReadback(const ParticleReadback&) = delete;
+  ParticleReadback& operator=(const ParticleReadback&) = delete;
+  ~ParticleReadback();
+
+  void setup(const Settings& settings_, ReadbackSource source_, const StateLayout& stateLayout);
+  void release(); // frees the GL buffers; setup() again to restart
+  const Settings& getSettings() const { return settings; }
+  bool isSetup() const { return setupDone; }
+
+  void capture(const ofFbo& stateFbo, size_t activeCount);
+  void capture(const ParticleStateBuffer& stateBuffer, size_t activeCount);
+  void capture(const CpuSimulation& simulation);
+
+  View getView(); // empty until a capture has completed
+
+  // Of the current view: frames between its capture and getView() picking it up
+  uint64_t getLatencyFrames() const { return latencyFrames; }
+  uint64_t getBytesTransferred() const { return bytesTransferred; } // summed over captures since setup
+  size_t getLastCaptureBytes() const { return lastCaptureBytes; }
+  size_t getDroppedCaptureCount() const { return droppedCaptureCount; }
+
+private:
+  struct Slot {
+    GLuint pixelBuffer = 0;
+    GLsync fence = nullptr;
+    size_t sequence = 0; // 0 until captured into
+    size_t count = 0;
+    uint64_t frame = 0;
+  };
+  static bool isTransferComplete(Slot& slot);
+  size_t getNumComponents() const { return settings.includeVelocity ? 4 : 2; }
+  void allocateTarget(size_t count);
+  void releaseSlots();
+  void unmapView();
+  int acquireSlot(); // -1 when every slot is in flight or being viewed
+  template<typename RenderFunction>
+  void captureGpu(size_t activeCount, RenderFunction render);
+
+  Settings settings;
+  ReadbackSource source = ReadbackSource::STATE_TEXTURES;
+  bool setupDone = false;
+  ReadbackShader shader;
+
+  ofFbo target;
+  size_t sampleCount = 0;
+  std::array<Slot, RING_SIZE> slots;
+  size_t nextSlot = 0;
+  size_t latestSequence = 0;
+  int viewSlot = -1; // mapped for the current view
+  const float* viewData = nullptr;
+
+  size_t bufferBytes = 0;
+
+  std::vector<float> cpuSamples; // CPU source: the view points here
+  uint64_t cpuFrame = 0;
+  size_t cpuSequence = 0;
+
+  uint64_t latencyFrames = 0;
+  uint64_t bytesTransferred = 0;
+  size_t lastCaptureBytes = 0;
+  size_t droppedCaptureCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,67 @@
+#include "ParticleStateBuffer.h"
+#include "PermuteComputeShader.h"
+
+namespace ofxParticleField {
+
+
+
+bool ParticleStateBuffer::isSupported() {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 3);
+}
+
+void ParticleStateBuffer::resize(size_t newWidth, size_t newHeight) {
+  if (newWidth == width && newHeight == height && isAllocated()) return;
+
+  ofBufferObject resized;
+  resized.allocate(newWidth * newHeight * BYTES_PER_PARTICLE, GL_DYNAMIC_COPY);
+  if (isAllocated()) {
+    // Rows move when the width changes, so the overlap is copied a row at a time
+    size_t minWidth = std::min(width, newWidth);
+    size_t minHeight = std::min(height, newHeight);
+    for (size_t y = 0; y < minHeight; ++y) {
+      buffer.copyTo(resized, y * width * BYTES_PER_PARTICLE, y * newWidth * BYTES_PER_PARTICLE, minWidth * BYTES_PER_PARTICLE);
+    }
+  }
+  buffer = resized;
+  width = newWidth;
+  height = newHeight;
+}
+
+void ParticleStateBuffer::permute(const ofTexture& permutation) {
+  if (!isAllocated()) return;
+  if (!permuteShader) {
+    permuteShader = std::make_shared<PermuteComputeShader>();
+    permuteShader->load();
+  }
+  size_t bytes = width * height * BYTES_PER_PARTICLE;
+  if (!permuteSource.isAllocated() || permuteSource.size() != bytes) permuteSource.allocate(bytes, GL_DYNAMIC_COPY);
+  buffer.copyTo(permuteSource);
+  permuteShader->render(*this, permuteSource, permutation);
+}
+
+void ParticleStateBuffer::bind(ofShader& shader) const {
+  buffer.bindBase(GL_SHADER_STORAGE_BUFFER, BINDING);
+  shader.setUniform1i("stateWidth", (int)width);
+}
+
+ShaderDefines ParticleStateBuffer::getShaderDefines(bool readOnly) {
+  std::string qualifier = readOnly ? "readonly " : "";
+  return {
+    { "STATE_DECLARATIONS",
+      "struct Particle { vec2 position; vec2 velocity; vec2 jitter; float weight; float padding; }; "
+      "layout(std430, binding = " + std::to_string(BINDING) + ") " + qualifier + "buffer ParticleState { Particle particles[]; }; "
+      "uniform int stateWidth;" },
+    { "PARTICLE_INDEX(texel)", "((texel).y * stateWidth + (texel).x)" },
+    { "READ_POSITION(texel)", "particles[PARTICLE_INDEX(texel)].position" },
+    { "READ_VELOCITY(texel)", "particles[PARTICLE_INDEX(texel)].velocity" },
+    { "READ_JITTER(texel)", "particles[PARTICLE_INDEX(texel)].jitter" },
+    { "READ_WEIGHT(texel)", "particles[PARTICLE_INDEX(texel)].weight" }
+  };
+}
+
+
+
+} // namespace ofxParticleField
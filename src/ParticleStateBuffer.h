@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+
+#include "ShaderDefines.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+class PermuteComputeShader;
+
+// Particle state in one shader storage buffer for the compute backend (GL 4.3+).
+// Particle i is element i, and also texel (i % width, i / width) for anything laid out like the state textures.
+class ParticleStateBuffer {
+public:
+  static constexpr GLuint BINDING = 0;
+  static constexpr size_t BYTES_PER_PARTICLE = 8 * sizeof(float); // std430 Particle struct below
+
+  static bool isSupported(); // needs a current GL 4.3 context
+
+  // Keeps the overlapping region like resizeParticles() does for the state textures; the rest is undefined
+  void resize(size_t width, size_t height);
+  bool isAllocated() const { return buffer.isAllocated(); }
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+  size_t getUpdateBytesPerParticle() const { return (7 + 6) * sizeof(float); } // weight is read but not written
+
+  // Particle i takes the state of particle permutation[i], from an R32UI texture laid out like the particles
+  void permute(const ofTexture& permutation);
+
+  // Binds the buffer to BINDING and sets stateWidth for the READ_* macros
+  void bind(ofShader& shader) const;
+  // STATE_DECLARATIONS and READ_* like StateLayout, reading the buffer instead of textures
+  static ShaderDefines getShaderDefines(bool readOnly);
+
+private:
+  ofBufferObject buffer;
+  ofBufferObject permuteSource; // copy of the buffer read by the permute pass
+  std::shared_ptr<PermuteComputeShader> permuteShader; // loaded on first use
+  size_t width = 0;
+  size_t height = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ComputeShader.h"
+#include "Constants.h"
+#include "ParticleStateBuffer.h"
+
+namespace ofxParticleField {
+
+
+
+// PermuteShader for the compute backend: particle i of the state buffer takes particle permutation[i]
+// of a copy of the previous state, bound at SOURCE_BINDING
+class PermuteComputeShader : public ComputeShader {
+
+public:
+  static constexpr size_t WORKGROUP_SIZE = 256;
+  static constexpr GLuint SOURCE_BINDING = ParticleStateBuffer::BINDING + 1;
+
+  void render(const ParticleStateBuffer& stateBuffer, const ofBufferObject& source, const ofTexture& permutation) {
+    size_t count = stateBuffer.getWidth() * stateBuffer.getHeight();
+    shader.begin();
+    stateBuffer.bind(shader);
+    source.bindBase(GL_SHADER_STORAGE_BUFFER, SOURCE_BINDING);
+    shader.setUniformTexture("permutation", permutation, PERMUTATION_TEXTURE_UNIT);
+    shader.setUniform1i("particleCount", (int)count);
+    dispatch(count, WORKGROUP_SIZE);
+    shader.end();
+  }
+
+protected:
+  std::string getComputeShader() override {
+    return injectDefines(GLSL(
+                layout(local_size_x = WORKGROUP_SIZE) in;
+                STATE_DECLARATIONS
+                layout(std430, binding = SOURCE_BINDING) readonly buffer SourceState { Particle sourceParticles[]; };
+                uniform usampler2DRect permutation;
+                uniform int particleCount;
+
+                void main(void) {
+                  int i = int(gl_GlobalInvocationID.x);
+                  if (i >= particleCount) return;
+                  ivec2 texel = ivec2(i % stateWidth, i / stateWidth);
+                  particles[i] = sourceParticles[texelFetch(permutation, texel).r];
+                }
+                ), getShaderDefines());
+  }
+
+private:
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = ParticleStateBuffer::getShaderDefines(false);
+    defines.push_back({ "WORKGROUP_SIZE", std::to_string(WORKGROUP_SIZE) });
+    defines.push_back({ "SOURCE_BINDING", std::to_string(SOURCE_BINDING) });
+    return defines;
+  }
+
+};
+
+
+
+} // namespace ofxParticleField
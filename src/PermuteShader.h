@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+
+#include "CachedShader.h"
+#include "Constants.h"
+#include "StateLayout.h"
+
+namespace ofxParticleField {
+
+
+
+// Reorders particles: target texel i takes the texel of particle permutation[i], where the permutation
+// is an R32UI texture laid out like the state. Copies every state attachment unchanged, or with
+// setSingleTexture() one float or unsigned integer texture such as the particle colors.
+class PermuteShader : public CachedShader {
+
+public:
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; singleTexture = false; } // before load()
+  void setSingleTexture(bool integer) { singleTexture = true; integerTexture = integer; } // before load()
+
+  // Within target.begin()/end() with every attachment drawn to and blending disabled.
+  // bindSource binds the source as stateData0..N.
+  void render(const ofTexture& permutation, size_t width, size_t height, const std::function<void(ofShader&)>& bindSource) {
+    ofPushStyle();
+    ofFill();
+    shader.begin();
+    bindSource(shader);
+    shader.setUniformTexture("permutation", permutation, PERMUTATION_TEXTURE_UNIT);
+    shader.setUniform1i("particleDataWidth", (int)width);
+    // The source may be an integer texture, so a rectangle is drawn rather than its texture
+    ofDrawRectangle(0, 0, width, height);
+    shader.end();
+    ofPopStyle();
+  }
+
+protected:
+  std::string getVertexShader() override {
+    return GLSL(
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+
+                void main() {
+                  gl_Position = modelViewProjectionMatrix * position;
+                }
+                );
+  }
+
+  std::string getFragmentShader() override {
+    return injectDefines(GLSL(
+                STATE_DECLARATIONS
+                ALL_STATE_OUTPUTS
+                uniform usampler2DRect permutation;
+                uniform int particleDataWidth;
+
+                void main(void) {
+                  int source = int(texelFetch(permutation, ivec2(gl_FragCoord.xy)).r);
+                  ivec2 sourceTexel = ivec2(source % particleDataWidth, source / particleDataWidth);
+                  COPY_ALL_STATE(sourceTexel);
+                }
+                ), getShaderDefines());
+  }
+
+private:
+  ShaderDefines getShaderDefines() const {
+    if (!singleTexture) return stateLayout.getShaderDefines();
+    std::string sampler = integerTexture ? "usampler2DRect" : "sampler2DRect";
+    std::string output = integerTexture ? "uvec4" : "vec4";
+    return {
+      { "STATE_DECLARATIONS", "uniform " + sampler + " stateData0;" },
+      { "ALL_STATE_OUTPUTS", "layout(location = 0) out " + output + " outState0;" },
+      { "COPY_ALL_STATE(sourceTexel)", "outState0 = texelFetch(stateData0, sourceTexel)" }
+    };
+  }
+
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  bool singleTexture = false;
+  bool integerTexture = false;
+
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <limits>
+
+#include "PopulationStats.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+size_t divideRoundingUp(size_t value, size_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+} // namespace
+
+PopulationReducer::~PopulationReducer() {
+  releaseSlots();
+}
+
+void PopulationReducer::setup(ReadbackSource source_, const StateLayout& stateLayout) {
+  release();
+  source = source_;
+  if (source != ReadbackSource::CPU) {
+    gatherShader.setStateLayout(stateLayout);
+    gatherShader.setUseStateBuffer(source == ReadbackSource::STATE_BUFFER);
+    gatherShader.load();
+    combineShader.setCombine(true);
+    combineShader.load();
+  }
+  setupDone = true;
+}
+
+void PopulationReducer::release() {
+  releaseSlots();
+  levels.clear();
+  levelWidth = 0;
+  levelHeight = 0;
+  stats = PopulationStats {};
+  droppedReductionCount = 0;
+  setupDone = false;
+}
+
+void PopulationReducer::releaseSlots() {
+  for (auto& slot : slots) {
+    if (slot.fence) glDeleteSync(slot.fence);
+    if (slot.pixelBuffer != 0) glDeleteBuffers(1, &slot.pixelBuffer);
+    slot = Slot {};
+  }
+  nextSlot = 0;
+  latestSequence = 0;
+  statsSequence = 0;
+}
+
+void PopulationReducer::allocateLevels(size_t width, size_t height) {
+  levels.clear();
+  levelWidth = width;
+  levelHeight = height;
+  while (true) {
+    ofFboSettings fboSettings;
+    fboSettings.width = width;
+    fboSettings.height = height;
+    fboSettings.numColorbuffers = NUM_TARGETS;
+    fboSettings.colorFormats = std::vector<GLint>(NUM_TARGETS, GL_RGBA32F);
+    fboSettings.textureTarget = GL_TEXTURE_2D;
+    fboSettings.minFilter = GL_NEAREST;
+    fboSettings.maxFilter = GL_NEAREST;
+    levels.emplace_back();
+    levels.back().allocate(fboSettings);
+    if (width == 1 && height == 1) break;
+    width = divideRoundingUp(width, COMBINE_BLOCK);
+    height = divideRoundingUp(height, COMBINE_BLOCK);
+  }
+
+  if (slots[0].pixelBuffer != 0) return;
+  for (auto& slot : slots) {
+    glGenBuffers(1, &slot.pixelBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, RESULT_FLOATS * sizeof(float), nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+}
+
+bool PopulationReducer::isTransferComplete(Slot& slot) {
+  if (!slot.fence) return true;
+  GLenum result = glClientWaitSync(slot.fence, 0, 0);
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return false;
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+  return true;
+}
+
+template<typename Gather>
+void PopulationReducer::reduceGpu(size_t particleDataWidth, size_t activeCount, Gather gather) {
+  if (!setupDone || activeCount == 0 || particleDataWidth == 0) return;
+  size_t activeRows = divideRoundingUp(activeCount, particleDataWidth);
+  size_t width = divideRoundingUp(particleDataWidth, GATHER_BLOCK);
+  size_t height = divideRoundingUp(activeRows, GATHER_BLOCK);
+  if (width != levelWidth || height != levelHeight) allocateLevels(width, height);
+
+  // A slot whose result was never picked up is superseded by this one
+  Slot& slot = slots[nextSlot];
+  if (!isTransferComplete(slot)) {
+    ++droppedReductionCount;
+    return;
+  }
+
+  static const GLenum drawBuffers[NUM_TARGETS] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+  ofPushStyle();
+  ofFill();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED); // alpha carries data
+  for (size_t i = 0; i < levels.size(); ++i) {
+    levels[i].begin();
+    glDrawBuffers(NUM_TARGETS, drawBuffers);
+    if (i == 0) {
+      gather(levels[i]);
+    } else {
+      combineShader.renderCombine(levels[i], levels[i - 1], COMBINE_BLOCK);
+    }
+    glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to single draw buffer after MRT
+    levels[i].end();
+  }
+  ofPopStyle();
+
+  GLint previousReadFramebuffer = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, levels.back().getId());
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+  for (size_t i = 0; i < NUM_TARGETS; ++i) {
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>(i * 4 * sizeof(float))); // offset into the bound buffer
+  }
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.sequence = ++latestSequence;
+  slot.frame = ofGetFrameNum();
+  nextSlot = (nextSlot + 1) % RING_SIZE;
+}
+
+void PopulationReducer::reduce(const ofFbo& stateFbo, size_t activeCount, float speedThreshold) {
+  reduceGpu(stateFbo.getWidth(), activeCount, [&](const ofFbo& target) {
+    gatherShader.renderGather(target, stateFbo, activeCount, speedThreshold, GATHER_BLOCK);
+  });
+}
+
+void PopulationReducer::reduce(const ParticleStateBuffer& stateBuffer, size_t activeCount, float speedThreshold) {
+  reduceGpu(stateBuffer.getWidth(), activeCount, [&](const ofFbo& target) {
+    gatherShader.renderGather(target, stateBuffer, activeCount, speedThreshold, GATHER_BLOCK);
+  });
+}
+
+void PopulationReducer::reduce(const CpuSimulation& simulation, float speedThreshold) {
+  if (!setupDone) return;
+  const auto& positionX = simulation.getPositionX();
+  const auto& positionY = simulation.getPositionY();
+  const auto& velocityX = simulation.getVelocityX();
+  const auto& velocityY = simulation.getVelocityY();
+  const auto& weight = simulation.getWeight();
+  float result[RESULT_FLOATS] = {
+    0.0f, 0.0f, 0.0f, 0.0f,
+    std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+    0.0f, 0.0f, 0.0f, 0.0f
+  };
+  // Doubles for the sums, as the GPU's tree reduction keeps partial sums small and this doesn't
+  double speedSum = 0.0, energySum = 0.0, xSum = 0.0, ySum = 0.0;
+  size_t aboveCount = 0;
+  size_t count = simulation.getActiveCount();
+  for (size_t i = 0; i < count; ++i) {
+    float speed = std::sqrt(velocityX[i] * velocityX[i] + velocityY[i] * velocityY[i]);
+    speedSum += speed;
+    energySum += 0.5 * weight[i] * speed * speed;
+    xSum += positionX[i];
+    ySum += positionY[i];
+    result[4] = std::min(result[4], positionX[i]);
+    result[5] = std::min(result[5], positionY[i]);
+    result[6] = std::max(result[6], positionX[i]);
+    result[7] = std::max(result[7], positionY[i]);
+    result[8] = std::max(result[8], speed);
+    if (speed * speedThreshold >= 1.0f) ++aboveCount;
+  }
+  result[0] = (float)speedSum;
+  result[1] = (float)energySum;
+  result[2] = (float)xSum;
+  result[3] = (float)ySum;
+  result[9] = (float)aboveCount;
+  result[10] = (float)count;
+  setStats(result, ofGetFrameNum());
+}
+
+void PopulationReducer::setStats(const float* result, uint64_t frame) {
+  stats = PopulationStats {};
+  stats.frame = frame;
+  stats.particleCount = (size_t)result[10];
+  if (stats.particleCount == 0) return;
+  float inverseCount = 1.0f / result[10];
+  stats.meanSpeed = result[0] * inverseCount;
+  stats.kineticEnergy = result[1];
+  stats.centroidX = result[2] * inverseCount;
+  stats.centroidY = result[3] * inverseCount;
+  stats.minX = result[4];
+  stats.minY = result[5];
+  stats.maxX = result[6];
+  stats.maxY = result[7];
+  stats.maxSpeed = result[8];
+  stats.fractionAboveSpeedThreshold = result[9] * inverseCount;
+}
+
+const PopulationStats& PopulationReducer::getStats() {
+  if (source == ReadbackSource::CPU) return stats;
+  int newest = -1;
+  for (int i = 0; i < (int)RING_SIZE; ++i) {
+    Slot& slot = slots[i];
+    if (slot.sequence <= statsSequence) continue;
+    if (isTransferComplete(slot) && (newest < 0 || slot.sequence > slots[newest].sequence)) newest = i;
+  }
+  if (newest < 0) return stats;
+
+  float result[RESULT_FLOATS];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[newest].pixelBuffer);
+  glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(result), result); // the fence has signalled, so this doesn't wait
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  statsSequence = slots[newest].sequence;
+  setStats(result, slots[newest].frame);
+  return stats;
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "CpuSimulation.h"
+#include "ParticleReadback.h"
+#include "ParticleStateBuffer.h"
+#include "PopulationStatsShader.h"
+#include "StateLayout.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Aggregates over the active particles. Speeds are lengths of the state velocity (displacement per
+// step is velocity * maxVelocity); positions are normalized, and the centroid is not wrap-aware.
+struct PopulationStats {
+  size_t particleCount = 0;
+  float meanSpeed = 0.0f;
+  float maxSpeed = 0.0f;
+  float kineticEnergy = 0.0f; // sum of weight * speed^2 / 2
+  float centroidX = 0.0f;
+  float centroidY = 0.0f;
+  float minX = 0.0f;
+  float minY = 0.0f;
+  float maxX = 0.0f;
+  float maxY = 0.0f;
+  float fractionAboveSpeedThreshold = 0.0f; // speed * speedThreshold >= 1, so drawn at full alpha
+  uint64_t frame = 0; // ofGetFrameNum() when reduced
+};
+
+// Reduces the particle state to PopulationStats on the GPU: a gather pass sums GATHER_BLOCK^2
+// particles per texel, then combine passes merge COMBINE_BLOCK^2 texels until one is left. That
+// texel is read into a ring of pixel-pack buffers with fences and picked up once its transfer has
+// finished, so getStats() is a few frames behind and never waits. The CPU backend reduces in place.
+class PopulationReducer {
+public:
+  static constexpr size_t RING_SIZE = 3;
+  static constexpr int GATHER_BLOCK = 8;
+  static constexpr int COMBINE_BLOCK = 4;
+
+  PopulationReducer() = default;
+  PopulationReducer(const PopulationReducer&) = delete;
+  PopulationReducer& operator=(const PopulationReducer&) = delete;
+  ~PopulationReducer();
+
+  void setup(ReadbackSource source_, const StateLayout& stateLayout);
+  void release();
+  bool isSetup() const { return setupDone; }
+
+  void reduce(const ofFbo& stateFbo, size_t activeCount, float speedThreshold);
+  void reduce(const ParticleStateBuffer& stateBuffer, size_t activeCount, float speedThreshold);
+  void reduce(const CpuSimulation& simulation, float speedThreshold);
+
+  const PopulationStats& getStats(); // the newest finished reduction; zeros until the first
+  size_t getDroppedReductionCount() const { return droppedReductionCount; }
+
+private:
+  static constexpr size_t NUM_TARGETS = 3;
+  static constexpr size_t RESULT_FLOATS = NUM_TARGETS * 4;
+
+  struct Slot {
+    GLuint pixelBuffer = 0;
+    GLsync fence = nullptr;
+    size_t sequence = 0;
+    uint64_t frame = 0;
+  };
+  static bool isTransferComplete(Slot& slot);
+  void allocateLevels(size_t width, size_t height);
+  void releaseSlots();
+  template<typename Gather>
+  void reduceGpu(size_t particleDataWidth, size_t activeCount, Gather gather); // gather(target) runs the first pass
+  void setStats(const float* result, uint64_t frame); // RESULT_FLOATS from the three targets
+
+  ReadbackSource source = ReadbackSource::STATE_TEXTURES;
+  bool setupDone = false;
+  PopulationStatsShader gatherShader;
+  PopulationStatsShader combineShader;
+
+  std::vector<ofFbo> levels; // the gather output first, down to 1x1
+  size_t levelWidth = 0;
+  size_t levelHeight = 0;
+  std::array<Slot, RING_SIZE> slots;
+  size_t nextSlot = 0;
+  size_t latestSequence = 0;
+  size_t statsSequence = 0;
+
+  PopulationStats stats;
+  size_t droppedReductionCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "CachedShader.h"
+#include "ParticleStateBuffer.h"
+#include "StateLayout.h"
+
+namespace ofxParticleField {
+
+
+
+// One pass of the population reduction into three RGBA32F attachments:
+//   0: summed speed, kinetic energy, position x, position y
+//   1: min x, min y, max x, max y
+//   2: max speed, particles above the speed threshold, particles, unused
+// The gather pass reads blockSize^2 state texels per output texel through the READ_* macros;
+// the combine pass merges blockSize^2 texels of the previous level.
+class PopulationStatsShader : public CachedShader {
+
+public:
+  void setCombine(bool combine_) { combine = combine_; } // before load()
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load(); gather only
+  void setUseStateBuffer(bool useStateBuffer_) { useStateBuffer = useStateBuffer_; } // before load(); gather only
+
+  // Within target.begin()/end() with its three draw buffers active
+  void renderGather(const ofFbo& target, const ofFbo& stateFbo, size_t activeCount, float speedThreshold, int blockSize) {
+    renderGather(target, stateFbo.getWidth(), activeCount, speedThreshold, blockSize, [&] {
+      stateLayout.bindStateTextures(shader, stateFbo);
+    });
+  }
+
+  void renderGather(const ofFbo& target, const ParticleStateBuffer& stateBuffer, size_t activeCount, float speedThreshold, int blockSize) {
+    renderGather(target, stateBuffer.getWidth(), activeCount, speedThreshold, blockSize, [&] {
+      stateBuffer.bind(shader);
+    });
+  }
+
+  void renderCombine(const ofFbo& target, const ofFbo& source, int blockSize) {
+    shader.begin();
+    shader.setUniformTexture("sumsTexture", source.getTexture(0), 0);
+    shader.setUniformTexture("boundsTexture", source.getTexture(1), 1);
+    shader.setUniformTexture("countsTexture", source.getTexture(2), 2);
+    shader.setUniform2i("sourceSize", (int)source.getWidth(), (int)source.getHeight());
+    shader.setUniform1i("blockSize", blockSize);
+    ofDrawRectangle(0, 0, target.getWidth(), target.getHeight());
+    shader.end();
+  }
+
+protected:
+  void renderGather(const ofFbo& target, size_t particleDataWidth, size_t activeCount, float speedThreshold, int blockSize, const std::function<void()>& bindState) {
+    shader.begin();
+    bindState();
+    shader.setUniform1i("particleDataWidth", (int)particleDataWidth);
+    shader.setUniform1i("activeCount", (int)activeCount);
+    shader.setUniform1f("speedThreshold", speedThreshold);
+    shader.setUniform1i("blockSize", blockSize);
+    ofDrawRectangle(0, 0, target.getWidth(), target.getHeight());
+    shader.end();
+  }
+
+  std::string getVertexShader() override {
+    return specialize(GLSL(
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+
+                void main() {
+                  gl_Position = modelViewProjectionMatrix * position;
+                }
+                ));
+  }
+
+  std::string getFragmentShader() override {
+    if (combine) {
+      return GLSL(
+                uniform sampler2D sumsTexture;
+                uniform sampler2D boundsTexture;
+                uniform sampler2D countsTexture;
+                uniform ivec2 sourceSize;
+                uniform int blockSize;
+                layout(location = 0) out vec4 sums;
+                layout(location = 1) out vec4 bounds;
+                layout(location = 2) out vec4 counts;
+
+                void main(void) {
+                  ivec2 origin = ivec2(gl_FragCoord.xy) * blockSize;
+                  ivec2 end = min(origin + blockSize, sourceSize);
+                  sums = vec4(0.0);
+                  bounds = vec4(1e30, 1e30, -1e30, -1e30);
+                  counts = vec4(0.0);
+                  for (int y = origin.y; y < end.y; ++y) {
+                    for (int x = origin.x; x < end.x; ++x) {
+                      ivec2 texel = ivec2(x, y);
+                      sums += texelFetch(sumsTexture, texel, 0);
+                      vec4 b = texelFetch(boundsTexture, texel, 0);
+                      bounds = vec4(min(bounds.xy, b.xy), max(bounds.zw, b.zw));
+                      vec4 c = texelFetch(countsTexture, texel, 0);
+                      counts = vec4(max(counts.x, c.x), counts.yzw + c.yzw);
+                    }
+                  }
+                }
+                );
+    }
+    return specialize(GLSL(
+                STATE_DECLARATIONS
+                uniform int particleDataWidth;
+                uniform int activeCount;
+                uniform float speedThreshold;
+                uniform int blockSize;
+                layout(location = 0) out vec4 sums;
+                layout(location = 1) out vec4 bounds;
+                layout(location = 2) out vec4 counts;
+
+                void main(void) {
+                  ivec2 origin = ivec2(gl_FragCoord.xy) * blockSize;
+                  sums = vec4(0.0);
+                  bounds = vec4(1e30, 1e30, -1e30, -1e30);
+                  counts = vec4(0.0);
+                  for (int y = origin.y; y < origin.y + blockSize; ++y) {
+                    for (int x = origin.x; x < min(origin.x + blockSize, particleDataWidth); ++x) {
+                      if (y * particleDataWidth + x >= activeCount) break;
+                      ivec2 texel = ivec2(x, y);
+                      vec2 position = READ_POSITION(texel);
+                      float speed = length(READ_VELOCITY(texel));
+                      sums += vec4(speed, 0.5 * READ_WEIGHT(texel) * speed * speed, position);
+                      bounds = vec4(min(bounds.xy, position), max(bounds.zw, position));
+                      // Drawn at full alpha from here
+                      counts += vec4(0.0, step(1.0, speed * speedThreshold), 1.0, 0.0);
+                      counts.x = max(counts.x, speed);
+                    }
+                  }
+                }
+                ));
+  }
+
+private:
+  // Storage buffers need GLSL 430
+  std::string specialize(const std::string& source) const {
+    if (combine) return source;
+    ShaderDefines defines = useStateBuffer ? ParticleStateBuffer::getShaderDefines(true) : stateLayout.getShaderDefines();
+    std::string specialized = injectDefines(source, defines);
+    return useStateBuffer ? replaceVersion(specialized, 430) : specialized;
+  }
+
+  bool combine = false;
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  bool useStateBuffer = false;
+
+};
+
+
+
+} // namespace ofxParticleField
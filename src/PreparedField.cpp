@@ -0,0 +1,92 @@
+#include <algorithm>
+
+#include "PreparedField.h"
+
+namespace ofxParticleField {
+
+
+
+PreparedField::~PreparedField() {
+  for (auto& query : queries) {
+    if (query.id != 0) glDeleteQueries(1, &query.id);
+  }
+}
+
+const ofTexture& PreparedField::prepare(const ofTexture& field1Texture, const ofTexture& field2Texture, bool hasField2, const StepParameters& parameters) {
+  for (auto& query : queries) {
+    if (query.pending) collectQuery(query);
+  }
+
+  size_t width = field1Texture.getWidth();
+  size_t height = field1Texture.getHeight();
+  if (hasField2) {
+    width = std::max(width, (size_t)field2Texture.getWidth());
+    height = std::max(height, (size_t)field2Texture.getHeight());
+  }
+  std::array<float, 4> fieldParameters { parameters.field1ValueOffset, parameters.field2ValueOffset, parameters.field1Multiplier, parameters.field2Multiplier };
+  bool resized = !fbo.isAllocated() || fbo.getWidth() != width || fbo.getHeight() != height;
+  if (!dirty && !resized && fieldParameters == preparedParameters) return fbo.getTexture();
+
+  if (resized) {
+    ofFboSettings fboSettings;
+    fboSettings.width = width;
+    fboSettings.height = height;
+    fboSettings.internalformat = GL_RG32F;
+    fboSettings.textureTarget = GL_TEXTURE_2D; // sampled with normalized positions, like the source fields
+    fboSettings.minFilter = GL_LINEAR;
+    fboSettings.maxFilter = GL_LINEAR;
+    fboSettings.wrapModeHorizontal = GL_CLAMP_TO_EDGE;
+    fboSettings.wrapModeVertical = GL_CLAMP_TO_EDGE;
+    fbo.allocate(fboSettings);
+  }
+
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  ofSetColor(255);
+  ofFill();
+  fbo.begin();
+  shader.render(fbo, field1Texture, field2Texture, fieldParameters[0], fieldParameters[1], fieldParameters[2], fieldParameters[3]);
+  countNanTexels(field1Texture, field2Texture, hasField2);
+  fbo.end();
+  ofPopStyle();
+
+  dirty = false;
+  preparedParameters = fieldParameters;
+  ++preparationCount;
+  return fbo.getTexture();
+}
+
+// Within fbo.begin()/end(), which the fields fit inside by construction
+void PreparedField::countNanTexels(const ofTexture& field1Texture, const ofTexture& field2Texture, bool hasField2) {
+  NanQuery& query = queries[nextQuery];
+  if (query.id == 0) glGenQueries(1, &query.id);
+  // A query still in flight after a full ring of preparations is dropped rather than waited for
+  if (query.pending) collectQuery(query);
+  query.pending = false;
+
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glBeginQuery(GL_SAMPLES_PASSED, query.id);
+  shader.renderNanTexels(field1Texture, 1);
+  if (hasField2) shader.renderNanTexels(field2Texture, 2);
+  glEndQuery(GL_SAMPLES_PASSED);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  query.pending = true;
+  nextQuery = (nextQuery + 1) % QUERY_RING_SIZE;
+}
+
+bool PreparedField::collectQuery(NanQuery& query) {
+  GLint available = 0;
+  glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) return false;
+  GLuint64 texels = 0;
+  glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &texels);
+  scrubbedNanTexelCount += texels;
+  lastScrubbedNanTexelCount = texels;
+  query.pending = false;
+  return true;
+}
+
+
+
+} // namespace ofxParticleField
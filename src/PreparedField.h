@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+
+#include "FieldPrepareShader.h"
+#include "StepParameters.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// The combined, NaN-free field an update step samples with one fetch. It is only rebuilt after
+// invalidate() or when an offset or multiplier changes, not per step. NaN texels are counted by an
+// occlusion query that is read a few frames later, so counting never stalls.
+class PreparedField {
+public:
+  static constexpr size_t QUERY_RING_SIZE = 3;
+
+  PreparedField() = default;
+  PreparedField(const PreparedField&) = delete;
+  PreparedField& operator=(const PreparedField&) = delete;
+  ~PreparedField();
+
+  void load() { shader.load(); }
+  void invalidate() { dirty = true; } // a field's contents changed
+  // For a ParticleFieldGroup, which prepares its members' fields into its own atlas instead
+  bool isInvalidated() const { return dirty; }
+  void clearInvalidation() { dirty = false; }
+
+  // Sized to the larger of the two fields
+  const ofTexture& prepare(const ofTexture& field1Texture, const ofTexture& field2Texture, bool hasField2, const StepParameters& parameters);
+  const ofTexture& getTexture() const { return fbo.getTexture(); }
+
+  // Source texels holding a NaN in either component, summed over preparations and for the latest counted one
+  uint64_t getScrubbedNanTexelCount() const { return scrubbedNanTexelCount; }
+  uint64_t getLastScrubbedNanTexelCount() const { return lastScrubbedNanTexelCount; }
+  size_t getPreparationCount() const { return preparationCount; }
+
+private:
+  struct NanQuery {
+    GLuint id = 0;
+    bool pending = false;
+  };
+  bool collectQuery(NanQuery& query);
+  void countNanTexels(const ofTexture& field1Texture, const ofTexture& field2Texture, bool hasField2);
+
+  FieldPrepareShader shader;
+  ofFbo fbo;
+  bool dirty = true;
+  std::array<float, 4> preparedParameters {}; // offsets and multipliers it was built with
+
+  std::array<NanQuery, QUERY_RING_SIZE> queries;
+  size_t nextQuery = 0;
+  uint64_t scrubbedNanTexelCount = 0;
+  uint64_t lastScrubbedNanTexelCount = 0;
+  size_t preparationCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "ProgramCache.h"
+
+namespace ofxParticleField {
+
+
+
+// Never destroyed: cached programs can't be deleted once the GL context has gone at exit
+ProgramCache& ProgramCache::shared() {
+  static ProgramCache* cache = new ProgramCache();
+  return *cache;
+}
+
+bool ProgramCache::load(ofShader& shader, const Sources& sources) {
+  std::string key;
+  for (const auto& source : sources) {
+    key += std::to_string(source.first) + '\n' + source.second + '\0';
+  }
+  auto it = programs.find(key);
+  if (it != programs.end()) {
+    shader = it->second;
+    ++cachedLoadCount;
+    return true;
+  }
+
+  shader.unload();
+  for (const auto& source : sources) {
+    if (!shader.setupShaderFromSource(source.first, source.second)) return false;
+  }
+  bool hasVertexStage = std::any_of(sources.begin(), sources.end(), [](const auto& source) { return source.first == GL_VERTEX_SHADER; });
+  if (hasVertexStage) shader.bindDefaults();
+  if (!shader.linkProgram()) return false;
+  programs.emplace(std::move(key), shader);
+  ++compiledLoadCount;
+  return true;
+}
+
+void ProgramCache::clear() {
+  programs.clear();
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Linked programs shared by every shader set up through it in this process, keyed by their stage
+// sources. A hit copies the cached ofShader, which shares its GL program instead of compiling, so
+// each further ParticleField with the same settings and variants links nothing. Programs aren't kept
+// across runs: ofShader looks uniforms up in the list it records when it links, so a program restored
+// with glProgramBinary would drop every uniform set by name.
+class ProgramCache {
+public:
+  using Sources = std::vector<std::pair<GLenum, std::string>>; // stage type and source, in attach order
+
+  static ProgramCache& shared();
+
+  // False when a stage fails to compile or the program fails to link; failures aren't cached
+  bool load(ofShader& shader, const Sources& sources);
+  void clear(); // with the GL context current; shaders already set up keep their programs
+
+  size_t getCachedLoadCount() const { return cachedLoadCount; } // loads shared from the cache
+  size_t getCompiledLoadCount() const { return compiledLoadCount; }
+  size_t getProgramCount() const { return programs.size(); }
+
+private:
+  ProgramCache() = default;
+
+  std::unordered_map<std::string, ofShader> programs;
+  size_t cachedLoadCount = 0;
+  size_t compiledLoadCount = 0;
+};
+
+
+
+} // namespace ofxParticleField
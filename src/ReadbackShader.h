@@ -0,0 +1,96 @@
+#pragma once
+
+#include "CachedShader.h"
+#include "ParticleStateBuffer.h"
+#include "StateLayout.h"
+
+namespace ofxParticleField {
+
+
+
+// Gathers every stride-th active particle into consecutive texels of a float target for readback:
+// xy position and, with velocities, zw velocity. Reads state through the READ_* macros, so any
+// state layout, position encoding or the compute backend's storage buffer comes out the same.
+class ReadbackShader : public CachedShader {
+
+public:
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load()
+  void setUseStateBuffer(bool useStateBuffer_) { useStateBuffer = useStateBuffer_; } // before load()
+  void setIncludeVelocity(bool includeVelocity_) { includeVelocity = includeVelocity_; } // before load()
+
+  // Within target.begin()/end()
+  void render(const ofFbo& target, const ofFbo& stateFbo, size_t activeCount, size_t stride) {
+    renderSamples(target, stateFbo.getWidth(), activeCount, stride, [&] {
+      stateLayout.bindStateTextures(shader, stateFbo);
+    });
+  }
+
+  void render(const ofFbo& target, const ParticleStateBuffer& stateBuffer, size_t activeCount, size_t stride) {
+    renderSamples(target, stateBuffer.getWidth(), activeCount, stride, [&] {
+      stateBuffer.bind(shader);
+    });
+  }
+
+protected:
+  void renderSamples(const ofFbo& target, size_t particleDataWidth, size_t activeCount, size_t stride, const std::function<void()>& bindState) {
+    shader.begin();
+    bindState();
+    shader.setUniform1i("particleDataWidth", (int)particleDataWidth);
+    shader.setUniform1i("targetWidth", (int)target.getWidth());
+    shader.setUniform1i("activeCount", (int)activeCount);
+    shader.setUniform1i("stride", (int)stride);
+    ofDrawRectangle(0, 0, target.getWidth(), target.getHeight());
+    shader.end();
+  }
+
+  std::string getVertexShader() override {
+    return specialize(GLSL(
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+
+                void main() {
+                  gl_Position = modelViewProjectionMatrix * position;
+                }
+                ));
+  }
+
+  std::string getFragmentShader() override {
+    return specialize(GLSL(
+                STATE_DECLARATIONS
+                uniform int particleDataWidth;
+                uniform int targetWidth;
+                uniform int activeCount;
+                uniform int stride;
+                out vec4 fragColor;
+
+                void main(void) {
+                  int sampleIndex = int(gl_FragCoord.y) * targetWidth + int(gl_FragCoord.x);
+                  int particle = sampleIndex * stride;
+                  if (particle >= activeCount) {
+                    fragColor = vec4(0.0);
+                    return;
+                  }
+                  ivec2 texel = ivec2(particle % particleDataWidth, particle / particleDataWidth);
+                  fragColor = READBACK_VALUE(texel);
+                }
+                ));
+  }
+
+private:
+  // Storage buffers need GLSL 430
+  std::string specialize(const std::string& source) const {
+    ShaderDefines defines = useStateBuffer ? ParticleStateBuffer::getShaderDefines(true) : stateLayout.getShaderDefines();
+    defines.push_back({ "READBACK_VALUE(texel)", includeVelocity ? "vec4(READ_POSITION(texel), READ_VELOCITY(texel))" : "vec4(READ_POSITION(texel), 0.0, 0.0)" });
+    std::string specialized = injectDefines(source, defines);
+    return useStateBuffer ? replaceVersion(specialized, 430) : specialized;
+  }
+
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  bool useStateBuffer = false;
+  bool includeVelocity = true;
+
+};
+
+
+
+} // namespace ofxParticleField
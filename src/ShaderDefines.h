@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ofxParticleField {
+
+
+
+// Shader variants are specialized with preprocessor defines. GLSL() stringizes its argument,
+// so the variant code itself lives in the define values and the shader body only names the macros.
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+// GLSL() emits the #version line first, and defines have to follow it
+inline std::string injectDefines(const std::string& source, const ShaderDefines& defines) {
+  std::string header;
+  for (const auto& define : defines) {
+    header += "#define " + define.first + " " + define.second + "\n";
+  }
+  size_t versionLineEnd = source.find('\n');
+  if (source.compare(0, 8, "#version") != 0 || versionLineEnd == std::string::npos) {
+    return header + source;
+  }
+  return source.substr(0, versionLineEnd + 1) + header + source.substr(versionLineEnd + 1);
+}
+
+// Replaces the values of defines that are already present and appends the rest
+inline void overrideDefines(ShaderDefines& defines, const ShaderDefines& overrides) {
+  for (const auto& override : overrides) {
+    auto it = std::find_if(defines.begin(), defines.end(), [&](const auto& define) { return define.first == override.first; });
+    if (it != defines.end()) {
+      it->second = override.second;
+    } else {
+      defines.push_back(override);
+    }
+  }
+}
+
+// For shaders that need more than the GLSL() version, e.g. 430 for compute and storage buffers
+inline std::string replaceVersion(const std::string& source, int version) {
+  size_t versionLineEnd = source.find('\n');
+  if (source.compare(0, 8, "#version") != 0 || versionLineEnd == std::string::npos) return source;
+  return "#version " + std::to_string(version) + source.substr(versionLineEnd);
+}
+
+
+
+} // namespace ofxParticleField
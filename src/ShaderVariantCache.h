@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "ofLog.h"
+
+namespace ofxParticleField {
+
+
+
+// Loaded shader variants by key. warm() compiles every variant up front so that switching between
+// them at runtime never compiles; a variant first requested after warming is compiled and logged.
+template<typename ShaderType, typename VariantType>
+class ShaderVariantCache {
+public:
+  using Configure = std::function<void(ShaderType& shader, const VariantType& variant)>; // called before load()
+
+  void setup(Configure configure_) {
+    configure = std::move(configure_);
+    shaders.clear();
+    warmed = false;
+  }
+
+  ShaderType& get(const VariantType& variant) {
+    auto key = variant.getKey();
+    auto it = shaders.find(key);
+    if (it != shaders.end()) return *it->second;
+    if (warmed) ofLogWarning("ShaderVariantCache") << "compiling variant " << key << " after warm-up";
+    return load(variant);
+  }
+
+  template<typename KeyPredicate>
+  void warm(uint32_t numKeys, KeyPredicate isKeyNeeded) {
+    for (uint32_t key = 0; key < numKeys; ++key) {
+      if (isKeyNeeded(key) && shaders.find(key) == shaders.end()) load(VariantType::fromKey(key));
+    }
+    warmed = true;
+  }
+
+  size_t getLoadedCount() const { return shaders.size(); }
+
+private:
+  ShaderType& load(const VariantType& variant) {
+    auto shader = std::make_unique<ShaderType>();
+    if (configure) configure(*shader, variant);
+    shader->load();
+    ShaderType& loaded = *shader;
+    shaders[variant.getKey()] = std::move(shader);
+    return loaded;
+  }
+
+  Configure configure;
+  std::map<uint32_t, std::unique_ptr<ShaderType>> shaders;
+  bool warmed = false;
+};
+
+
+
+} // namespace ofxParticleField
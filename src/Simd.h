@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OFXPARTICLEFIELD_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OFXPARTICLEFIELD_SIMD_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define OFXPARTICLEFIELD_SIMD_NEON 1
+#endif
+
+// Minimal float vector wrapper used by the CPU backend.
+// Build with -mavx2 (or -march=native) on x86 to get 8 lanes; SSE2 is the x86-64 baseline
+// and gives 4 lanes; aarch64 uses NEON; anything else falls back to scalar.
+namespace ofxParticleField {
+namespace simd {
+
+
+
+#if defined(OFXPARTICLEFIELD_SIMD_AVX2)
+
+constexpr size_t width = 8;
+constexpr const char* name = "avx2";
+
+struct Float { __m256 v; };
+struct Mask { __m256 v; };
+
+inline Float load(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline void store(float* p, Float a) { _mm256_storeu_ps(p, a.v); }
+inline Float broadcast(float x) { return { _mm256_set1_ps(x) }; }
+inline Float iota(float start) { return { _mm256_setr_ps(start, start + 1, start + 2, start + 3, start + 4, start + 5, start + 6, start + 7) }; }
+inline Float operator+(Float a, Float b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline Float operator-(Float a, Float b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline Float operator*(Float a, Float b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline Float operator/(Float a, Float b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline Float max(Float a, Float b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline Float sqrt(Float a) { return { _mm256_sqrt_ps(a.v) }; }
+inline Float floor(Float a) { return { _mm256_floor_ps(a.v) }; }
+inline Mask greaterThan(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline Mask isNan(Float a) { return { _mm256_cmp_ps(a.v, a.v, _CMP_UNORD_Q) }; }
+inline Float select(Mask m, Float ifTrue, Float ifFalse) { return { _mm256_blendv_ps(ifFalse.v, ifTrue.v, m.v) }; }
+
+#elif defined(OFXPARTICLEFIELD_SIMD_SSE2)
+
+constexpr size_t width = 4;
+constexpr const char* name = "sse2";
+
+struct Float { __m128 v; };
+struct Mask { __m128 v; };
+
+inline Float load(const float* p) { return { _mm_loadu_ps(p) }; }
+inline void store(float* p, Float a) { _mm_storeu_ps(p, a.v); }
+inline Float broadcast(float x) { return { _mm_set1_ps(x) }; }
+inline Float iota(float start) { return { _mm_setr_ps(start, start + 1, start + 2, start + 3) }; }
+inline Float operator+(Float a, Float b) { return { _mm_add_ps(a.v, b.v) }; }
+inline Float operator-(Float a, Float b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline Float operator*(Float a, Float b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline Float operator/(Float a, Float b) { return { _mm_div_ps(a.v, b.v) }; }
+inline Float max(Float a, Float b) { return { _mm_max_ps(a.v, b.v) }; }
+inline Float sqrt(Float a) { return { _mm_sqrt_ps(a.v) }; }
+inline Mask greaterThan(Float a, Float b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline Mask isNan(Float a) { return { _mm_cmpunord_ps(a.v, a.v) }; }
+inline Float select(Mask m, Float ifTrue, Float ifFalse) {
+  return { _mm_or_ps(_mm_and_ps(m.v, ifTrue.v), _mm_andnot_ps(m.v, ifFalse.v)) };
+}
+// SSE2 has no round instruction: truncate then step down where truncation rounded up.
+// Only valid for |a| < 2^31, which holds for every value the simulation floors.
+inline Float floor(Float a) {
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+  return { _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))) };
+}
+
+#elif defined(OFXPARTICLEFIELD_SIMD_NEON)
+
+constexpr size_t width = 4;
+constexpr const char* name = "neon";
+
+struct Float { float32x4_t v; };
+struct Mask { uint32x4_t v; };
+
+inline Float load(const float* p) { return { vld1q_f32(p) }; }
+inline void store(float* p, Float a) { vst1q_f32(p, a.v); }
+inline Float broadcast(float x) { return { vdupq_n_f32(x) }; }
+inline Float iota(float start) {
+  const float values[4] = { start, start + 1, start + 2, start + 3 };
+  return { vld1q_f32(values) };
+}
+inline Float operator+(Float a, Float b) { return { vaddq_f32(a.v, b.v) }; }
+inline Float operator-(Float a, Float b) { return { vsubq_f32(a.v, b.v) }; }
+inline Float operator*(Float a, Float b) { return { vmulq_f32(a.v, b.v) }; }
+inline Float operator/(Float a, Float b) { return { vdivq_f32(a.v, b.v) }; }
+inline Float max(Float a, Float b) { return { vmaxq_f32(a.v, b.v) }; }
+inline Float sqrt(Float a) { return { vsqrtq_f32(a.v) }; }
+inline Float floor(Float a) { return { vrndmq_f32(a.v) }; }
+inline Mask greaterThan(Float a, Float b) { return { vcgtq_f32(a.v, b.v) }; }
+inline Mask isNan(Float a) { return { vmvnq_u32(vceqq_f32(a.v, a.v)) }; }
+inline Float select(Mask m, Float ifTrue, Float ifFalse) { return { vbslq_f32(m.v, ifTrue.v, ifFalse.v) }; }
+
+#else
+
+constexpr size_t width = 1;
+constexpr const char* name = "scalar";
+
+struct Float { float v; };
+struct Mask { bool v; };
+
+inline Float load(const float* p) { return { *p }; }
+inline void store(float* p, Float a) { *p = a.v; }
+inline Float broadcast(float x) { return { x }; }
+inline Float iota(float start) { return { start }; }
+inline Float operator+(Float a, Float b) { return { a.v + b.v }; }
+inline Float operator-(Float a, Float b) { return { a.v - b.v }; }
+inline Float operator*(Float a, Float b) { return { a.v * b.v }; }
+inline Float operator/(Float a, Float b) { return { a.v / b.v }; }
+inline Float max(Float a, Float b) { return { a.v > b.v ? a.v : b.v }; }
+inline Float sqrt(Float a) { return { std::sqrt(a.v) }; }
+inline Float floor(Float a) { return { std::floor(a.v) }; }
+inline Mask greaterThan(Float a, Float b) { return { a.v > b.v }; }
+inline Mask isNan(Float a) { return { a.v != a.v }; }
+inline Float select(Mask m, Float ifTrue, Float ifFalse) { return m.v ? ifTrue : ifFalse; }
+
+#endif
+
+inline Float fract(Float a) { return a - floor(a); }
+
+// GLSL mix(): x * (1 - a) + y * a
+inline Float mix(Float x, Float y, Float a) { return x * (broadcast(1.0f) - a) + y * a; }
+
+
+
+} // namespace simd
+} // namespace ofxParticleField
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+#include "SpatialSort.h"
+
+namespace ofxParticleField {
+
+
+
+namespace {
+
+constexpr float MORTON_SCALE = 65536.0f; // 16 bits per axis
+
+// Spreads the low 16 bits of x over the even bits
+uint32_t spreadBits(uint32_t x) {
+  x &= 0x0000FFFFu;
+  x = (x | (x << 8)) & 0x00FF00FFu;
+  x = (x | (x << 4)) & 0x0F0F0F0Fu;
+  x = (x | (x << 2)) & 0x33333333u;
+  x = (x | (x << 1)) & 0x55555555u;
+  return x;
+}
+
+uint32_t quantize(float value) {
+  if (!(value >= 0.0f)) return 0; // also NaN
+  return std::min((uint32_t)(value * MORTON_SCALE), (uint32_t)MORTON_SCALE - 1);
+}
+
+uint32_t mortonCode(float x, float y) {
+  return spreadBits(quantize(x)) | (spreadBits(quantize(y)) << 1);
+}
+
+} // namespace
+
+float SpatialSorter::Statistics::getGain() const {
+  float after = updateMsAfter + drawMsAfter;
+  if (after <= 0.0f || updateMsBefore + drawMsBefore <= 0.0f) return 1.0f;
+  return (updateMsBefore + drawMsBefore) / after;
+}
+
+SpatialSorter::~SpatialSorter() {
+  waitForSort();
+}
+
+void SpatialSorter::waitForSort() const {
+  while (phase == Phase::SORTING && !sortDone.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+void SpatialSorter::setup(const Settings& settings_, ReadbackSource source, const StateLayout& stateLayout, const StageTimers& timers_) {
+  release();
+  settings = settings_;
+  settings.intervalUpdates = std::max<size_t>(settings.intervalUpdates, 1);
+  settings.measureUpdates = std::clamp<size_t>(settings.measureUpdates, 1, settings.intervalUpdates);
+  readback.setup({ false, 1 }, source, stateLayout);
+  timers = &timers_;
+  updatesSinceSort = settings.intervalUpdates; // the first sort is captured straight away
+}
+
+void SpatialSorter::release() {
+  waitForSort();
+  readback.release();
+  timers = nullptr;
+  phase = Phase::IDLE;
+  measuring = false;
+  statistics = Statistics {};
+  positions.clear();
+  keys.clear();
+  permutation.clear();
+  permutationTexture.clear();
+}
+
+template<typename CaptureFunction>
+void SpatialSorter::captureWith(size_t capacity, size_t activeCount, CaptureFunction capture) {
+  if (!isCaptureDue()) return;
+  previousViewSequence = readback.getView().sequence;
+  size_t droppedBefore = readback.getDroppedCaptureCount();
+  capture();
+  if (readback.getDroppedCaptureCount() != droppedBefore) return; // tried again next update
+  capturedCapacity = capacity;
+  capturedCount = activeCount;
+  phase = Phase::CAPTURING;
+}
+
+void SpatialSorter::capture(const ofFbo& stateFbo, size_t activeCount) {
+  captureWith((size_t)(stateFbo.getWidth() * stateFbo.getHeight()), activeCount, [&] { readback.capture(stateFbo, activeCount); });
+}
+
+void SpatialSorter::capture(const ParticleStateBuffer& stateBuffer, size_t activeCount) {
+  captureWith(stateBuffer.getWidth() * stateBuffer.getHeight(), activeCount, [&] { readback.capture(stateBuffer, activeCount); });
+}
+
+void SpatialSorter::capture(const CpuSimulation& simulation) {
+  captureWith(simulation.getParticleCount(), simulation.getActiveCount(), [&] { readback.capture(simulation); });
+}
+
+void SpatialSorter::update() {
+  if (!isSetup()) return;
+  ++updatesSinceSort;
+
+  if (phase == Phase::CAPTURING) {
+    ParticleReadback::View view = readback.getView();
+    if (view.sequence > previousViewSequence) {
+      // The mapped memory is only valid until the next getView(), so the worker gets a copy
+      positions.resize(view.count * 2);
+      std::memcpy(positions.data(), view.data, positions.size() * sizeof(float));
+      capturedCount = std::min(view.count, capturedCount);
+      sortDone = false;
+      phase = Phase::SORTING;
+      pool.enqueue([this] { sortPositions(); });
+    }
+  } else if (phase == Phase::SORTING && sortDone.load(std::memory_order_acquire)) {
+    statistics.lastSortWorkMs = sortNanoseconds.load() / 1.0e6f;
+    phase = Phase::READY;
+  }
+
+  if (measuring && updatesSinceSort >= settings.measureUpdates) {
+    statistics.updateMsAfter = timers->getStats(Stage::UPDATE, settings.measureUpdates).gpu.meanMs;
+    statistics.drawMsAfter = timers->getStats(Stage::DRAW, settings.measureUpdates).gpu.meanMs;
+    measuring = false;
+  }
+}
+
+// Runs on a pool thread; only touches positions, keys and permutation until sortDone is set
+void SpatialSorter::sortPositions() {
+  auto start = std::chrono::steady_clock::now();
+  keys.resize(capturedCount);
+  for (size_t i = 0; i < capturedCount; ++i) {
+    keys[i] = ((uint64_t)mortonCode(positions[i * 2], positions[i * 2 + 1]) << 32) | (uint64_t)i;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  permutation.resize(capturedCapacity);
+  for (size_t i = 0; i < capturedCount; ++i) {
+    permutation[i] = (uint32_t)(keys[i] & 0xFFFFFFFFu);
+  }
+  std::iota(permutation.begin() + capturedCount, permutation.end(), (uint32_t)capturedCount);
+
+  auto end = std::chrono::steady_clock::now();
+  sortNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  sortDone.store(true, std::memory_order_release);
+}
+
+const ofTexture& SpatialSorter::getPermutationTexture(size_t width, size_t height) {
+  if (!permutationTexture.isAllocated() || permutationTexture.getWidth() != width || permutationTexture.getHeight() != height) {
+    ofTextureData textureData;
+    textureData.width = width;
+    textureData.height = height;
+    textureData.textureTarget = GL_TEXTURE_RECTANGLE;
+    textureData.glInternalFormat = GL_R32UI;
+    permutationTexture.allocate(textureData, GL_RED_INTEGER, GL_UNSIGNED_INT);
+    permutationTexture.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+  }
+  permutationTexture.loadData(permutation.data(), width, height, GL_RED_INTEGER, GL_UNSIGNED_INT);
+  return permutationTexture;
+}
+
+void SpatialSorter::finishPermutation(bool applied) {
+  if (phase != Phase::READY) return;
+  phase = Phase::IDLE;
+  updatesSinceSort = 0;
+  if (!applied) {
+    ++statistics.discardedSortCount;
+    return;
+  }
+  ++statistics.sortCount;
+  statistics.updateMsBefore = timers->getStats(Stage::UPDATE, settings.measureUpdates).gpu.meanMs;
+  statistics.drawMsBefore = timers->getStats(Stage::DRAW, settings.measureUpdates).gpu.meanMs;
+  statistics.updateMsAfter = 0.0f;
+  statistics.drawMsAfter = 0.0f;
+  measuring = true;
+}
+
+
+
+} // namespace ofxParticleField
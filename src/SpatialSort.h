@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "CpuSimulation.h"
+#include "ParticleReadback.h"
+#include "ParticleStateBuffer.h"
+#include "StageTimers.h"
+#include "StateLayout.h"
+#include "WorkerPool.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Plans a reordering of the particles by Morton (Z-order) code of their positions, so particles next
+// to each other in the state are also close in the field and on screen. Spread over several updates:
+// positions are captured through a ParticleReadback, sorted on a WorkerPool thread once they arrive,
+// and the permutation is handed to the owner to apply in one pass. The GPU update and draw timings
+// either side of each applied sort give the throughput gain.
+class SpatialSorter {
+public:
+  struct Settings {
+    size_t intervalUpdates = 300; // update() calls from one applied sort to the capture for the next
+    size_t measureUpdates = 60; // timing samples averaged before and after a sort
+  };
+
+  struct Statistics {
+    size_t sortCount = 0; // applied
+    size_t discardedSortCount = 0; // the particle count changed while sorting
+    float lastSortWorkMs = 0.0f; // codes and sort on the worker
+    // Mean GPU milliseconds over measureUpdates, before the last sort and after it; 0 until measured
+    float updateMsBefore = 0.0f;
+    float updateMsAfter = 0.0f;
+    float drawMsBefore = 0.0f;
+    float drawMsAfter = 0.0f;
+    float getGain() const; // update + draw time before over after; 1 until measured
+  };
+
+  explicit SpatialSorter(WorkerPool& pool = WorkerPool::shared()) : pool(pool) {}
+  ~SpatialSorter();
+  SpatialSorter(const SpatialSorter&) = delete;
+  SpatialSorter& operator=(const SpatialSorter&) = delete;
+
+  // timers are read for the gain, and must outlive the sorter
+  void setup(const Settings& settings_, ReadbackSource source, const StateLayout& stateLayout, const StageTimers& timers_);
+  void release();
+  bool isSetup() const { return timers != nullptr; }
+  const Settings& getSettings() const { return settings; }
+  const Statistics& getStatistics() const { return statistics; }
+
+  // Once per update(): counts updates, starts the sort when the captured positions have arrived
+  // and records the timings after a sort
+  void update();
+
+  bool isCaptureDue() const { return phase == Phase::IDLE && updatesSinceSort >= settings.intervalUpdates; }
+  void capture(const ofFbo& stateFbo, size_t activeCount);
+  void capture(const ParticleStateBuffer& stateBuffer, size_t activeCount);
+  void capture(const CpuSimulation& simulation);
+
+  // Source index for every particle slot, as captured; slots past the active count keep their particle
+  bool isPermutationReady() const { return phase == Phase::READY; }
+  size_t getCapturedCapacity() const { return capturedCapacity; }
+  size_t getCapturedCount() const { return capturedCount; }
+  const std::vector<uint32_t>& getPermutation() const { return permutation; }
+  const ofTexture& getPermutationTexture(size_t width, size_t height); // R32UI laid out like the state
+  // After applying the permutation, or with applied false to drop a stale one
+  void finishPermutation(bool applied);
+
+private:
+  enum class Phase { IDLE, CAPTURING, SORTING, READY };
+  template<typename CaptureFunction>
+  void captureWith(size_t capacity, size_t activeCount, CaptureFunction capture);
+  void sortPositions(); // on a worker
+  void waitForSort() const;
+
+  WorkerPool& pool;
+  Settings settings;
+  const StageTimers* timers = nullptr;
+  ParticleReadback readback;
+
+  Phase phase = Phase::IDLE;
+  size_t updatesSinceSort = 0;
+  size_t capturedCapacity = 0;
+  size_t capturedCount = 0;
+  size_t previousViewSequence = 0;
+  std::vector<float> positions; // xy of the captured particles
+  std::vector<uint64_t> keys; // Morton code above particle index
+  std::vector<uint32_t> permutation;
+  std::atomic<bool> sortDone { false };
+  std::atomic<int64_t> sortNanoseconds { 0 };
+  ofTexture permutationTexture;
+
+  bool measuring = false;
+  Statistics statistics;
+};
+
+
+
+} // namespace ofxParticleField
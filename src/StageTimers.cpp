@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <numeric>
+
+#include "StageTimers.h"
+
+namespace ofxParticleField {
+
+
+
+const char* getStageName(Stage stage) {
+  switch (stage) {
+    case Stage::UPDATE: return "update";
+    case Stage::DRAW: return "draw";
+    case Stage::RESIZE: return "resize";
+    case Stage::FIELD_UPLOAD: return "fieldUpload";
+    case Stage::POPULATION_STATS: return "populationStats";
+    case Stage::SPATIAL_SORT: return "spatialSort";
+  }
+  return "";
+}
+
+void RollingSamples::add(float ms) {
+  samples[next] = ms;
+  next = (next + 1) % samples.size();
+  count = std::min(count + 1, samples.size());
+}
+
+TimingStats RollingSamples::getStats(size_t recentCount) const {
+  TimingStats stats;
+  size_t count = (recentCount == 0) ? this->count : std::min(recentCount, this->count);
+  if (count == 0) return stats;
+  std::vector<float> sorted(count);
+  for (size_t i = 0; i < count; ++i) {
+    sorted[i] = samples[(next + samples.size() - 1 - i) % samples.size()];
+  }
+  std::sort(sorted.begin(), sorted.end());
+  stats.minMs = sorted.front();
+  stats.meanMs = std::accumulate(sorted.begin(), sorted.end(), 0.0f) / count;
+  stats.p99Ms = sorted[std::min(count - 1, (size_t)(count * 0.99f))];
+  stats.sampleCount = count;
+  return stats;
+}
+
+StageTimers::~StageTimers() {
+  for (auto& timer : timers) {
+    for (auto& query : timer.queries) {
+      if (query.start != 0) glDeleteQueries(1, &query.start);
+      if (query.end != 0) glDeleteQueries(1, &query.end);
+    }
+  }
+}
+
+void StageTimers::begin(Stage stage, bool timeGpu) {
+  StageTimer& timer = timers[(size_t)stage];
+  timer.active = enabled;
+  if (!enabled) return;
+
+  timer.timingGpu = timeGpu;
+  if (timeGpu) {
+    GpuQuery& query = timer.queries[timer.nextQuery];
+    if (query.start == 0) {
+      glGenQueries(1, &query.start);
+      glGenQueries(1, &query.end);
+    }
+    // A slot still in flight after a full ring of frames is dropped rather than waited for
+    if (query.pending) collectQuery(query, timer);
+    query.pending = false;
+    query.frame = ofGetFrameNum();
+    glQueryCounter(query.start, GL_TIMESTAMP);
+  }
+  timer.cpuStart = std::chrono::steady_clock::now();
+}
+
+void StageTimers::end(Stage stage) {
+  StageTimer& timer = timers[(size_t)stage];
+  if (!timer.active) return;
+  timer.active = false;
+
+  auto cpuEnd = std::chrono::steady_clock::now();
+  float cpuMs = std::chrono::duration<float, std::milli>(cpuEnd - timer.cpuStart).count();
+  timer.cpuSamples.add(cpuMs);
+  getFrameCost(ofGetFrameNum(), true)->cpuMs[(size_t)stage] += cpuMs;
+
+  if (timer.timingGpu) {
+    GpuQuery& query = timer.queries[timer.nextQuery];
+    glQueryCounter(query.end, GL_TIMESTAMP);
+    query.pending = true;
+    timer.nextQuery = (timer.nextQuery + 1) % QUERY_RING_SIZE;
+  }
+}
+
+bool StageTimers::collectQuery(GpuQuery& query, StageTimer& timer) {
+  GLint available = 0;
+  glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) return false;
+  GLuint64 start = 0, end = 0;
+  glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &start);
+  glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+  float gpuMs = (end - start) / 1.0e6f;
+  timer.gpuSamples.add(gpuMs);
+  if (FrameCost* frameCost = getFrameCost(query.frame, false)) frameCost->gpuMs[&timer - timers.data()] += gpuMs;
+  query.pending = false;
+  return true;
+}
+
+void StageTimers::collect() {
+  for (auto& timer : timers) {
+    for (auto& query : timer.queries) {
+      if (query.pending) collectQuery(query, timer);
+    }
+  }
+}
+
+StageStats StageTimers::getStats(Stage stage, size_t recentCount) const {
+  const StageTimer& timer = timers[(size_t)stage];
+  return { timer.cpuSamples.getStats(recentCount), timer.gpuSamples.getStats(recentCount) };
+}
+
+StageTimers::FrameCost* StageTimers::getFrameCost(uint64_t frame, bool create) {
+  FrameCost& frameCost = frameCosts[frame % FRAME_HISTORY];
+  if (frameCost.frame == frame) return &frameCost;
+  if (!create) return nullptr;
+  frameCost = FrameCost();
+  frameCost.frame = frame;
+  return &frameCost;
+}
+
+TimingStats StageTimers::getFrameStats(size_t recentFrames) const {
+  uint64_t currentFrame = ofGetFrameNum();
+  RollingSamples frameSamples(FRAME_HISTORY);
+  // Oldest first, so the most recent frames are the ones RollingSamples keeps
+  for (uint64_t age = FRAME_HISTORY - 1; age > QUERY_RING_SIZE; --age) {
+    if (age > currentFrame) continue;
+    const FrameCost& frameCost = frameCosts[(currentFrame - age) % FRAME_HISTORY];
+    if (frameCost.frame != currentFrame - age) continue;
+    float costMs = 0.0f;
+    for (size_t i = 0; i < NUM_STAGES; ++i) costMs += std::max(frameCost.cpuMs[i], frameCost.gpuMs[i]);
+    frameSamples.add(costMs);
+  }
+  return frameSamples.getStats(recentFrames);
+}
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "ofMain.h"
+
+// Build with OFX_PARTICLE_FIELD_TIMING=0 to compile the timing scopes out entirely
+#ifndef OFX_PARTICLE_FIELD_TIMING
+#define OFX_PARTICLE_FIELD_TIMING 1
+#endif
+
+namespace ofxParticleField {
+
+
+
+enum class Stage {
+  UPDATE,
+  DRAW,
+  RESIZE,
+  FIELD_UPLOAD, // field pixels to texture, or texture readback for the CPU backend
+  POPULATION_STATS,
+  SPATIAL_SORT // capturing positions for a sort and applying its permutation; the sort itself runs on a worker
+};
+static constexpr size_t NUM_STAGES = 6;
+const char* getStageName(Stage stage);
+
+struct TimingStats {
+  float minMs = 0.0f;
+  float meanMs = 0.0f;
+  float p99Ms = 0.0f;
+  size_t sampleCount = 0;
+};
+
+struct StageStats {
+  TimingStats cpu; // wall clock on the calling thread
+  TimingStats gpu; // GL timestamps, a few frames behind
+};
+
+// Last N samples in a ring; stats are computed on request
+class RollingSamples {
+public:
+  explicit RollingSamples(size_t capacity = 240) : samples(capacity) {}
+  void add(float ms);
+  TimingStats getStats(size_t recentCount = 0) const; // over the most recent samples; 0 is the whole window
+
+private:
+  std::vector<float> samples;
+  size_t next = 0;
+  size_t count = 0;
+};
+
+// CPU wall-clock and GL timestamp timing per stage. GPU results are read from a ring of
+// query pairs only once available, and dropped rather than waited for, so timing never stalls.
+// Samples are also summed per frame (ofGetFrameNum()), however many times a stage runs in it.
+class StageTimers {
+public:
+  static constexpr size_t QUERY_RING_SIZE = 8; // a few frames of a stage that runs more than once per frame
+  static constexpr size_t FRAME_HISTORY = 240;
+
+  ~StageTimers();
+
+  void setEnabled(bool enabled_) { enabled = enabled_; }
+  bool isEnabled() const { return enabled; }
+
+  void begin(Stage stage, bool timeGpu); // timeGpu needs a current GL context
+  void end(Stage stage);
+  void collect(); // reads any finished GPU queries without waiting
+  StageStats getStats(Stage stage, size_t recentCount = 0) const;
+  // Cost per frame over the most recent frames that ran any stage: the sum over stages of the larger of each
+  // stage's CPU and GPU time. The current frame, and the QUERY_RING_SIZE before it whose GPU times may still
+  // be pending, are left out.
+  TimingStats getFrameStats(size_t recentFrames) const;
+
+private:
+  struct GpuQuery {
+    GLuint start = 0;
+    GLuint end = 0;
+    bool pending = false;
+    uint64_t frame = 0;
+  };
+  struct FrameCost {
+    uint64_t frame = UINT64_MAX; // none yet
+    std::array<float, NUM_STAGES> cpuMs {};
+    std::array<float, NUM_STAGES> gpuMs {};
+  };
+  struct StageTimer {
+    bool active = false;
+    bool timingGpu = false;
+    std::chrono::steady_clock::time_point cpuStart;
+    std::array<GpuQuery, QUERY_RING_SIZE> queries;
+    size_t nextQuery = 0;
+    RollingSamples cpuSamples;
+    RollingSamples gpuSamples;
+  };
+  bool collectQuery(GpuQuery& query, StageTimer& timer);
+  FrameCost* getFrameCost(uint64_t frame, bool create); // null once the frame has left the history
+
+  bool enabled = true;
+  std::array<StageTimer, NUM_STAGES> timers;
+  std::vector<FrameCost> frameCosts = std::vector<FrameCost>(FRAME_HISTORY); // indexed by frame % FRAME_HISTORY
+};
+
+class ScopedStageTimer {
+public:
+  ScopedStageTimer(StageTimers& timers, Stage stage, bool timeGpu) : timers(timers), stage(stage) { timers.begin(stage, timeGpu); }
+  ~ScopedStageTimer() { timers.end(stage); }
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+  StageTimers& timers;
+  Stage stage;
+};
+
+
+
+} // namespace ofxParticleField
+
+#if OFX_PARTICLE_FIELD_TIMING
+#define PARTICLE_FIELD_TIME_STAGE(timers, stage, timeGpu) ofxParticleField::ScopedStageTimer particleFieldStageTimer((timers), (stage), (timeGpu))
+#else
+#define PARTICLE_FIELD_TIME_STAGE(timers, stage, timeGpu)
+#endif
@@ -0,0 +1,230 @@
+#include "StateLayout.h"
+
+namespace ofxParticleField {
+
+
+
+StateLayout StateLayout::create(StateLayoutType type, PositionEncoding positionEncoding) {
+  StateLayout layout;
+  layout.type = type;
+  layout.positionEncoding = positionEncoding;
+
+  const Attachment fixedPosition { (positionEncoding == PositionEncoding::FIXED16) ? GL_RG16UI : GL_RG32UI, "position, 0u, 1u" };
+
+  if (type == StateLayoutType::PACKED && positionEncoding == PositionEncoding::FLOAT) {
+    layout.attachments = {
+      { GL_RGBA32F, "position, velocity" },
+      { GL_RG16F, "jitter, 0.0, 1.0" },
+      { GL_R16F, "weight, 0.0, 0.0, 1.0" }
+    };
+    layout.numDynamicAttachments = 2;
+    layout.positionAttachment = PACKED_POSITION_VELOCITY_DATA_INDEX;
+    layout.velocityAttachment = PACKED_POSITION_VELOCITY_DATA_INDEX;
+    layout.jitterAttachment = PACKED_JITTER_DATA_INDEX;
+    layout.weightAttachment = PACKED_WEIGHT_DATA_INDEX;
+    return layout;
+  }
+
+  // Fixed-point positions can't share an attachment with floats, so they use the SEPARATE indices
+  layout.positionAttachment = POSITION_DATA_INDEX;
+  layout.velocityAttachment = VELOCITY_DATA_INDEX;
+  layout.jitterAttachment = JITTER_DATA_INDEX;
+  layout.weightAttachment = WEIGHT_DATA_INDEX;
+  if (type == StateLayoutType::PACKED) {
+    layout.attachments = {
+      fixedPosition,
+      { GL_RG32F, "velocity, 0.0, 1.0" },
+      { GL_RG16F, "jitter, 0.0, 1.0" },
+      { GL_R16F, "weight, 0.0, 0.0, 1.0" }
+    };
+    layout.numDynamicAttachments = 3;
+  } else {
+    // full float precision to avoid accumulation artefacts
+    layout.attachments = {
+      { GL_RG32F, "position, 0.0, 1.0" },
+      { GL_RG32F, "velocity, 0.0, 1.0" },
+      { GL_RG32F, "jitter, 0.0, 1.0" },
+      { GL_RG32F, "weight, 0.0, 0.0, 1.0" }
+    };
+    if (positionEncoding != PositionEncoding::FLOAT) layout.attachments[POSITION_DATA_INDEX] = fixedPosition;
+    layout.numDynamicAttachments = 4;
+  }
+  return layout;
+}
+
+bool StateLayout::isInteger(GLint format) {
+  return format == GL_RG16UI || format == GL_RG32UI;
+}
+
+std::vector<GLint> StateLayout::getFormats() const {
+  std::vector<GLint> formats;
+  for (const auto& attachment : attachments) {
+    formats.push_back(attachment.format);
+  }
+  return formats;
+}
+
+size_t getBytesPerTexel(GLint internalFormat) {
+  switch (internalFormat) {
+    case GL_R16F: return 2;
+    case GL_RG16F: return 4;
+    case GL_RG16UI: return 4;
+    case GL_R32F: return 4;
+    case GL_RG32F: return 8;
+    case GL_RG32UI: return 8;
+    case GL_RGBA16F: return 8;
+    case GL_RGBA32F: return 16;
+    default: return 0;
+  }
+}
+
+size_t StateLayout::getUpdateBytesPerParticle() const {
+  size_t bytes = 0;
+  for (size_t i = 0; i < attachments.size(); ++i) {
+    size_t texelBytes = getBytesPerTexel(attachments[i].format);
+    bytes += texelBytes; // read
+    if (i < numDynamicAttachments) bytes += texelBytes; // written
+  }
+  return bytes;
+}
+
+size_t StateLayout::getPositionBytesPerParticle() const {
+  return getBytesPerTexel(attachments[positionAttachment].format);
+}
+
+size_t StateLayout::getVelocityBytesPerParticle() const {
+  return isPositionVelocityPacked() ? 0 : getBytesPerTexel(attachments[velocityAttachment].format);
+}
+
+ShaderDefines StateLayout::getShaderDefines() const {
+  auto stateData = [](size_t i) { return "stateData" + std::to_string(i); };
+  auto fetch = [&](size_t i) { return "texelFetch(" + stateData(i) + ", texel)"; };
+  auto outputs = [&](size_t count) {
+    std::string declarations;
+    for (size_t i = 0; i < count; ++i) {
+      declarations += "layout(location = " + std::to_string(i) + ") out " + (isInteger(attachments[i].format) ? "uvec4" : "vec4") + " outState" + std::to_string(i) + "; ";
+    }
+    return declarations;
+  };
+  auto copies = [&]() {
+    std::string statements;
+    for (size_t i = 0; i < attachments.size(); ++i) {
+      if (i > 0) statements += "; ";
+      statements += "outState" + std::to_string(i) + " = texelFetch(" + stateData(i) + ", sourceTexel)";
+    }
+    return statements;
+  };
+  auto writes = [&](size_t count) {
+    std::string statements;
+    for (size_t i = 0; i < count; ++i) {
+      if (i > 0) statements += "; ";
+      statements += "outState" + std::to_string(i) + " = " + (isInteger(attachments[i].format) ? "uvec4(" : "vec4(") + attachments[i].components + ")";
+    }
+    return statements;
+  };
+
+  std::string declarations;
+  for (size_t i = 0; i < attachments.size(); ++i) {
+    declarations += std::string("uniform ") + (isInteger(attachments[i].format) ? "usampler2DRect " : "sampler2DRect ") + stateData(i) + "; ";
+  }
+
+  ShaderDefines defines {
+    { "STATE_DECLARATIONS", declarations },
+    { "READ_VELOCITY(texel)", fetch(velocityAttachment) + (isPositionVelocityPacked() ? ".zw" : ".xy") },
+    { "READ_JITTER(texel)", fetch(jitterAttachment) + ".xy" },
+    { "READ_WEIGHT(texel)", fetch(weightAttachment) + ".x" },
+    { "ALL_STATE_OUTPUTS", outputs(attachments.size()) },
+    { "DYNAMIC_STATE_OUTPUTS", outputs(numDynamicAttachments) },
+    // position is as returned by ENCODE_POSITION or ADVANCE_POSITION
+    { "WRITE_ALL_STATE(position, velocity, jitter, weight)", writes(attachments.size()) },
+    { "WRITE_DYNAMIC_STATE(position, velocity, jitter, weight)", writes(numDynamicAttachments) },
+    // every attachment unchanged from another texel, for reordering particles
+    { "COPY_ALL_STATE(sourceTexel)", copies() }
+  };
+
+  if (positionEncoding == PositionEncoding::FLOAT) {
+    defines.push_back({ "READ_POSITION(texel)", fetch(positionAttachment) + ".xy" });
+    defines.push_back({ "ENCODE_POSITION(position)", "(position)" });
+    defines.push_back({ "ADVANCE_POSITION(texel, position, displacement)", "fract((position) + (displacement))" });
+    return defines;
+  }
+
+  // Displacements are rounded to whole fixed-point steps. Adding a negative step as a uint
+  // wraps around the torus, so no fract() is needed; 16-bit values are masked to their width.
+  std::string scale = (positionEncoding == PositionEncoding::FIXED16) ? "65536.0" : "4294967296.0";
+  std::string mask = (positionEncoding == PositionEncoding::FIXED16) ? " & uvec2(0xFFFFu)" : "";
+  defines.push_back({ "READ_POSITION(texel)", "(vec2(" + fetch(positionAttachment) + ".xy) * (1.0 / " + scale + "))" });
+  defines.push_back({ "ENCODE_POSITION(position)", "(uvec2((position) * " + scale + ")" + mask + ")" });
+  defines.push_back({ "ADVANCE_POSITION(texel, position, displacement)",
+    "((" + fetch(positionAttachment) + ".xy + uvec2(ivec2(round((displacement) * " + scale + "))))" + mask + ")" });
+  return defines;
+}
+
+void StateLayout::bindStateTextures(ofShader& shader, const ofFbo& stateFbo) const {
+  for (size_t i = 0; i < attachments.size(); ++i) {
+    shader.setUniformTexture("stateData" + ofToString(i), stateFbo.getTexture(i), (int)i);
+  }
+}
+
+namespace {
+
+void activateDrawBuffers(size_t count) {
+  std::vector<GLenum> drawBuffers(count);
+  for (size_t i = 0; i < count; ++i) {
+    drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+  }
+  glDrawBuffers((GLsizei)count, drawBuffers.data());
+}
+
+} // namespace
+
+void StateLayout::activateAllDrawBuffers() const {
+  activateDrawBuffers(attachments.size());
+}
+
+void StateLayout::activateDynamicDrawBuffers() const {
+  activateDrawBuffers(numDynamicAttachments);
+}
+
+void StateLayout::clearAllAttachments() const {
+  activateAllDrawBuffers();
+  const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  const GLuint zeroInteger[4] = { 0, 0, 0, 0 };
+  for (size_t i = 0; i < attachments.size(); ++i) {
+    if (isInteger(attachments[i].format)) {
+      glClearBufferuiv(GL_COLOR, (GLint)i, zeroInteger);
+    } else {
+      glClearBufferfv(GL_COLOR, (GLint)i, zero);
+    }
+  }
+  glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to default attachment
+}
+
+void StateLayout::copyStaticAttachments(const ofFbo& source, const ofFbo& target) const {
+  size_t numStaticAttachments = attachments.size() - numDynamicAttachments;
+  if (numStaticAttachments == 0) return;
+  copyAttachments(source, target, numDynamicAttachments, numStaticAttachments, source.getWidth(), source.getHeight());
+}
+
+void copyAttachments(const ofFbo& source, const ofFbo& target, size_t firstAttachment, size_t count, size_t width, size_t height) {
+  GLint previousDrawFramebuffer, previousReadFramebuffer;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, source.getId());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.getId());
+  for (size_t i = firstAttachment; i < firstAttachment + count; ++i) {
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDrawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previousReadFramebuffer);
+}
+
+
+
+} // namespace ofxParticleField
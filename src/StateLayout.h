@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "ShaderDefines.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+enum class StateLayoutType {
+  SEPARATE, // four RG32F attachments: position, velocity, jitter, weight; all rewritten every step
+  PACKED    // RGBA32F position+velocity, RG16F jitter, R16F weight that only init writes
+};
+
+enum class PositionEncoding {
+  FLOAT,   // normalized floats wrapped with fract()
+  FIXED16, // RG16UI fixed-point: 1/65536 of the field everywhere, wrapped by integer overflow
+  FIXED32  // RG32UI fixed-point: same bandwidth as RG32F but uniform precision
+};
+
+// How particle state is spread over the particleDataFbo attachments. Shaders read and write
+// state through the READ_*/WRITE_* macros from getShaderDefines(), so they follow the layout.
+// Fixed-point positions take their own integer attachment in either layout.
+class StateLayout {
+public:
+  static StateLayout create(StateLayoutType type, PositionEncoding positionEncoding = PositionEncoding::FLOAT);
+
+  StateLayoutType getType() const { return type; }
+  PositionEncoding getPositionEncoding() const { return positionEncoding; }
+  size_t getNumAttachments() const { return attachments.size(); }
+  size_t getNumDynamicAttachments() const { return numDynamicAttachments; } // written by each update step; the rest are static
+  std::vector<GLint> getFormats() const;
+  size_t getPositionAttachment() const { return positionAttachment; }
+  size_t getVelocityAttachment() const { return velocityAttachment; }
+  bool isPositionVelocityPacked() const { return positionAttachment == velocityAttachment; }
+
+  size_t getUpdateBytesPerParticle() const; // read from source and written to target by one step
+  size_t getPositionBytesPerParticle() const;
+  size_t getVelocityBytesPerParticle() const; // 0 when velocity shares the position texel
+  ShaderDefines getShaderDefines() const;
+
+  // Binds attachments as stateData0..N to texture units 0..N
+  void bindStateTextures(ofShader& shader, const ofFbo& stateFbo) const;
+  // On the bound FBO
+  void activateAllDrawBuffers() const;
+  void activateDynamicDrawBuffers() const;
+  void clearAllAttachments() const;
+
+  // Keeps static attachments identical in both ping-pong FBOs after they are written on one side
+  void copyStaticAttachments(const ofFbo& source, const ofFbo& target) const;
+
+private:
+  struct Attachment {
+    GLint format;
+    std::string components; // vec4 constructor arguments in terms of position, velocity, jitter, weight
+  };
+  static bool isInteger(GLint format);
+
+  StateLayoutType type = StateLayoutType::SEPARATE;
+  PositionEncoding positionEncoding = PositionEncoding::FLOAT;
+  std::vector<Attachment> attachments;
+  size_t numDynamicAttachments = 0;
+  size_t positionAttachment = 0;
+  size_t velocityAttachment = 0;
+  size_t jitterAttachment = 0;
+  size_t weightAttachment = 0;
+};
+
+size_t getBytesPerTexel(GLint internalFormat);
+
+// glBlitFramebuffer between same-format attachments, so it works for any format and ignores blend state
+void copyAttachments(const ofFbo& source, const ofFbo& target, size_t firstAttachment, size_t count, size_t width, size_t height);
+
+
+
+} // namespace ofxParticleField
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+
+namespace ofxParticleField {
+
+
+
+// Uniforms of one integration step, shared by the CPU and compute backends
+struct StepParameters {
+  float field1ValueOffset = 0.0f;
+  float field2ValueOffset = 0.0f;
+  float field1Multiplier = 1.0f;
+  float field2Multiplier = 1.0f;
+  float velocityDamping = 1.0f;
+  float forceMultiplier = 1.0f;
+  float maxVelocity = 0.0f;
+  float jitterStrength = 0.0f;
+  float jitterSmoothing = 0.0f;
+  float jitterSeed = 0.0f;
+  float maxDisplacement = 0.0016667f; // per step, in normalized coordinates; infinite when clamping is off
+  float uniformWeight = 0.0f; // when positive, used for every particle instead of its stored weight
+  float interactionMultiplier = 1.0f; // the step's length in reference frames, as in forceMultiplier
+};
+
+// Short-range particle-particle forces, found through a neighbour grid each step and added to the field
+// force before dividing by weight. Neighbours within radius weigh in by the kernel (1 - r / radius).
+struct InteractionParameters {
+  float radius = 0.01f; // normalized; also the grid cell size, down to 1 / MAX_CELLS_PER_AXIS
+  float separation = 0.0f; // away from each neighbour
+  float alignment = 0.0f; // towards the weighted mean neighbour velocity
+  float pressure = 0.0f; // apart where the density is above restDensity, together where it is below
+  float restDensity = 2.0f; // sum of kernel^2 over the neighbours
+  int maxNeighbours = 32; // neighbours considered per particle, bounding the cost in dense clumps
+
+  static constexpr int MAX_CELLS_PER_AXIS = 256;
+  bool isEnabled() const { return radius > 0.0f && maxNeighbours > 0 && (separation != 0.0f || alignment != 0.0f || pressure != 0.0f); }
+  int getCellsPerAxis() const { return std::clamp((int)(1.0f / std::max(radius, 1e-6f)), 1, MAX_CELLS_PER_AXIS); }
+};
+
+
+
+} // namespace ofxParticleField
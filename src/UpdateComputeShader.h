@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ComputeShader.h"
+#include "Constants.h"
+#include "ParticleStateBuffer.h"
+#include "ParameterBlock.h"
+#include "StepParameters.h"
+#include "UpdateVariant.h"
+
+namespace ofxParticleField {
+
+
+
+// UpdateShader's step as a compute pass over the particle state buffer, updated in place.
+// Invocation i stands in for the fragment at texel (i % width, i / width), so jitter matches the fragment path.
+class UpdateComputeShader : public ComputeShader {
+
+public:
+  void setWorkgroupSize(size_t workgroupSize_) { workgroupSize = workgroupSize_; } // before load()
+  void setVariant(const UpdateVariant& variant_) { variant = variant_; } // before load()
+  void load() {
+    ComputeShader::load();
+    ParameterBlock::bindToProgram(shader);
+  }
+
+  // Substeps are back-to-back dispatches with only the jitter seed changing between them.
+  // With a prepared field, field1Texture is the prepared one; field2Texture is only used by two-field variants.
+  // Other parameters are read from the bound ParameterBlock; only jitterSeed is taken from parameters.
+  void dispatch(const ParticleStateBuffer& stateBuffer, size_t activeCount, const ofTexture& field1Texture, const ofTexture& field2Texture, const StepParameters& parameters, int substeps = 1) {
+    shader.begin();
+    stateBuffer.bind(shader);
+    shader.setUniform1i("activeCount", (int)activeCount);
+    variant.bindFieldTextures(shader, field1Texture, field2Texture);
+    for (int i = 0; i < substeps; ++i) {
+      if (variant.jitter) shader.setUniform1f("jitterSeed", parameters.jitterSeed + i * SUBSTEP_JITTER_SEED_OFFSET);
+      ComputeShader::dispatch(activeCount, workgroupSize);
+    }
+    shader.end();
+  }
+
+protected:
+  std::string getComputeShader() override {
+    return injectDefines(GLSL(
+                layout(local_size_x = WORKGROUP_SIZE) in;
+                STATE_DECLARATIONS
+                uniform int activeCount;
+                PARAMETER_BLOCK
+                FIELD_DECLARATIONS
+                VARIANT_DECLARATIONS
+                INTERACTION_DECLARATIONS
+
+                // Cheap per-pixel RNG (Interleaved Gradient Noise)
+                float ign(vec2 p) {
+                  return fract(52.9829189 * fract(0.06711056 * p.x + 0.00583715 * p.y));
+                }
+
+                void main(void) {
+                  int i = int(gl_GlobalInvocationID.x);
+                  if (i >= activeCount) return;
+                  vec2 fragCoord = vec2(i % stateWidth, i / stateWidth) + 0.5;
+                  Particle particle = particles[i];
+
+                  vec2 field = sampleField(particle.position);
+
+                  particle.jitter = STEP_JITTER(particle.jitter, fragCoord);
+
+                  // Apply force divided by weight (F/m = a)
+                  particle.velocity += (field * forceMultiplier + INTERACTION_FORCE(i) * interactionMultiplier) / PARTICLE_WEIGHT(particle.weight);
+                  particle.velocity += particle.jitter;
+                  particle.velocity *= velocityDamping;
+
+                  // Hard safety clamp, as in UpdateShader
+                  vec2 disp = particle.velocity * maxVelocity;
+                  CLAMP_DISPLACEMENT(disp, particle.velocity);
+
+                  particle.position = fract(particle.position + disp);
+                  particles[i] = particle;
+                }
+                ), getShaderDefines());
+  }
+
+private:
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = ParticleStateBuffer::getShaderDefines(false);
+    defines.push_back({ "WORKGROUP_SIZE", std::to_string(workgroupSize) });
+    for (const auto& define : ParameterBlock::getShaderDefines()) defines.push_back(define);
+    for (const auto& define : variant.getShaderDefines()) defines.push_back(define);
+    return defines;
+  }
+
+  size_t workgroupSize = 256;
+  UpdateVariant variant;
+
+};
+
+
+
+} // namespace ofxParticleField
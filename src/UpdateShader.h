@@ -7,41 +7,51 @@
 
 #pragma once
 
-#include "Shader.h"
+#include "CachedShader.h"
 #include "Constants.h"
+#include "GroupParameterBlock.h"
+#include "StateLayout.h"
+#include "ParameterBlock.h"
+#include "StepParameters.h"
+#include "UpdateVariant.h"
 
 namespace ofxParticleField {
 
 
 
-class UpdateShader : public Shader {
+class UpdateShader : public CachedShader {
   
 public:
-  void render(PingPongFbo& particleData, const ofTexture& field1Texture, const ofTexture& field2Texture, float field1ValueOffset, float field2ValueOffset, float field1Multiplier, float field2Multiplier, float velocityDamping, float forceMultiplier, float maxVelocity, float jitterStrength, float jitterSmoothing) {
-    particleData.getTarget().begin();
-    particleData.getTarget().activateAllDrawBuffers();
+  void setStateLayout(const StateLayout& stateLayout_) { stateLayout = stateLayout_; } // before load()
+  void setVariant(const UpdateVariant& variant_) { variant = variant_; } // before load()
+  void setGroupParameters(bool groupParameters_) { groupParameters = groupParameters_; } // before load(); reads a GroupParameterBlock
+  void load() {
+    CachedShader::load();
+    ParameterBlock::bindToProgram(shader);
+  }
+
+  // Runs substeps steps, ping-ponging between them; only the first activeRows rows of the state are stepped.
+  // With a prepared field, field1Texture is the prepared one; field2Texture is only used by two-field variants.
+  // Other parameters are read from the bound ParameterBlock; only jitterSeed is taken from parameters.
+  void render(PingPongFbo& particleData, size_t activeRows, const ofTexture& field1Texture, const ofTexture& field2Texture, const StepParameters& parameters, int substeps = 1) {
     shader.begin();
-    shader.setUniformTexture("positionData", particleData.getSource().getTexture(POSITION_DATA_INDEX), 0);
-    shader.setUniformTexture("velocityData", particleData.getSource().getTexture(VELOCITY_DATA_INDEX), 1);
-    shader.setUniformTexture("jitterData", particleData.getSource().getTexture(JITTER_DATA_INDEX), 2);
-    shader.setUniformTexture("weightData", particleData.getSource().getTexture(WEIGHT_DATA_INDEX), 5);
-    shader.setUniformTexture("field1Texture", field1Texture, 3);
-    shader.setUniformTexture("field2Texture", field2Texture, 4);
-    shader.setUniform1f("field1ValueOffset", field1ValueOffset);
-    shader.setUniform1f("field2ValueOffset", field2ValueOffset);
-    shader.setUniform1f("field1Multiplier", field1Multiplier);
-    shader.setUniform1f("field2Multiplier", field2Multiplier);
-    shader.setUniform1f("velocityDamping", velocityDamping);
-    shader.setUniform1f("forceMultiplier", forceMultiplier);
-    shader.setUniform1f("maxVelocity", maxVelocity);
-    shader.setUniform1f("jitterStrength", jitterStrength);
-    shader.setUniform1f("jitterSmoothing", jitterSmoothing);
-    shader.setUniform1f("jitterSeed", ofGetElapsedTimef());
-    particleData.getSource().draw(0, 0);
+    variant.bindFieldTextures(shader, field1Texture, field2Texture);
+    ofPushStyle();
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED); // state is data: the PACKED layout keeps velocity.y in alpha
+    ofFill();
+    for (int i = 0; i < substeps; ++i) {
+      particleData.getTarget().begin();
+      stateLayout.activateDynamicDrawBuffers(); // static attachments keep what init wrote
+      stateLayout.bindStateTextures(shader, particleData.getSource());
+      if (variant.jitter) shader.setUniform1f("jitterSeed", parameters.jitterSeed + i * SUBSTEP_JITTER_SEED_OFFSET);
+      // The source may start with an integer attachment, so a rectangle is drawn rather than its texture
+      ofDrawRectangle(0, 0, particleData.getSource().getWidth(), activeRows);
+      glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to single draw buffer after MRT
+      particleData.getTarget().end();
+      particleData.swap();
+    }
+    ofPopStyle();
     shader.end();
-    glDrawBuffer(GL_COLOR_ATTACHMENT0); // Reset to single draw buffer after MRT
-    particleData.getTarget().end();
-    particleData.swap();
   }
   
 protected:
@@ -60,28 +70,12 @@ protected:
   }
   
   std::string getFragmentShader() override {
-    return GLSL(
-                in vec2 texCoordVarying;
-                uniform sampler2DRect positionData;
-                uniform sampler2DRect velocityData;
-                uniform sampler2DRect jitterData;
-                uniform sampler2DRect weightData;
-                uniform sampler2D field1Texture;
-                uniform sampler2D field2Texture;
-                uniform float field1ValueOffset;
-                uniform float field2ValueOffset;
-                uniform float field1Multiplier;
-                uniform float field2Multiplier;
-                uniform float velocityDamping;
-                uniform float forceMultiplier;
-                uniform float maxVelocity;
-                uniform float jitterStrength;
-                uniform float jitterSmoothing;
-                uniform float jitterSeed;
-                layout(location = 0) out vec4 outPosition;
-                layout(location = 1) out vec4 outVelocity;
-                layout(location = 2) out vec4 outJitter;
-                layout(location = 3) out vec4 outWeight;
+    return injectDefines(GLSL(
+                STATE_DECLARATIONS
+                PARAMETER_BLOCK
+                FIELD_DECLARATIONS
+                VARIANT_DECLARATIONS
+                DYNAMIC_STATE_OUTPUTS
                 
                 // Cheap per-pixel RNG (Interleaved Gradient Noise)
                 float ign(vec2 p) {
@@ -89,52 +83,46 @@ protected:
                 }
 
                 void main(void) {
-                  vec2 normalizedParticlePosition = texture(positionData, texCoordVarying).xy;
-                  vec2 velocity = texture(velocityData, texCoordVarying).xy;
-                  vec2 jitterSmooth = texture(jitterData, texCoordVarying).xy;
-                  float weight = texture(weightData, texCoordVarying).x;
-                  vec2 field1 = texture(field1Texture, normalizedParticlePosition).xy + field1ValueOffset;
-                  vec2 field2 = texture(field2Texture, normalizedParticlePosition).xy + field2ValueOffset;
-                  vec2 field = field1 * field1Multiplier + field2 * field2Multiplier;
-
-                  // FIXME: where are these NaNs coming from with the VideoFlowSourceMod?
-                  if (isnan(field.x)) field.x = 0.0;
-                  if (isnan(field.y)) field.y = 0.0;
+                  ivec2 texel = ivec2(gl_FragCoord.xy);
+                  SELECT_PARAMETERS(texel);
+                  vec2 normalizedParticlePosition = READ_POSITION(texel);
+                  vec2 velocity = READ_VELOCITY(texel);
+                  vec2 jitterSmooth = READ_JITTER(texel);
+                  float weight = READ_WEIGHT(texel); // kept in state even when a uniform weight is used
+                  vec2 field = sampleField(normalizedParticlePosition);
                   
-                  vec2 rnd = vec2(
-                    ign(gl_FragCoord.xy + vec2(jitterSeed, jitterSeed * 1.37)),
-                    ign(gl_FragCoord.yx + vec2(jitterSeed * 2.17, jitterSeed * 3.13))
-                  );
-                  vec2 jitterRaw = (rnd - 0.5) * (2.0 * jitterStrength);
-                  
-                  jitterSmooth = mix(jitterSmooth, jitterRaw, jitterSmoothing);
+                  // Smoothed toward fresh per-pixel noise, or just decaying in variants without jitter
+                  jitterSmooth = STEP_JITTER(jitterSmooth, gl_FragCoord.xy);
 
                   // Apply force divided by weight (F/m = a)
                   // Heavier particles (weight > 1) accelerate less, lighter particles (weight < 1) accelerate more
-                  velocity += (field * forceMultiplier) / weight;
+                  velocity += (field * forceMultiplier) / PARTICLE_WEIGHT(weight);
                   velocity += jitterSmooth;
                   // velocity += jitterSmooth / weight; // Optional: also scale jitter by weight
                   velocity *= velocityDamping;
 
                   // Hard safety clamp: limit per-step displacement in normalized coordinates.
-                  // Target: ~6px/frame at 3600px wide => 6/3600 = 0.001666...
-                  const float maxDisp = 0.0016667;
+                  // Target: ~6px/frame at 3600px wide => 6/3600 = 0.001666... per 60Hz frame
                   vec2 disp = velocity * maxVelocity;
-                  float dispLen = length(disp);
-                  if (dispLen > maxDisp) {
-                    float scale = maxDisp / (dispLen + 1e-6);
-                    disp *= scale;
-                    // Keep stored velocity consistent with clamped displacement.
-                    velocity = disp / max(maxVelocity, 1e-6);
-                  }
-
-                  outPosition = vec4(fract(normalizedParticlePosition + disp), 0.0, 1.0);
-                  outVelocity = vec4(velocity, 0.0, 1.0);
-                  outJitter = vec4(jitterSmooth, 0.0, 1.0);
-                  outWeight = vec4(weight, 0.0, 0.0, 1.0);
+                  CLAMP_DISPLACEMENT(disp, velocity);
+
+                  WRITE_DYNAMIC_STATE(ADVANCE_POSITION(texel, normalizedParticlePosition, disp), velocity, jitterSmooth, weight);
                 }
-                );
+                ), getShaderDefines());
+  }
+  
+private:
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines = stateLayout.getShaderDefines();
+    for (const auto& define : groupParameters ? GroupParameterBlock::getShaderDefines() : ParameterBlock::getShaderDefines()) defines.push_back(define);
+    for (const auto& define : variant.getShaderDefines()) defines.push_back(define);
+    if (groupParameters) overrideDefines(defines, GroupParameterBlock::getUpdateShaderDefines());
+    return defines;
   }
+
+  StateLayout stateLayout = StateLayout::create(StateLayoutType::SEPARATE);
+  UpdateVariant variant;
+  bool groupParameters = false;
   
 };
 
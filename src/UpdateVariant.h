@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Constants.h"
+#include "ShaderDefines.h"
+#include "ofMain.h"
+
+namespace ofxParticleField {
+
+
+
+// Features of the update step that are compiled in or out. The update shaders name the macros from
+// getShaderDefines(); everything a variant leaves out is neither bound nor fetched. The parameters
+// themselves all come from the ParameterBlock, whatever the variant.
+struct UpdateVariant {
+  bool preparedField = false; // one fetch of a PreparedField instead of the raw fields
+  bool twoFields = true; // field2 is sampled; false when there is none or the field is prepared
+  bool jitter = true; // false when jitterStrength is 0: existing jitter only decays
+  bool uniformWeight = false; // every particle uses the uniformWeight uniform instead of its stored weight
+  bool clampDisplacement = true;
+  bool interaction = false; // compute backend: adds the NeighbourGridCompute force of each particle
+
+  static constexpr uint32_t NUM_KEYS = 64;
+  uint32_t getKey() const {
+    return (preparedField ? 1u : 0u) | (twoFields ? 2u : 0u) | (jitter ? 4u : 0u) | (uniformWeight ? 8u : 0u) | (clampDisplacement ? 16u : 0u) | (interaction ? 32u : 0u);
+  }
+  static UpdateVariant fromKey(uint32_t key) {
+    return { (key & 1u) != 0, (key & 2u) != 0, (key & 4u) != 0, (key & 8u) != 0, (key & 16u) != 0, (key & 32u) != 0 };
+  }
+  // preparedField makes twoFields meaningless, so only keys with it cleared are real variants
+  static bool isCanonicalKey(uint32_t key) { return !((key & 1u) && (key & 2u)); }
+
+  ShaderDefines getShaderDefines() const {
+    ShaderDefines defines;
+
+    if (preparedField) {
+      defines.push_back({ "FIELD_DECLARATIONS", "uniform sampler2D fieldTexture; vec2 sampleField(vec2 position) { return texture(fieldTexture, position).xy; }" });
+    } else {
+      // FIXME: where are these NaNs coming from with the VideoFlowSourceMod?
+      std::string declarations = "uniform sampler2D field1Texture; ";
+      std::string field = "(texture(field1Texture, position).xy + field1ValueOffset) * field1Multiplier";
+      if (twoFields) {
+        declarations += "uniform sampler2D field2Texture; ";
+        field += " + (texture(field2Texture, position).xy + field2ValueOffset) * field2Multiplier";
+      }
+      defines.push_back({ "FIELD_DECLARATIONS", declarations + "vec2 sampleField(vec2 position) { vec2 field = " + field + "; "
+                                                "if (isnan(field.x)) field.x = 0.0; if (isnan(field.y)) field.y = 0.0; return field; }" });
+    }
+
+    std::string declarations;
+    if (jitter) {
+      declarations += "uniform float jitterSeed; ";
+      defines.push_back({ "STEP_JITTER(jitter, fragCoord)",
+        "mix((jitter), (vec2(ign((fragCoord) + vec2(jitterSeed, jitterSeed * 1.37)), ign((fragCoord).yx + vec2(jitterSeed * 2.17, jitterSeed * 3.13))) - 0.5) * (2.0 * jitterStrength), jitterSmoothing)" });
+    } else {
+      defines.push_back({ "STEP_JITTER(jitter, fragCoord)", "((jitter) * (1.0 - jitterSmoothing))" });
+    }
+    if (uniformWeight) {
+      defines.push_back({ "PARTICLE_WEIGHT(stored)", "uniformWeight" });
+    } else {
+      defines.push_back({ "PARTICLE_WEIGHT(stored)", "(stored)" });
+    }
+    if (clampDisplacement) {
+      // Limits per-step displacement in normalized coordinates, keeping velocity consistent with the clamped displacement
+      defines.push_back({ "CLAMP_DISPLACEMENT(disp, velocity)",
+        "{ float dispLen = length(disp); if (dispLen > maxDisplacement) { disp *= maxDisplacement / (dispLen + 1e-6); velocity = (disp) / max(maxVelocity, 1e-6); } }" });
+    } else {
+      defines.push_back({ "CLAMP_DISPLACEMENT(disp, velocity)", "" });
+    }
+    if (interaction) {
+      defines.push_back({ "INTERACTION_DECLARATIONS", "layout(std430, binding = " + std::to_string(INTERACTION_FORCE_BINDING) + ") readonly buffer InteractionForces { vec2 interactionForces[]; };" });
+      defines.push_back({ "INTERACTION_FORCE(i)", "interactionForces[i]" });
+    } else {
+      defines.push_back({ "INTERACTION_DECLARATIONS", "" });
+      defines.push_back({ "INTERACTION_FORCE(i)", "vec2(0.0)" });
+    }
+    defines.push_back({ "VARIANT_DECLARATIONS", declarations });
+    return defines;
+  }
+
+  // A prepared field is passed as field1Texture
+  void bindFieldTextures(ofShader& shader, const ofTexture& field1Texture, const ofTexture& field2Texture) const {
+    if (preparedField) {
+      shader.setUniformTexture("fieldTexture", field1Texture, FIRST_FIELD_TEXTURE_UNIT);
+    } else {
+      shader.setUniformTexture("field1Texture", field1Texture, FIRST_FIELD_TEXTURE_UNIT);
+      if (twoFields) shader.setUniformTexture("field2Texture", field2Texture, FIRST_FIELD_TEXTURE_UNIT + 1);
+    }
+  }
+};
+
+
+
+} // namespace ofxParticleField
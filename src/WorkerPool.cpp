@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "WorkerPool.h"
+
+namespace ofxParticleField {
+
+
+
+WorkerPool::WorkerPool(size_t numThreads) {
+  if (numThreads == 0) {
+    size_t hardwareThreads = std::thread::hardware_concurrency();
+    numThreads = (hardwareThreads > 1) ? hardwareThreads - 1 : 1;
+  }
+  threads.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i) {
+    threads.emplace_back(&WorkerPool::workerLoop, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobAvailable.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+WorkerPool& WorkerPool::shared() {
+  static WorkerPool pool;
+  return pool;
+}
+
+void WorkerPool::enqueue(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  jobAvailable.notify_one();
+}
+
+void WorkerPool::workerLoop() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (stopping && jobs.empty()) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+void WorkerPool::parallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& fn) {
+  if (count == 0) return;
+  grainSize = std::max<size_t>(grainSize, 1);
+  size_t numChunks = (count + grainSize - 1) / grainSize;
+  if (numChunks == 1 || threads.empty()) {
+    fn(0, count);
+    return;
+  }
+
+  // Shared so that helpers which only get scheduled after the loop has finished still see valid state
+  struct Loop {
+    std::atomic<size_t> nextChunk { 0 };
+    std::atomic<size_t> chunksDone { 0 };
+    std::mutex doneMutex;
+    std::condition_variable done;
+  };
+  auto loop = std::make_shared<Loop>();
+
+  auto runChunks = [loop, count, grainSize, numChunks, &fn]() {
+    size_t chunk;
+    while ((chunk = loop->nextChunk.fetch_add(1)) < numChunks) {
+      size_t begin = chunk * grainSize;
+      fn(begin, std::min(begin + grainSize, count));
+      if (loop->chunksDone.fetch_add(1) + 1 == numChunks) {
+        std::lock_guard<std::mutex> lock(loop->doneMutex);
+        loop->done.notify_all();
+      }
+    }
+  };
+
+  size_t numHelpers = std::min(threads.size(), numChunks - 1);
+  for (size_t i = 0; i < numHelpers; ++i) {
+    // fn is only dereferenced while chunks remain, which is before this call returns
+    enqueue(runChunks);
+  }
+  runChunks();
+
+  std::unique_lock<std::mutex> lock(loop->doneMutex);
+  loop->done.wait(lock, [&loop, numChunks] { return loop->chunksDone.load() == numChunks; });
+}
+
+
+
+} // namespace ofxParticleField
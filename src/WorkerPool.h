@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ofxParticleField {
+
+
+
+// Fixed set of worker threads pulling jobs off a shared queue.
+// parallelFor() blocks, with the calling thread taking chunks alongside the workers.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t numThreads = 0); // 0 uses hardware_concurrency - 1
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  static WorkerPool& shared();
+
+  size_t getThreadCount() const { return threads.size(); }
+  void enqueue(std::function<void()> job);
+  void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& fn);
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable jobAvailable;
+  bool stopping = false;
+};
+
+
+
+} // namespace ofxParticleField
@@ -1,3 +1,5 @@
 #pragma once
 
+#include "FieldGenerator.h"
 #include "ParticleField.h"
+#include "ParticleFieldGroup.h"